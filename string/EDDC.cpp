@@ -2,355 +2,2731 @@
 // insertion, deletion, mutation以外にduplicationとcontractionを考慮した編集距離(ed)の計算
 // Reference: Tamar Pinhas, Shay Zakov, Dekel Tsur and Michal Ziv-Ukelson
 // "Efficient edit distance with duplications and contractions” Algorithms for Molecular Biology, 8:27 (2013)
-// To compile, perform: g++ -std=c++20 -Wall --pedantic-errors -o EDDC EDDC.cpp
+// To compile, perform: g++ -std=c++20 -O2 -pthread -Wall --pedantic-errors -o EDDC EDDC.cpp
 //--------------------------------------------------------------------------------------------------------
 #include <iostream>
 #include <string>
 #include <vector>
 #include <climits>
+#include <array>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EDDC_X86_SIMD 1
+#endif
 using namespace std;
 
-int ins(char a) { return 3; }
-int del(char a) { return 3; }
-int dup(char a) { return 2; }
-int cont(char a) { return 2; }
-// 塩基置換はKimuraの2-parameterモデルを使用
-int alpha = 1;
-int beta = 3;
-int mut(char a, char b)
-{
-    if (a == b) return 0;
-    else if ((a == 'A' && b == 'G') || (a == 'G' && b  == 'A') || 
-            (a == 'C' && b == 'T') || (a == 'T' && b == 'C')) return alpha;
-    else return beta;
+//--------------------------------------------------------------------------------------------------------
+// コストモデル
+// EDDC<Cost>はCost::NUM_ALPHABET, ALPHABET, 文字ごとのINS, DEL, DUP, CONTとMUT[a][b] (aをbに置換)を
+// constexprとして参照するので、alphabetのループは展開され、コストの参照に実行時の分岐は入らない
+// 別の置換モデルを使うときは同じメンバを持つstructを定義してEDDC<MyCost>とする
+//--------------------------------------------------------------------------------------------------------
+// 塩基置換はKimuraの2-parameterモデルを使用 (transition: Alpha, transversion: Beta)
+template <int Alpha = 1, int Beta = 3, int Indel = 3, int DupCont = 2>
+struct Kimura2ParameterCost
+{
+    static constexpr int  NUM_ALPHABET = 4;
+    static constexpr char ALPHABET[NUM_ALPHABET] = {'A', 'C', 'G', 'T'};
+    static constexpr int  INS [NUM_ALPHABET] = {Indel,   Indel,   Indel,   Indel  };
+    static constexpr int  DEL [NUM_ALPHABET] = {Indel,   Indel,   Indel,   Indel  };
+    static constexpr int  DUP [NUM_ALPHABET] = {DupCont, DupCont, DupCont, DupCont};
+    static constexpr int  CONT[NUM_ALPHABET] = {DupCont, DupCont, DupCont, DupCont};
+    static constexpr int  MUT [NUM_ALPHABET][NUM_ALPHABET] =
+    {
+        //  A      C      G      T
+        {0,     Beta,  Alpha, Beta },  // A
+        {Beta,  0,     Beta,  Alpha},  // C
+        {Alpha, Beta,  0,     Beta },  // G
+        {Beta,  Alpha, Beta,  0    },  // T
+    };
+};
+
+// Cost::ALPHABETの文字(小文字も可)を0, 1, ...に写す表. それ以外の文字はNUM_ALPHABETになる
+template <class Cost>
+constexpr array<uint8_t, 256> make_letter_codes()
+{
+    array<uint8_t, 256> codes {};
+    codes.fill(Cost::NUM_ALPHABET);
+    for (int k = 0; k < Cost::NUM_ALPHABET; k++)
+    {
+        char c = Cost::ALPHABET[k];
+        codes[static_cast<unsigned char>(c)] = k;
+        if (c >= 'A' && c <= 'Z') codes[static_cast<unsigned char>(c - 'A' + 'a')] = k;
+    }
+    return codes;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// DPテーブルのセルの型(Cell)
+// int16_tは編集距離の上界が16bitに収まるときに使い、テーブルのメモリを半分、min-plusのSIMDのレーン数を倍にする
+// INFは枝刈りしたセルの値とmin-plusの初期値. 2つのセルの和はintで(SIMDのint16_tでは飽和させて)計算し、
+// INFから始めたminに入れるので、どのセルの値もmin(真の値, INF)になり、INF未満の結果は正確
+// intのINFは2つ足してもあふれないINT_MAX / 4とする
+//--------------------------------------------------------------------------------------------------------
+template <class Cell> struct CellTraits;
+template <> struct CellTraits<int>     { static constexpr int INF = INT_MAX / 4; };
+template <> struct CellTraits<int16_t> { static constexpr int INF = INT16_MAX; };
+
+// 区間[i, j) (0 <= i <= j <= len)を添字とするDPテーブルのview
+// i < jの上三角部分だけを行優先に詰めて持ち、同じ区間のalphabet[k]の値は隣接させる(letter-interleaved)
+// max_width_ < len_なら長さmax_width_以下の区間だけを帯状に持つ(行iは[i, i + max_width_]の分)
+template <class Cell = int>
+struct IntervalTableView
+{
+    Cell * data_       {nullptr};
+    int   len_         {0};       // 文字列の長さ
+    int   num_alphabet_{1};       // 1区間あたりの値の数
+    int   max_width_   {INT_MAX}; // これより長い区間は持たない
+
+    static size_t num_cells(const int len, const int max_width = INT_MAX)
+    {
+        if (max_width < len) return static_cast<size_t>(len + 1) * (max_width + 1);
+        return static_cast<size_t>(len + 1) * (len + 2) / 2;
+    }
+
+    bool in_band(const int i, const int j) const { return j - i <= max_width_; }
+
+    size_t cell(const int i, const int j) const
+    {
+        if (max_width_ < len_) return static_cast<size_t>(i) * (max_width_ + 1) + (j - i);
+        // 行iの先頭は sum_{r < i} (len_ + 1 - r) = i * (2 * len_ + 3 - i) / 2
+        return static_cast<size_t>(i) * (2 * len_ + 3 - i) / 2 + (j - i);
+    }
+    Cell & operator()(const int k, const int i, const int j) const { return data_[cell(i, j) * num_alphabet_ + k]; }
+    Cell & operator()(const int i, const int j)              const { return data_[cell(i, j)]; }
+};
+
+// IntervalTableViewの列優先版
+// 列jに属する区間[h, j) (0 <= h <= j)の値が連続するので、Equation 3/6/9の列方向の走査が連続アクセスになる
+template <class Cell = int>
+struct IntervalColumnView
+{
+    Cell * data_       {nullptr};
+    int   len_         {0};
+    int   num_alphabet_{1};
+    int   max_width_   {INT_MAX}; // max_width_ < len_なら列jは[j - max_width_, j]の分だけを持つ
+
+    static size_t num_cells(const int len, const int max_width = INT_MAX) { return IntervalTableView<Cell>::num_cells(len, max_width); }
+
+    bool in_band(const int i, const int j) const { return j - i <= max_width_; }
+
+    size_t cell(const int i, const int j) const
+    {
+        if (max_width_ < len_) return static_cast<size_t>(j) * (max_width_ + 1) + (max_width_ - (j - i));
+        return static_cast<size_t>(j) * (j + 1) / 2 + i;
+    }
+    Cell & operator()(const int k, const int i, const int j) const { return data_[cell(i, j) * num_alphabet_ + k]; }
+    Cell & operator()(const int i, const int j)              const { return data_[cell(i, j)]; }
+};
+
+// (i, j)を添字とする長方形のDPテーブルのview
+// IntervalTableViewと同様に同じ(i, j)のalphabet[k]の値は隣接させる
+template <class Cell = int>
+struct MatrixView
+{
+    Cell * data_       {nullptr};
+    int   rows_        {0};
+    int   cols_        {0};
+    int   num_alphabet_{1};
+    bool  col_major_   {false};   // trueなら同じ列jの値が連続する
+    int   col_mask_    {-1};      // 列優先のときjに&する. 0なら1列分の領域を全ての列で使い回す
+    int   band_        {-1};      // 0以上なら|i - j| <= band_のセルだけを帯状に持つ
+
+    static size_t num_cells(const int rows, const int cols, const int band = -1)
+    {
+        if (band >= 0) return static_cast<size_t>(max(rows, cols)) * (2 * band + 1);
+        return static_cast<size_t>(rows) * cols;
+    }
+
+    bool in_band(const int i, const int j) const { return band_ < 0 || abs(i - j) <= band_; }
+
+    size_t cell(const int i, const int j) const
+    {
+        if (band_ >= 0)
+        {
+            return col_major_ ? static_cast<size_t>(j) * (2 * band_ + 1) + (i - j + band_) : static_cast<size_t>(i) * (2 * band_ + 1) + (j - i + band_);
+        }
+        return col_major_ ? static_cast<size_t>(j & col_mask_) * rows_ + i : static_cast<size_t>(i) * cols_ + j;
+    }
+    Cell & operator()(const int k, const int i, const int j) const { return data_[cell(i, j) * num_alphabet_ + k]; }
+    Cell & operator()(const int i, const int j)              const { return data_[cell(i, j)]; }
+};
+
+// 1本の文字列だけで決まるStage 1のテーブル一式(source側またはtarget側)のview
+template <class Cell = int>
+struct Stage1Views
+{
+    IntervalTableView<Cell>  empty_;           // 空文字列との編集距離
+    IntervalTableView<Cell>  alphabet_;        // alphabet[k]との編集距離
+    IntervalTableView<Cell>  alphabet_nonmut_; // alphabet[k]側の操作がmutでないもの (source側: non-generating, target側: non-reducing)
+    IntervalColumnView<Cell> empty_col_;       // empty_の列優先ミラー
+    IntervalColumnView<Cell> alphabet_col_;    // alphabet_の列優先ミラー
+
+    static size_t num_cells(const int len, const int num_alphabet, const int max_width = INT_MAX)
+    {
+        return IntervalTableView<Cell>::num_cells(len, max_width) * (2 + 3 * num_alphabet);
+    }
+
+    // pから順に各テーブルを割り当て、使い終わった位置を返す(max_width < lenなら帯状に持つ)
+    Cell * carve(Cell * p, const int len, const int num_alphabet, const int max_width = INT_MAX)
+    {
+        auto take = [&](auto & v, const int width)
+        {
+            v = {p, len, width, max_width};
+            p += IntervalTableView<Cell>::num_cells(len, max_width) * width;
+        };
+        take(empty_,           1);
+        take(alphabet_,        num_alphabet);
+        take(alphabet_nonmut_, num_alphabet);
+        take(empty_col_,       1);
+        take(alphabet_col_,    num_alphabet);
+        return p;
+    }
+};
+
+// Stage1Viewsとその実体を持つ。EDDCBatchが文字列ごとに1度だけ計算して複数の組で使い回す
+template <class Cell = int>
+struct Stage1Tables
+{
+    string            seq_;
+    vector<Cell>      buffer_;
+    Stage1Views<Cell> views_;
+    int               max_width_ {INT_MAX}; // これより長い区間は計算していない(持たない). EDDC::compute_edit_distance(max_distance)用
+
+    Stage1Tables() = default;
+    Stage1Tables(Stage1Tables &&) = default;
+    Stage1Tables & operator=(Stage1Tables &&) = default;
+    Stage1Tables(const Stage1Tables &) = delete;            // views_がbuffer_を指すのでコピーはしない
+    Stage1Tables & operator=(const Stage1Tables &) = delete;
+
+    size_t get_bytes() const { return buffer_.size() * sizeof(Cell); }
+};
+
+// Stage 1の各セルで選んだ候補(traceback用). 添字はStage1Viewsの同じ区間のcell(i, j)
+struct Stage1Choices
+{
+    vector<uint32_t> split_;  // Equation 3/6: (h - i - 1) << 2 | 項(0: 左がalphabet, 1: 右がalphabet, 2: dup/cont)
+    vector<uint8_t>  mut_;    // Equation 2/5: 経由したalphabet[l]のl
+    vector<uint8_t>  empty_;  // Equation 1/4: 経由したalphabet[k]のk
+
+    void resize(const int len, const int num_alphabet)
+    {
+        size_t cells = IntervalTableView<>::num_cells(len);
+        split_.assign(cells * num_alphabet, 0);
+        mut_.assign(cells * num_alphabet, 0);
+        empty_.assign(cells, 0);
+    }
+
+    void release()
+    {
+        vector<uint32_t>().swap(split_);
+        vector<uint8_t>().swap(mut_);
+        vector<uint8_t>().swap(empty_);
+    }
+
+    size_t get_bytes() const { return split_.capacity() * sizeof(uint32_t) + mut_.capacity() + empty_.capacity(); }
+};
+
+// 文字列のrun (同じ文字の連続)の位置. runの内部の枝刈り(set_run_pruning)で長いrunの内部の分割位置を読み飛ばすのに使う
+struct RunIndex
+{
+    static constexpr int MIN_SKIPPED = 32; // 内部(先頭と末尾以外)がこれより短いrunは読み飛ばすより走査した方が速い
+
+    vector<int> next_run_;   // next_run_[p]: p以上で最初のrunの先頭(なければlen)
+    vector<int> next_long_;  // next_long_[p]: p以上で最初の、内部がMIN_SKIPPEDより長いrunの先頭(なければlen)
+
+    void build(const vector<uint8_t> & code)
+    {
+        int len = code.size();
+        next_run_.resize(len + 1);
+        next_long_.resize(len + 1);
+        next_run_[len] = next_long_[len] = len;
+        for (int p = len - 1; p >= 0; p--)
+        {
+            bool start = (p == 0 || code[p - 1] != code[p]);
+            next_run_[p] = start ? p : next_run_[p + 1];
+            next_long_[p] = (start && next_run_[p + 1] - p - 1 > MIN_SKIPPED) ? p : next_long_[p + 1];
+        }
+    }
+};
+
+// 編集スクリプトの1操作
+// s_begin, s_end / t_begin, t_endはこの操作が関わるs_ / t_の区間
+// 削除されるsourceの区間や挿入されるtargetの区間の操作では、反対側は空区間になる
+struct EditOperation
+{
+    enum Type { MATCH, MUTATION, INSERTION, DELETION, DUPLICATION, CONTRACTION };
+
+    Type type;
+    char from;      // 操作前の文字 (INSERTIONでは'-')
+    char to;        // 操作後の文字 (DELETIONでは'-')
+    int  cost;
+    int  s_begin;
+    int  s_end;
+    int  t_begin;
+    int  t_end;
+    int  split {-1}; // DUPLICATIONで2つに分かれるt_の位置、CONTRACTIONで縮約される2つの境目のs_の位置. それ以外は-1
+};
+
+// scriptをsに先頭から適用してtになるか確かめる(EDDC::compute_edit_scriptの検査用)
+// 文字列を区間付きの文字の並びとして持ち、s_側の操作(縮約、削除、縮約側のmut)はs_の区間に含まれる文字に、
+// t_側の操作(生成、挿入、生成側のmut)はt_の区間を含む文字に適用する. 挿入は区間を含む文字の前後に置き、その文字の区間を縮める
+// 最後に全ての文字が長さ1のt_の区間を持ち、左から順にtを綴っていればtrue
+inline bool replay_edit_script(const string & s, const string & t, const vector<EditOperation> & script)
+{
+    struct Token { char c; int s_begin, s_end, t_begin, t_end; };
+    vector<Token> tokens;
+    for (int i = 0; i < static_cast<int>(s.size()); i++) tokens.push_back({s[i], i, i + 1, -1, -1});
+    auto t_assigned = [](const Token & x) { return x.t_begin >= 0 && x.t_begin < x.t_end; };
+    // s_の区間[a, b)に含まれる(元のs_の文字から来た)文字
+    auto within_s = [&](const int a, const int b)
+    {
+        vector<int> found;
+        for (int x = 0; x < static_cast<int>(tokens.size()); x++)
+        {
+            if (tokens[x].s_begin < tokens[x].s_end && a <= tokens[x].s_begin && tokens[x].s_end <= b) found.push_back(x);
+        }
+        return found;
+    };
+    // t_の区間[a, b)を含む文字. なければ-1
+    auto containing_t = [&](const int a, const int b)
+    {
+        for (int x = 0; x < static_cast<int>(tokens.size()); x++)
+        {
+            if (t_assigned(tokens[x]) && tokens[x].t_begin <= a && b <= tokens[x].t_end) return x;
+        }
+        return -1;
+    };
+    // 操作を適用する文字: s_の区間が空でなくその中の文字が1つならそれ(初めてt_の区間を持つならop.t_の区間にする)、
+    // そうでなければt_の区間を含む文字
+    auto target_of = [&](const EditOperation & op)
+    {
+        if (op.s_begin < op.s_end)
+        {
+            vector<int> found = within_s(op.s_begin, op.s_end);
+            if (found.size() == 1)
+            {
+                Token & x = tokens[found[0]];
+                if (!t_assigned(x)) x.t_begin = op.t_begin, x.t_end = op.t_end;
+                return found[0];
+            }
+        }
+        return (op.t_begin < op.t_end) ? containing_t(op.t_begin, op.t_end) : -1;
+    };
+
+    for (const auto & op : script)
+    {
+        switch (op.type)
+        {
+            case EditOperation::MATCH:
+            case EditOperation::MUTATION:
+            {
+                int x = target_of(op);
+                if (x < 0 || tokens[x].c != op.from) return false;
+                tokens[x].c = op.to;
+                break;
+            }
+            case EditOperation::DELETION:
+            {
+                vector<int> found = within_s(op.s_begin, op.s_end);
+                if (found.size() != 1 || tokens[found[0]].c != op.from) return false;
+                tokens.erase(tokens.begin() + found[0]);
+                break;
+            }
+            case EditOperation::CONTRACTION:
+            {
+                vector<int> left = within_s(op.s_begin, op.split);
+                vector<int> right = within_s(op.split, op.s_end);
+                if (left.size() != 1 || right.size() != 1 || right[0] != left[0] + 1) return false;
+                if (tokens[left[0]].c != op.from || tokens[right[0]].c != op.from) return false;
+                tokens[left[0]].s_end = op.s_end;
+                tokens.erase(tokens.begin() + right[0]);
+                break;
+            }
+            case EditOperation::DUPLICATION:
+            {
+                int x = target_of(op);
+                if (x < 0 || tokens[x].c != op.from || op.split <= tokens[x].t_begin || op.split >= tokens[x].t_end) return false;
+                Token right = tokens[x];
+                right.t_begin = tokens[x].t_end = op.split;
+                tokens.insert(tokens.begin() + x + 1, right);
+                break;
+            }
+            case EditOperation::INSERTION:
+            {
+                Token inserted {op.to, op.s_begin, op.s_begin, op.t_begin, op.t_end};
+                int x = containing_t(op.t_begin, op.t_end);
+                if (x >= 0)
+                {
+                    // 区間の先頭か末尾を挿入した文字に渡す
+                    if (tokens[x].t_begin == op.t_begin && op.t_end < tokens[x].t_end)
+                    {
+                        tokens[x].t_begin = op.t_end;
+                        tokens.insert(tokens.begin() + x, inserted);
+                    }
+                    else if (tokens[x].t_end == op.t_end && tokens[x].t_begin < op.t_begin)
+                    {
+                        tokens[x].t_end = op.t_begin;
+                        tokens.insert(tokens.begin() + x + 1, inserted);
+                    }
+                    else return false;
+                }
+                else
+                {
+                    // どの文字からも生成されない区間は、その後ろに来るt_またはs_の文字の前に置く
+                    auto after = find_if(tokens.begin(), tokens.end(), [&](const Token & y)
+                    {
+                        return t_assigned(y) ? y.t_begin >= op.t_end : (y.s_begin < y.s_end && y.s_begin >= op.s_begin);
+                    });
+                    tokens.insert(after, inserted);
+                }
+                break;
+            }
+        }
+    }
+    if (tokens.size() != t.size()) return false;
+    for (int x = 0; x < static_cast<int>(tokens.size()); x++)
+    {
+        if (tokens[x].t_begin != x || tokens[x].t_end != x + 1 || tokens[x].c != t[x]) return false;
+    }
+    return true;
+}
+
+// NONE: 距離だけ計算する
+// FULL: fillで選んだ候補を全て保存し、tracebackはそれを辿るだけ
+// CHECKPOINTED: Stage 2はed_と、ed_で選んだ候補だけを保存してedt_は1列を使い回す
+//               Stage 1の候補も保存せず、tracebackで通る区間とedt_の列だけを再計算する
+enum class TracebackMode { NONE, FULL, CHECKPOINTED };
+
+// EDDC::compute_edit_distance()の計算方法
+// BANDEDとAUTOは編集距離が長さより十分小さい組のための帯の中だけの近道で、最悪の計算量はCUBICと同じO(|Σ| n^3)
+// (隣り合うセルの差が有界なことを使う劣3乗のmin-plus積やFour-Russiansの表引きは使っていない)
+// CUBIC:  全てのセルを計算する. 時間O(|Σ| n^3), メモリO(|Σ| n^2)
+// BANDED: 上限Dを倍にしながらcompute_edit_distance(D)を呼び、D以下に収まったところで返す
+//         長さを1変える操作のコストの最小値をc_minとすると、ed_の隣り合うセルの差もStage 1の区間の値も
+//         c_minで押さえられるので、コストD以下の編集パスは対角線から幅D / c_minの帯に収まり、
+//         分割位置もその幅の中に限られる. 時間O(|Σ| n (d / c_min)^2), メモリO(|Σ| n d / c_min) (dは編集距離)
+// AUTO:   既定. BANDEDと同じく上限を倍にするが、帯の幅D / c_minが長い方の長さの1/4を超える上限は試さずにCUBICで1回計算する
+//         帯の幅がnに近い計算を何度も繰り返すと、離れた配列の組ではBANDEDはCUBICの1.3-1.8倍かかる
+//         幅n / 4までの計算は合わせてCUBICの1-2割程度なので、似た配列の組ではBANDEDの速さを保ったまま最悪でもその程度の損で済む
+enum class DistanceEngine { CUBIC, BANDED, AUTO };
+
+// 直前の計算の各段階にかかった秒数 (EDDC::get_stage_times)
+// Stage 1の両側を並行に計算したときはそれぞれの経過時間. BANDEDでは上限を倍にした各回の合計
+struct StageTimes
+{
+    double stage1_source_ {0.0}; // Equation 4-6
+    double stage1_target_ {0.0}; // Equation 1-3
+    double stage2_        {0.0}; // Equation 8, 9
+    double traceback_     {0.0}; // compute_edit_scriptで編集スクリプトを辿る部分
+
+    StageTimes & operator+=(const StageTimes & other)
+    {
+        stage1_source_ += other.stage1_source_;
+        stage1_target_ += other.stage1_target_;
+        stage2_        += other.stage2_;
+        traceback_     += other.traceback_;
+        return *this;
+    }
+
+    double total() const { return stage1_source_ + stage1_target_ + stage2_ + traceback_; }
+};
+
+//--------------------------------------------------------------------------------------------------------
+// min-plusのリダクションカーネル
+// 値はletter-interleaved (a[g * num_alphabet + k])で並んでいるので、num_alphabet = 4のときは
+// SSE 1レジスタ = 1グループ(int16_tなら2グループ), AVX2 1レジスタ = 2グループ(同4グループ)としてkの方向をそのままレーンに載せる
+// min_plus_interleaved: acc[k] = min(acc[k], min_g a[g][k] + b[g][k])
+// min_plus_broadcast:   acc[k] = min(acc[k], min_g a[g][k] + y[g])
+// accはCellTraits<Cell>::INF以下から始めるので結果もINF以下に収まる(int16_tのSIMD版は足し算を飽和させる)
+//--------------------------------------------------------------------------------------------------------
+template <class Cell>
+void min_plus_interleaved_scalar(const Cell * a, const Cell * b, const int num_groups, const int num_alphabet, Cell * acc)
+{
+    for (int g = 0; g < num_groups; g++)
+    {
+        for (int k = 0; k < num_alphabet; k++)
+        {
+            acc[k] = min<int>(acc[k], a[g * num_alphabet + k] + b[g * num_alphabet + k]);
+        }
+    }
+}
+
+template <class Cell>
+void min_plus_broadcast_scalar(const Cell * a, const Cell * y, const int num_groups, const int num_alphabet, Cell * acc)
+{
+    for (int g = 0; g < num_groups; g++)
+    {
+        for (int k = 0; k < num_alphabet; k++)
+        {
+            acc[k] = min<int>(acc[k], a[g * num_alphabet + k] + y[g]);
+        }
+    }
+}
+
+// 上の2つでacc[k]を更新したときにarg[k] = gも記録する版(同じ値なら小さいgを残す). traceback用
+template <class Cell>
+void min_plus_interleaved_arg_scalar(const Cell * a, const Cell * b, const int num_groups, const int num_alphabet, Cell * acc, int * arg)
+{
+    for (int g = 0; g < num_groups; g++)
+    {
+        for (int k = 0; k < num_alphabet; k++)
+        {
+            int v = a[g * num_alphabet + k] + b[g * num_alphabet + k];
+            if (v < acc[k])
+            {
+                acc[k] = v;
+                arg[k] = g;
+            }
+        }
+    }
+}
+
+template <class Cell>
+void min_plus_broadcast_arg_scalar(const Cell * a, const Cell * y, const int num_groups, const int num_alphabet, Cell * acc, int * arg)
+{
+    for (int g = 0; g < num_groups; g++)
+    {
+        for (int k = 0; k < num_alphabet; k++)
+        {
+            int v = a[g * num_alphabet + k] + y[g];
+            if (v < acc[k])
+            {
+                acc[k] = v;
+                arg[k] = g;
+            }
+        }
+    }
+}
+
+#ifdef EDDC_X86_SIMD
+__attribute__((target("sse4.1")))
+void min_plus_interleaved_sse41(const int * a, const int * b, const int num_groups, const int, int * acc)
+{
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc));
+    for (int g = 0; g < num_groups; g++)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 4 * g));
+        m = _mm_min_epi32(m, _mm_add_epi32(va, vb));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), m);
+}
+
+__attribute__((target("sse4.1")))
+void min_plus_broadcast_sse41(const int * a, const int * y, const int num_groups, const int, int * acc)
+{
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc));
+    for (int g = 0; g < num_groups; g++)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        m = _mm_min_epi32(m, _mm_add_epi32(va, _mm_set1_epi32(y[g])));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), m);
+}
+
+// arg版はgのベクトルをblendで残す. AVX2のCPUでもこちらを使う
+__attribute__((target("sse4.1")))
+void min_plus_interleaved_arg_sse41(const int * a, const int * b, const int num_groups, const int, int * acc, int * arg)
+{
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc));
+    __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(arg));
+    __m128i vg = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    for (int g = 0; g < num_groups; g++)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 4 * g));
+        __m128i v = _mm_add_epi32(va, vb);
+        idx = _mm_blendv_epi8(idx, vg, _mm_cmpgt_epi32(m, v));
+        m = _mm_min_epi32(m, v);
+        vg = _mm_add_epi32(vg, one);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), m);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(arg), idx);
+}
+
+__attribute__((target("sse4.1")))
+void min_plus_broadcast_arg_sse41(const int * a, const int * y, const int num_groups, const int, int * acc, int * arg)
+{
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc));
+    __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(arg));
+    __m128i vg = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    for (int g = 0; g < num_groups; g++)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i v = _mm_add_epi32(va, _mm_set1_epi32(y[g]));
+        idx = _mm_blendv_epi8(idx, vg, _mm_cmpgt_epi32(m, v));
+        m = _mm_min_epi32(m, v);
+        vg = _mm_add_epi32(vg, one);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), m);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(arg), idx);
+}
+
+__attribute__((target("avx2")))
+void min_plus_interleaved_avx2(const int * a, const int * b, const int num_groups, const int, int * acc)
+{
+    // 2つのアキュムレータで依存チェーンを切る(1ループで4グループ)
+    __m256i m0 = _mm256_set1_epi32(CellTraits<int>::INF);
+    __m256i m1 = _mm256_set1_epi32(CellTraits<int>::INF);
+    int g = 0;
+    for (; g + 4 <= num_groups; g += 4)
+    {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 4 * g));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g + 8));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 4 * g + 8));
+        m0 = _mm256_min_epi32(m0, _mm256_add_epi32(a0, b0));
+        m1 = _mm256_min_epi32(m1, _mm256_add_epi32(a1, b1));
+    }
+    m0 = _mm256_min_epi32(m0, m1);
+    __m128i m = _mm_min_epi32(_mm256_castsi256_si128(m0), _mm256_extracti128_si256(m0, 1));
+    m = _mm_min_epi32(m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc)));
+    for (; g < num_groups; g++)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 4 * g));
+        m = _mm_min_epi32(m, _mm_add_epi32(va, vb));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), m);
+}
+
+__attribute__((target("avx2")))
+void min_plus_broadcast_avx2(const int * a, const int * y, const int num_groups, const int, int * acc)
+{
+    // y[g], y[g + 1]をそれぞれ下位/上位128bitの4レーンに広げる
+    const __m256i spread = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    __m256i m0 = _mm256_set1_epi32(CellTraits<int>::INF);
+    __m256i m1 = _mm256_set1_epi32(CellTraits<int>::INF);
+    int g = 0;
+    for (; g + 4 <= num_groups; g += 4)
+    {
+        __m256i y0 = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(y + g))), spread);
+        __m256i y1 = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(y + g + 2))), spread);
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g + 8));
+        m0 = _mm256_min_epi32(m0, _mm256_add_epi32(a0, y0));
+        m1 = _mm256_min_epi32(m1, _mm256_add_epi32(a1, y1));
+    }
+    m0 = _mm256_min_epi32(m0, m1);
+    __m128i m = _mm_min_epi32(_mm256_castsi256_si128(m0), _mm256_extracti128_si256(m0, 1));
+    m = _mm_min_epi32(m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc)));
+    for (; g < num_groups; g++)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        m = _mm_min_epi32(m, _mm_add_epi32(va, _mm_set1_epi32(y[g])));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), m);
+}
+
+// int16_t版: SSE 1レジスタに2グループ、AVX2 1レジスタに4グループを載せる
+// 値は0以上なので_mm_adds_epi16はCellTraits<int16_t>::INF (= INT16_MAX)で飽和する
+__attribute__((target("sse4.1")))
+void min_plus_interleaved_sse41_i16(const int16_t * a, const int16_t * b, const int num_groups, const int, int16_t * acc)
+{
+    __m128i m = _mm_set1_epi16(CellTraits<int16_t>::INF);
+    int g = 0;
+    for (; g + 2 <= num_groups; g += 2)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, vb));
+    }
+    m = _mm_min_epi16(m, _mm_srli_si128(m, 8));
+    m = _mm_min_epi16(m, _mm_loadl_epi64(reinterpret_cast<const __m128i *>(acc)));
+    if (g < num_groups)
+    {
+        __m128i va = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i vb = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(b + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, vb));
+    }
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(acc), m);
+}
+
+__attribute__((target("sse4.1")))
+void min_plus_broadcast_sse41_i16(const int16_t * a, const int16_t * y, const int num_groups, const int, int16_t * acc)
+{
+    __m128i m = _mm_set1_epi16(CellTraits<int16_t>::INF);
+    int g = 0;
+    for (; g + 2 <= num_groups; g += 2)
+    {
+        // y[g], y[g + 1]をそれぞれ下位/上位64bitの4レーンに広げる
+        __m128i vy = _mm_cvtsi32_si128(y[g] | y[g + 1] << 16);
+        vy = _mm_unpacklo_epi16(vy, vy);
+        vy = _mm_unpacklo_epi32(vy, vy);
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, vy));
+    }
+    m = _mm_min_epi16(m, _mm_srli_si128(m, 8));
+    m = _mm_min_epi16(m, _mm_loadl_epi64(reinterpret_cast<const __m128i *>(acc)));
+    if (g < num_groups)
+    {
+        __m128i va = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(a + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, _mm_set1_epi16(y[g])));
+    }
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(acc), m);
+}
+
+__attribute__((target("avx2")))
+void min_plus_interleaved_avx2_i16(const int16_t * a, const int16_t * b, const int num_groups, const int, int16_t * acc)
+{
+    __m256i m0 = _mm256_set1_epi16(CellTraits<int16_t>::INF);
+    __m256i m1 = _mm256_set1_epi16(CellTraits<int16_t>::INF);
+    int g = 0;
+    for (; g + 8 <= num_groups; g += 8)
+    {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 4 * g));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g + 16));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 4 * g + 16));
+        m0 = _mm256_min_epi16(m0, _mm256_adds_epi16(a0, b0));
+        m1 = _mm256_min_epi16(m1, _mm256_adds_epi16(a1, b1));
+    }
+    if (g + 4 <= num_groups)
+    {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 4 * g));
+        m0 = _mm256_min_epi16(m0, _mm256_adds_epi16(a0, b0));
+        g += 4;
+    }
+    m0 = _mm256_min_epi16(m0, m1);
+    // 残りの8グループ未満は128bitで2グループずつ(SSE版を呼ぶとAVXとSSEの切り替えが重いのでここで処理する)
+    __m128i m = _mm_min_epi16(_mm256_castsi256_si128(m0), _mm256_extracti128_si256(m0, 1));
+    for (; g + 2 <= num_groups; g += 2)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, vb));
+    }
+    m = _mm_min_epi16(m, _mm_srli_si128(m, 8));
+    m = _mm_min_epi16(m, _mm_loadl_epi64(reinterpret_cast<const __m128i *>(acc)));
+    if (g < num_groups)
+    {
+        __m128i va = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(a + 4 * g));
+        __m128i vb = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(b + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, vb));
+    }
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(acc), m);
+}
+
+__attribute__((target("avx2")))
+void min_plus_broadcast_avx2_i16(const int16_t * a, const int16_t * y, const int num_groups, const int, int16_t * acc)
+{
+    // y[g], ..., y[g + 3]をunpackで2レーンずつにしてから32bit単位で並べ替え、それぞれ4レーンに広げる
+    const __m256i spread = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    __m256i m0 = _mm256_set1_epi16(CellTraits<int16_t>::INF);
+    __m256i m1 = _mm256_set1_epi16(CellTraits<int16_t>::INF);
+    int g = 0;
+    for (; g + 8 <= num_groups; g += 8)
+    {
+        __m128i y01 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + g));
+        __m256i y0 = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_unpacklo_epi16(y01, y01)), spread);
+        __m256i y1 = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_unpackhi_epi16(y01, y01)), spread);
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g + 16));
+        m0 = _mm256_min_epi16(m0, _mm256_adds_epi16(a0, y0));
+        m1 = _mm256_min_epi16(m1, _mm256_adds_epi16(a1, y1));
+    }
+    if (g + 4 <= num_groups)
+    {
+        __m128i y0123 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(y + g));
+        __m256i y0 = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_unpacklo_epi16(y0123, y0123)), spread);
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 4 * g));
+        m0 = _mm256_min_epi16(m0, _mm256_adds_epi16(a0, y0));
+        g += 4;
+    }
+    m0 = _mm256_min_epi16(m0, m1);
+    __m128i m = _mm_min_epi16(_mm256_castsi256_si128(m0), _mm256_extracti128_si256(m0, 1));
+    for (; g + 2 <= num_groups; g += 2)
+    {
+        __m128i vy = _mm_cvtsi32_si128(y[g] | y[g + 1] << 16);
+        vy = _mm_unpacklo_epi16(vy, vy);
+        vy = _mm_unpacklo_epi32(vy, vy);
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, vy));
+    }
+    m = _mm_min_epi16(m, _mm_srli_si128(m, 8));
+    m = _mm_min_epi16(m, _mm_loadl_epi64(reinterpret_cast<const __m128i *>(acc)));
+    if (g < num_groups)
+    {
+        __m128i va = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(a + 4 * g));
+        m = _mm_min_epi16(m, _mm_adds_epi16(va, _mm_set1_epi16(y[g])));
+    }
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(acc), m);
+}
+#endif
+
+// 実行時にCPUを見て使うカーネルを決める(num_alphabet != 4のときは常にスカラー版)
+// int16_tのarg版はtracebackでしか使わないのでスカラー版のまま
+template <class Cell>
+struct MinPlusKernels
+{
+    void (*interleaved)    (const Cell *, const Cell *, int, int, Cell *)        = min_plus_interleaved_scalar<Cell>;
+    void (*broadcast)      (const Cell *, const Cell *, int, int, Cell *)        = min_plus_broadcast_scalar<Cell>;
+    void (*interleaved_arg)(const Cell *, const Cell *, int, int, Cell *, int *) = min_plus_interleaved_arg_scalar<Cell>;
+    void (*broadcast_arg)  (const Cell *, const Cell *, int, int, Cell *, int *) = min_plus_broadcast_arg_scalar<Cell>;
+    const char * name = "scalar";
+};
+
+template <class Cell>
+const MinPlusKernels<Cell> & select_min_plus_kernels(const int num_alphabet)
+{
+    static const MinPlusKernels<Cell> scalar;
+    static const MinPlusKernels<Cell> simd = []
+    {
+        MinPlusKernels<Cell> kernels;
+#ifdef EDDC_X86_SIMD
+        if constexpr (is_same_v<Cell, int16_t>)
+        {
+            if (__builtin_cpu_supports("avx2"))
+            {
+                kernels.interleaved = min_plus_interleaved_avx2_i16;
+                kernels.broadcast = min_plus_broadcast_avx2_i16;
+                kernels.name = "avx2 (int16)";
+            }
+            else if (__builtin_cpu_supports("sse4.1"))
+            {
+                kernels.interleaved = min_plus_interleaved_sse41_i16;
+                kernels.broadcast = min_plus_broadcast_sse41_i16;
+                kernels.name = "sse4.1 (int16)";
+            }
+        }
+        else if (__builtin_cpu_supports("avx2"))
+        {
+            kernels = {min_plus_interleaved_avx2, min_plus_broadcast_avx2, min_plus_interleaved_arg_sse41, min_plus_broadcast_arg_sse41, "avx2"};
+        }
+        else if (__builtin_cpu_supports("sse4.1"))
+        {
+            kernels = {min_plus_interleaved_sse41, min_plus_broadcast_sse41, min_plus_interleaved_arg_sse41, min_plus_broadcast_arg_sse41, "sse4.1"};
+        }
+#endif
+        return kernels;
+    }();
+    return num_alphabet == 4 ? simd : scalar;
 }
 
+//--------------------------------------------------------------------------------------------------------
+// work-stealingスレッドプール
+// 各ワーカーは自分のキューの末尾からタスクを取り、空になったら他のワーカーのキューの先頭から盗む
+// 完了を待つスレッドもタスクを実行して手伝うので、タスクの中からparallel_forを入れ子に呼んでもよい
+//--------------------------------------------------------------------------------------------------------
+class WorkStealingPool
+{
+    public:
+        // num_threadsは呼び出し元のスレッドも含めた数
+        explicit WorkStealingPool(const int num_threads)
+            : queues_(max(1, num_threads - 1))
+        {
+            for (int i = 0; i < num_threads - 1; i++) workers_.emplace_back([this, i] { worker_loop(i); });
+        }
+
+        ~WorkStealingPool()
+        {
+            {
+                lock_guard<mutex> lock(sleep_mutex_);
+                stop_ = true;
+            }
+            sleep_cv_.notify_all();
+            for (auto & worker : workers_) worker.join();
+        }
+
+        int get_num_threads() const { return workers_.size() + 1; }
+
+        // [begin, end)をgrain個ずつに分け、func(lo, hi)を並列に実行して全て終わるまで待つ
+        template <class Func>
+        void parallel_for(const int begin, const int end, const int grain, const Func & func)
+        {
+            if (end - begin <= grain)
+            {
+                if (begin < end) func(begin, end);
+                return;
+            }
+            atomic<int> pending {0};
+            for (int lo = begin + grain; lo < end; lo += grain)
+            {
+                int hi = min(lo + grain, end);
+                pending++;
+                push([&func, &pending, lo, hi] { func(lo, hi); pending--; });
+            }
+            func(begin, begin + grain); // 先頭の塊は自分で処理する
+            wait(pending);
+        }
+
+        // func1とfunc2を並行に実行して両方終わるまで待つ
+        template <class Func1, class Func2>
+        void invoke(const Func1 & func1, const Func2 & func2)
+        {
+            atomic<int> pending {1};
+            push([&func2, &pending] { func2(); pending--; });
+            func1();
+            wait(pending);
+        }
+
+    private:
+        struct TaskQueue
+        {
+            mutex                    mutex_;
+            deque<function<void()>>  tasks_;
+        };
+
+        deque<TaskQueue>        queues_;        // ワーカーごとのキュー
+        vector<thread>          workers_;
+        mutex                   sleep_mutex_;
+        condition_variable      sleep_cv_;
+        atomic<int>             num_queued_ {0};
+        atomic<unsigned>        next_queue_ {0}; // ワーカー以外のスレッドがpushする先
+        bool                    stop_ {false};
+
+        inline static thread_local const WorkStealingPool * owner_ {nullptr};
+        inline static thread_local int                      worker_id_ {-1};
+
+        int self_id() const { return owner_ == this ? worker_id_ : -1; }
+
+        void push(function<void()> task)
+        {
+            int id = self_id();
+            int q = (id >= 0) ? id : static_cast<int>(next_queue_++ % queues_.size());
+            {
+                lock_guard<mutex> lock(queues_[q].mutex_);
+                queues_[q].tasks_.push_back(move(task));
+            }
+            num_queued_++;
+            {
+                lock_guard<mutex> lock(sleep_mutex_); // 眠りに入る直前のワーカーへの通知を取りこぼさない
+            }
+            sleep_cv_.notify_one();
+        }
+
+        bool try_run_one(const int id)
+        {
+            function<void()> task;
+            int num_queues = queues_.size();
+            if (id >= 0)
+            {
+                lock_guard<mutex> lock(queues_[id].mutex_);
+                if (!queues_[id].tasks_.empty())
+                {
+                    task = move(queues_[id].tasks_.back());
+                    queues_[id].tasks_.pop_back();
+                }
+            }
+            for (int offset = 1; !task && offset <= num_queues; offset++)
+            {
+                int victim = (max(id, 0) + offset) % num_queues;
+                lock_guard<mutex> lock(queues_[victim].mutex_);
+                if (!queues_[victim].tasks_.empty())
+                {
+                    task = move(queues_[victim].tasks_.front());
+                    queues_[victim].tasks_.pop_front();
+                }
+            }
+            if (!task) return false;
+            num_queued_--;
+            task();
+            return true;
+        }
+
+        void wait(const atomic<int> & pending)
+        {
+            int id = self_id();
+            while (pending.load() > 0)
+            {
+                if (!try_run_one(id)) this_thread::yield();
+            }
+        }
+
+        void worker_loop(const int id)
+        {
+            owner_ = this;
+            worker_id_ = id;
+            while (true)
+            {
+                if (try_run_one(id)) continue;
+                unique_lock<mutex> lock(sleep_mutex_);
+                sleep_cv_.wait(lock, [this] { return stop_ || num_queued_.load() > 0; });
+                if (stop_ && num_queued_.load() == 0) return;
+            }
+        }
+};
+
+// s_とt_はCost::ALPHABETの文字だけからなるものとする
+// CellはDPテーブルのセルの型. int16_tを使えるのはdistance_upper_boundがCellTraits<int16_t>::INF未満のとき
+// (compute_edit_distance(max_distance)だけならmax_distance + 1 < CellTraits<int16_t>::INFのとき). AdaptiveEDDCが選ぶ
+template <class Cost = Kimura2ParameterCost<>, class Cell = int>
 struct EDDC
 {
     public:
-        EDDC(const string & s, const string & t)
-            : s_(s), t_(t)
-            {}
+        static constexpr int NUM_ALPHABET = Cost::NUM_ALPHABET;
+        static_assert(NUM_ALPHABET >= 1 && NUM_ALPHABET <= 16, "ed_choice_ and Stage1Choices keep a letter in 4 bits");
+
+        EDDC(const string & s, const string & t, const int num_threads = 1, const DistanceEngine engine = DistanceEngine::AUTO)
+            : engine_(engine)
+            { set_strings(s, t); set_num_threads(num_threads); }
+
+        // 2以上ならStage 1の両側を並行に、各区間長・各反対角線上のセルをスレッドプールで分担して計算する
+        void set_num_threads(const int num_threads)
+        {
+            num_threads_ = max(1, num_threads);
+            if (num_threads_ == 1) pool_.reset();
+            else if (!pool_ || pool_->get_num_threads() != num_threads_) pool_ = make_unique<WorkStealingPool>(num_threads_);
+        }
+
+        // 長い方の長さがこれより短い組はnum_threadsが2以上でも1スレッドで埋める(既定はMIN_PARALLEL_LEN)
+        void set_min_parallel_len(const int len) { min_parallel_len_ = len; }
+
+        // compute_edit_distance()の計算方法. BANDEDは編集距離が長さに比べて小さいほど速い. AUTOは両者を選ぶ(結果は同じ)
+        void set_distance_engine(const DistanceEngine engine) { engine_ = engine; }
+
+        // runの内部の枝刈り: trueなら長いrunの内部の分割位置を下界で読み飛ばす(結果は変わらない)
+        // 表は通常どおり文字ごとに持ち、Equation 3/6の分割位置の走査だけを減らす. 下界を超えうるrunの内部は走査するので最悪の計算量は変わらない
+        // 下界で全て読み飛ばせればO(n^2 * (長いrunの数 + 短いrunの文字数))になる. MUT[a][a]が0でないコストモデルでは無視する
+        // 時間もメモリもrunの数で決まるrun-length符号化版(表をrunの境界で持つもの)ではなく、メモリは減らない
+        void set_run_pruning(const bool enabled) { run_pruning_ = enabled; }
+
+        // 同じインスタンスを別の文字列の組に使い回す(arena_は再確保しない)
+        void set_strings(const string & s, const string & t)
+        {
+            set_source(s);
+            set_target(t);
+        }
 
         int compute_edit_distance()
         {
+            if (engine_ != DistanceEngine::CUBIC) return compute_edit_distance_banded(engine_ == DistanceEngine::AUTO);
+
             // DPテーブルのサイズを決める
             int len_s = s_.size();
             int len_t = t_.size();
-            int num_alphabet = alphabet_.size();
-
-            ed_s_to_empty_.assign          (len_s + 1, vector<int>(len_s + 1, 0));
-            ed_s_to_alphabet_.assign       (num_alphabet, vector<vector<int>>(len_s + 1, vector<int>(len_s + 1, 0)));
-            ed_s_to_alphabet_nongen_.assign(num_alphabet, vector<vector<int>>(len_s + 1, vector<int>(len_s + 1, 0)));
-            ed_empty_to_t_.assign          (len_t + 1, vector<int>(len_t + 1, 0));
-            ed_alphabet_to_t_.assign       (num_alphabet, vector<vector<int>>(len_t + 1, vector<int>(len_t + 1, 0)));
-            ed_alphabet_to_t_nonred_.assign(num_alphabet, vector<vector<int>>(len_t + 1, vector<int>(len_t + 1, 0)));
-            edt_.assign                    (num_alphabet, vector<vector<int>>(len_s + 1, vector<int>(len_t + 1, 0)));
-            ed_.assign                     (len_s + 1, vector<int>(len_t + 1, 0));
+            constexpr int num_alphabet = NUM_ALPHABET;
+            allocate_tables(len_s, len_t, num_alphabet, true);
+            stage_times_ = {};
 
             // Stage 1: source文字列とtarget文字列のいずれかが空文字 or 1文字の場合の編集距離を計算
-            // DPテーブルの初期化
-            for (int i = 0; i < len_s; i++) ed_s_to_empty_[i][i + 1] = del(s_[i]);
-            for (int i = 0; i < len_t; i++) ed_empty_to_t_[i][i + 1] = ins(t_[i]);
-            for (int k = 0; k < num_alphabet; k++)
+            compute_stage1();
+
+            // Stage 2: source文字列とtarget文字列のどちらも2文字以上の場合の編集距離を計算
+            int distance = 0;
+            timed(stage_times_.stage2_, [&] { distance = compute_stage2(); });
+            return distance;
+        }
+
+        // 編集距離がmax_distance以下かどうかだけ分かればよい場合の計算
+        // max_distance以下ならその値を、超えるならmax_distance + 1を返す
+        int compute_edit_distance(const int max_distance)
+        {
+            int len_s = s_.size();
+            int len_t = t_.size();
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            // 1文字との間の編集距離がmax_distanceを超える長い区間はStage 1でも計算せず、テーブルも帯状に持つ
+            int max_width = bounded_width(max_distance);
+            allocate_tables(len_s, len_t, num_alphabet, true, INF_DISTANCE, false, max_width);
+            stage_times_ = {};
+            compute_stage1(max_width);
+            int distance = 0;
+            timed(stage_times_.stage2_, [&] { distance = compute_stage2_bounded(max_distance); });
+            return distance;
+        }
+
+        // 編集距離を計算し、それを与える編集スクリプト(get_edit_script)も求める
+        // FULLはfillで選んだ候補を1セルあたり数バイトで保存してそのまま辿る
+        // CHECKPOINTEDはStage 2の表をed_の1枚分に抑え(edt_は1列を使い回す)、辿るときに必要な所だけ選び直す
+        int compute_edit_script(const TracebackMode mode = TracebackMode::FULL)
+        {
+            script_.clear();
+            if (mode == TracebackMode::NONE) return compute_edit_distance();
+
+            int len_s = s_.size();
+            int len_t = t_.size();
+            constexpr int num_alphabet = NUM_ALPHABET;
+            size_t cells_st = MatrixView<Cell>::num_cells(len_s + 1, len_t + 1);
+            traceback_mode_ = mode;
+            allocate_tables(len_s, len_t, num_alphabet, true, 0, mode == TracebackMode::CHECKPOINTED);
+            if (mode == TracebackMode::FULL)
             {
-                for (int i = 0; i < len_s; i++) ed_s_to_alphabet_[k][i][i + 1] = mut(alphabet_[k], s_[i]);
-                for (int i = 0; i < len_t; i++) ed_alphabet_to_t_[k][i][i + 1] = mut(alphabet_[k], t_[i]);
+                source_choices_.resize(len_s, num_alphabet);
+                target_choices_.resize(len_t, num_alphabet);
+                edt_choice_.assign(cells_st * num_alphabet, 0);
             }
-            
+            else
+            {
+                source_choices_.release();
+                target_choices_.release();
+                vector<uint32_t>().swap(edt_choice_);
+            }
+            ed_choice_.assign(cells_st, 0);
+            stage_times_ = {};
+
+            compute_stage1();
+            int distance = 0;
+            timed(stage_times_.stage2_, [&] { distance = compute_stage2(); });
+            timed(stage_times_.traceback_, [this] { trace_stage2(); });
+            traceback_mode_ = TracebackMode::NONE;
+            return distance;
+        }
+
+        // 計算済みのStage 1のテーブルを使い、Stage 2だけを計算する
+        int compute_edit_distance(const Stage1Tables<Cell> & source, const Stage1Tables<Cell> & target)
+        {
+            bind_stage1(source, target, INF_DISTANCE);
+            stage_times_ = {};
+            int distance = 0;
+            timed(stage_times_.stage2_, [&] { distance = compute_stage2(); });
+            return distance;
+        }
+
+        // 上のmax_distance付き版(テーブルは同じmax_distanceで計算しておく)
+        int compute_edit_distance(const Stage1Tables<Cell> & source, const Stage1Tables<Cell> & target, const int max_distance)
+        {
+            bind_stage1(source, target, INF_DISTANCE, bounded_width(max_distance));
+            stage_times_ = {};
+            int distance = 0;
+            timed(stage_times_.stage2_, [&] { distance = compute_stage2_bounded(max_distance); });
+            return distance;
+        }
+
+        // seqだけで決まるStage 1のテーブルをtablesに計算する
+        // is_sourceならseqをsource文字列とみなしたテーブル、そうでなければtarget文字列とみなしたテーブル
+        // max_distance >= 0ならcompute_edit_distance(max_distance)で使わない長い区間は計算しない
+        void compute_stage1_tables(const string & seq, const bool is_source, Stage1Tables<Cell> & tables, const int max_distance = -1)
+        {
+            constexpr int num_alphabet = NUM_ALPHABET;
+            tables.seq_ = seq;
+            tables.max_width_ = (max_distance >= 0) ? bounded_width(max_distance) : INT_MAX;
+            tables.buffer_.assign(Stage1Views<Cell>::num_cells(seq.size(), num_alphabet, tables.max_width_), max_distance >= 0 ? INF_DISTANCE : 0);
+            tables.views_.carve(tables.buffer_.data(), seq.size(), num_alphabet, tables.max_width_);
+            stage_times_ = {};
+            if (is_source)
+            {
+                set_source(seq);
+                source_ = tables.views_;
+                timed(stage_times_.stage1_source_, [&] { compute_source_tables(tables.max_width_); });
+            }
+            else
+            {
+                set_target(seq);
+                target_ = tables.views_;
+                timed(stage_times_.stage1_target_, [&] { compute_target_tables(tables.max_width_); });
+            }
+        }
+
+        // max_distance以下で1文字と対応しうる区間の最大長
+        static int bounded_width(const int max_distance)
+        {
+            int c_min = min_length_change_cost();
+            return (c_min > 0) ? max_distance / c_min + 1 : INT_MAX;
+        }
+
+        // 長さが1変わる操作(ins, del, dup, cont)の最小コスト。編集距離の下界に使う
+        static constexpr int min_length_change_cost()
+        {
+            int cost = INT_MAX;
+            for (int a = 0; a < NUM_ALPHABET; a++) cost = min({cost, Cost::INS[a], Cost::DEL[a], Cost::DUP[a], Cost::CONT[a]});
+            return cost;
+        }
+
+        // 編集距離の上界: distance_upper_bound(s, t) = block_bound() + source_bound(s) + target_bound(t)
+        // s_[0]とt_[0]を同じalphabet[k]に対応させ、残りの文字は1文字ずつ消す / 生成するEquation 1-8上の編集パスのコスト
+        // (s_[a, b)の先頭をalphabet[k]にmutして残りを消し、そのkを消す: empty(a, b) <= DEL[k] + MUT[k][k] + MUT[s_a][k] + empty(a + 1, b))
+        // 組ごとにO(1)で足せるので、EDDCBatchでもCellを選ぶのに使える
+        static long long source_bound(const string & s)
+        {
+            long long bound = 0;
+            for (char c : s)
+            {
+                int a = LETTER_CODE[static_cast<unsigned char>(c)];
+                int via = INT_MAX;
+                for (int k = 0; k < NUM_ALPHABET; k++) via = min(via, Cost::DEL[k] + Cost::MUT[k][k] + Cost::MUT[a][k]);
+                bound += max(Cost::DEL[a], via); // 最後の1文字はそのままdel
+            }
+            return bound;
+        }
+
+        static long long target_bound(const string & t)
+        {
+            long long bound = 0;
+            for (char c : t)
+            {
+                int a = LETTER_CODE[static_cast<unsigned char>(c)];
+                int via = INT_MAX;
+                for (int k = 0; k < NUM_ALPHABET; k++) via = min(via, Cost::INS[k] + Cost::MUT[k][k] + Cost::MUT[k][a]);
+                bound += max(Cost::INS[a], via); // 最後の1文字はそのままins
+            }
+            return bound;
+        }
+
+        // s_[0] = aとt_[0] = bを対応させる部分の上界(全ての文字の組での最大値)
+        // 2文字以上どうしならalphabet[k]を経由し(Equation 8のed1)、どちらかが1文字ならその文字を経由する
+        static constexpr int block_bound()
+        {
+            int bound = 0;
+            for (int a = 0; a < NUM_ALPHABET; a++)
+            {
+                for (int b = 0; b < NUM_ALPHABET; b++)
+                {
+                    int via = INT_MAX;
+                    for (int k = 0; k < NUM_ALPHABET; k++) via = min(via, 2 * Cost::MUT[k][k] + Cost::MUT[a][k] + Cost::MUT[k][b]);
+                    bound = max({bound, via, max(Cost::MUT[a][a], Cost::MUT[b][b]) + Cost::MUT[a][b]});
+                }
+            }
+            return bound;
+        }
+
+        static long long distance_upper_bound(const string & s, const string & t) { return block_bound() + source_bound(s) + target_bound(t); }
+
+        // ins == del, dup == cont, mutが対称ならed(s, t) == ed(t, s)になる
+        static constexpr bool has_symmetric_costs()
+        {
+            for (int a = 0; a < NUM_ALPHABET; a++)
+            {
+                if (Cost::INS[a] != Cost::DEL[a] || Cost::DUP[a] != Cost::CONT[a]) return false;
+                for (int b = 0; b < NUM_ALPHABET; b++)
+                {
+                    if (Cost::MUT[a][b] != Cost::MUT[b][a]) return false;
+                }
+            }
+            return true;
+        }
+
+        const IntervalTableView<Cell> & get_ed_s_to_empty()           const { return source_.empty_;           }
+        const IntervalTableView<Cell> & get_ed_s_to_alphabet()        const { return source_.alphabet_;        }
+        const IntervalTableView<Cell> & get_ed_s_to_alphabet_nongen() const { return source_.alphabet_nonmut_; }
+        const IntervalTableView<Cell> & get_ed_empty_to_t()           const { return target_.empty_;           }
+        const IntervalTableView<Cell> & get_ed_alphabet_to_t()        const { return target_.alphabet_;        }
+        const IntervalTableView<Cell> & get_ed_alphabet_to_t_nonred() const { return target_.alphabet_nonmut_; }
+        const MatrixView<Cell> &        get_edt()                     const { return edt_;                     }
+        const MatrixView<Cell> &        get_ed()                      const { return ed_;                      }
+        const vector<EditOperation> &   get_edit_script()             const { return script_;                  }
+        size_t                          get_arena_size()              const { return arena_.size();            }
+        size_t                          get_arena_bytes()             const { return arena_.size() * sizeof(Cell); }
+        const char *                    get_kernel_name()             const { return kernels_->name;           }
+        const StageTimes &              get_stage_times()             const { return stage_times_;             }
+        size_t                          get_traceback_bytes()         const { return source_choices_.get_bytes() + target_choices_.get_bytes() +
+                                                                                     (edt_choice_.capacity() + ed_choice_.capacity()) * sizeof(uint32_t); }
+        int                             get_num_alphabet()            const { return NUM_ALPHABET;             }
+        int                             get_num_threads()             const { return num_threads_;             }
+
+    private:
+        string            s_;                       // source文字列
+        string            t_;                       // target文字列
+        vector<uint8_t>   s_code_;                  // s_の各文字のCost::ALPHABETでの番号
+        vector<uint8_t>   t_code_;                  // t_の各文字のCost::ALPHABETでの番号
+        RunIndex          s_runs_;                  // s_のrun
+        RunIndex          t_runs_;                  // t_のrun
+        bool              run_pruning_ {false};     // 長いrunの内部の分割位置を下界で読み飛ばすか
+        vector<Cell>      arena_;                   // 全DPテーブルを連続して置く領域
+        Stage1Views<Cell> source_;                  // s_[i, j]から空文字列 / alphabet[k]への編集距離
+        Stage1Views<Cell> target_;                  // 空文字列 / alphabet[k]からt_[i, j]への編集距離
+        MatrixView<Cell>  edt_;                     // alphabet[k]を経由したs_[0, i]からt_[0, j]への編集距離 (列優先)
+        MatrixView<Cell>  ed_;                      // s_[0, i]からt_[0, j]への編集距離
+        const MinPlusKernels<Cell> * kernels_ {&select_min_plus_kernels<Cell>(NUM_ALPHABET)}; // min-plusのリダクションカーネル
+        TracebackMode     traceback_mode_ {TracebackMode::NONE}; // compute_edit_scriptの間だけNONE以外
+        DistanceEngine    engine_ {DistanceEngine::AUTO};  // compute_edit_distance()の計算方法
+        StageTimes        stage_times_;             // 直前の計算の各段階の秒数
+        Stage1Choices     source_choices_;          // FULLのときsource_の各セルで選んだ候補
+        Stage1Choices     target_choices_;          // FULLのときtarget_の各セルで選んだ候補
+        vector<uint32_t>  edt_choice_;              // FULLのときedt_(k, i, j)で選んだh (edt_と同じ添字)
+        vector<uint32_t>  ed_choice_;               // ed_(i, j)で選んだh << 4 | k (h = 0はed1の項)
+        vector<EditOperation> script_;              // compute_edit_scriptで求めた編集スクリプト
+        int                          num_threads_ {1};
+        unique_ptr<WorkStealingPool> pool_;          // num_threads_ >= 2のときだけ作る
+        int                          min_parallel_len_ {MIN_PARALLEL_LEN};
+
+        // 波面(Stage 1の区間の長さ1つ、Stage 2の反対角線1本)ごとに待ち合わせるので、短い組では同期と
+        // 反対角線順の走査のほうが分担の効果より大きい(1コアで2スレッドにすると長さ128で6%、256で35%遅くなる)
+        // 512以上では反対角線1本に約n^2セル分のmin-plusがあり、待ち合わせ1回よりも十分大きい
+        static constexpr int MIN_PARALLEL_LEN = 512;
+
+        static constexpr int INF_DISTANCE = CellTraits<Cell>::INF; // 枝刈りしたセルの値で、各セルの値の上限
+        static constexpr array<uint8_t, 256> LETTER_CODE = make_letter_codes<Cost>();
+
+        // 文字列は受け取ったときに1度だけ番号の列にしておく
+        void set_source(const string & s)
+        {
+            s_ = s;
+            s_code_.resize(s.size());
+            for (size_t i = 0; i < s.size(); i++) s_code_[i] = LETTER_CODE[static_cast<unsigned char>(s[i])];
+            s_runs_.build(s_code_);
+        }
+
+        void set_target(const string & t)
+        {
+            t_ = t;
+            t_code_.resize(t.size());
+            for (size_t i = 0; i < t.size(); i++) t_code_[i] = LETTER_CODE[static_cast<unsigned char>(t[i])];
+            t_runs_.build(t_code_);
+        }
+
+        // runの内部の枝刈りで使う側のRunIndex (使わなければnullptr)
+        const RunIndex * run_index(const bool is_source) const
+        {
+            if (!run_pruning_ || !has_zero_self_mutation()) return nullptr;
+            return is_source ? &s_runs_ : &t_runs_;
+        }
+
+        static constexpr int MIN_KERNEL_SCAN = 4; // 分割位置がこれより少ない範囲はmin-plusカーネルを呼ばずにその場で調べる
+
+        // runの内部(同じ文字xが続く所)で区間を1文字伸ばしたときのコストの増分の上限
+        // target側はxをdupかinsで足し、source側はxをcontかdelで消せばよい(MUT[x][x] == 0を使う)
+        int run_slope(const bool is_source, const int h) const
+        {
+            if (is_source) return min(Cost::CONT[s_code_[h]], Cost::DEL[s_code_[h]]);
+            return min(Cost::DUP[t_code_[h]], Cost::INS[t_code_[h]]);
+        }
+
+        // 分割位置h = first, ..., lastをscan(lo, hi) (h = lo, ..., hi - 1をまとめて調べる)で調べる
+        // 長いrunの内部の区間[a, b] (h - 1とhが同じ文字)では両端を先に調べ、a < h < bはmay_improve(a, b)がtrueのときだけ調べる
+        // 左側の区間は1文字伸ばしても、右側の区間は1文字縮めてもコストの増分はrun_slope以下なので、
+        // a <= h <= bでの値は(左側のbでの値) + (右側のaでの値) - run_slope * (b - a)を下回らない
+        template <class Scan, class Bound>
+        static void for_each_split(const RunIndex & runs, const int first, const int last, const Scan & scan, const Bound & may_improve)
+        {
+            int lo = first;
+            for (int a = first; a <= last; )
+            {
+                int b = min(runs.next_run_[a + 1] - 1, last);
+                if (b - a > RunIndex::MIN_SKIPPED)
+                {
+                    scan(lo, a + 1);
+                    scan(b, b + 1);
+                    if (may_improve(a, b)) scan(a + 1, b);
+                    lo = b + 1;
+                }
+                a = runs.next_long_[b + 1];
+            }
+            scan(lo, last + 1);
+        }
+
+        // 同じ文字を残すmutのコストが0でないとrunの内部での下界が成り立たない
+        static constexpr bool has_zero_self_mutation()
+        {
+            for (int a = 0; a < NUM_ALPHABET; a++)
+            {
+                if (Cost::MUT[a][a] != 0) return false;
+            }
+            return true;
+        }
+
+        void bind_stage1(const Stage1Tables<Cell> & source, const Stage1Tables<Cell> & target, const int fill_value, const int max_width = INT_MAX)
+        {
+            set_source(source.seq_);
+            set_target(target.seq_);
+            allocate_tables(s_.size(), t_.size(), NUM_ALPHABET, false, fill_value, false, max_width);
+            source_ = source.views_;
+            target_ = target.views_;
+        }
+
+
+        // arena_を(必要なら1回だけ)確保し、各テーブルのviewを割り当てる
+        // with_stage1がfalseのときはStage 2のテーブルだけを置く(Stage 1は外から与える)
+        // rolling_edtならedt_には1列分だけ割り当てる
+        // max_widthが短ければ(compute_stage2_bounded用)、Stage 1は長さmax_width以下の区間だけ、
+        // ed_とedt_は|i - j| <= 2 * max_width + 1のセルだけを帯状に持つ
+        // (計算するセルは|i - j| <= max_width + 1で、分割位置hはそこから更にmax_width以内)
+        void allocate_tables(const int len_s, const int len_t, const int num_alphabet, const bool with_stage1, const int fill_value = 0,
+                             const bool rolling_edt = false, const int max_width = INT_MAX)
+        {
+            int band = (max_width <= max(len_s, len_t) / 2) ? 2 * max_width + 1 : -1;
+            size_t cells_st = MatrixView<Cell>::num_cells(len_s + 1, len_t + 1, band);
+            size_t cells_edt = rolling_edt ? MatrixView<Cell>::num_cells(len_s + 1, 1) : cells_st;
+            size_t total = cells_edt * num_alphabet + cells_st;
+            if (with_stage1) total += Stage1Views<Cell>::num_cells(len_s, num_alphabet, max_width) + Stage1Views<Cell>::num_cells(len_t, num_alphabet, max_width);
+            if (arena_.size() < total) arena_.resize(total);
+            fill(arena_.begin(), arena_.begin() + total, fill_value);
+
+            Cell * p = arena_.data();
+            if (with_stage1)
+            {
+                p = source_.carve(p, len_s, num_alphabet, max_width);
+                p = target_.carve(p, len_t, num_alphabet, max_width);
+            }
+            edt_ = {p, len_s + 1, len_t + 1, num_alphabet, true, rolling_edt ? 0 : -1, band};
+            p += cells_edt * num_alphabet;
+            ed_ = {p, len_s + 1, len_t + 1, 1, false, -1, band};
+        }
+
+        // 表を埋めるのに使うスレッドプール. 1スレッドか、組がmin_parallel_len_より短ければnullptr
+        WorkStealingPool * fill_pool() const
+        {
+            return (pool_ && max(s_.size(), t_.size()) >= static_cast<size_t>(min_parallel_len_)) ? pool_.get() : nullptr;
+        }
+
+        // Stage 1: target側とsource側は互いに独立なので、スレッドがあれば並行に計算する
+        void compute_stage1(const int max_width = INT_MAX)
+        {
+            auto target = [this, max_width] { timed(stage_times_.stage1_target_, [this, max_width] { compute_target_tables(max_width); }); };
+            auto source = [this, max_width] { timed(stage_times_.stage1_source_, [this, max_width] { compute_source_tables(max_width); }); };
+            if (WorkStealingPool * pool = fill_pool()) pool->invoke(target, source);
+            else
+            {
+                target();
+                source();
+            }
+        }
+
+        // funcにかかった秒数をsecondsに足す
+        template <class Func>
+        static void timed(double & seconds, const Func & func)
+        {
+            auto start = chrono::steady_clock::now();
+            func();
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+
+        // DistanceEngine::BANDED: 上限を倍にしながらcompute_edit_distance(max_distance)を呼ぶ
+        // 帯の計算量は上限の2乗に比例するので、全体でも最後の1回の高々4 / 3倍で済む
+        // adaptive (DistanceEngine::AUTO)なら帯の幅が長い方の長さの1/4を超える前にCUBICに切り替える
+        int compute_edit_distance_banded(const bool adaptive)
+        {
+            int len_s = s_.size();
+            int len_t = t_.size();
+            int c_min = min_length_change_cost();
+            StageTimes times;
+            auto cubic = [&]
+            {
+                DistanceEngine engine = engine_;
+                engine_ = DistanceEngine::CUBIC;
+                int distance = compute_edit_distance();
+                engine_ = engine;
+                times += stage_times_;
+                stage_times_ = times;
+                return distance;
+            };
+            if (c_min <= 0 || len_s < 2 || len_t < 2) return cubic();
+            // 長さの差の分は必ずかかるので、そこから帯の幅で32だけ余裕を持たせて始める
+            long long max_distance = static_cast<long long>(c_min) * (abs(len_s - len_t) + 32);
+            long long upper_bound = distance_upper_bound(s_, t_);
+            // CUBICは上界がセルの型で扱えるときだけ使える. 扱えなければBANDEDと同じく最後は型の上限で打ち切る
+            long long max_banded = (adaptive && upper_bound < INF_DISTANCE) ? static_cast<long long>(c_min) * (max(len_s, len_t) / 4) : LLONG_MAX;
+            if (min(max_distance, upper_bound) > max_banded) return cubic();
+            while (true)
+            {
+                // ここまで来たら帯を広げても得がないので、上界(またはセルの型で扱える最大の上限)で最後に1回計算する
+                // 上界で打ち切っても結果は変わらず、型の上限を超えるならmin(真の値, INF_DISTANCE)を返す
+                bool last = max_distance >= upper_bound || max_distance + 2 >= INF_DISTANCE;
+                if (last) max_distance = min<long long>(upper_bound, INF_DISTANCE - 2);
+                int distance = compute_edit_distance(static_cast<int>(max_distance));
+                times += stage_times_;
+                stage_times_ = times;
+                if (distance <= max_distance) return distance;
+                if (last) return INF_DISTANCE;
+                // AUTOでは帯の幅の上限ちょうどで1回試してからCUBICに切り替える
+                if (max_distance >= max_banded) return cubic();
+                max_distance = min(max_distance * 2, max_banded);
+            }
+        }
+
+        // Stage 2: Stage 1のテーブルからed_とedt_を埋めてs_とt_の編集距離を返す
+        int compute_stage2()
+        {
+            int len_s = s_.size();
+            int len_t = t_.size();
+            init_stage2();
+
+
+            // 論文には書いてないけどedt_の1行目もEquation 9で初期化しておく必要がある
+            WorkStealingPool * pool = fill_pool();
+            if (pool && traceback_mode_ != TracebackMode::CHECKPOINTED)
+            {
+                pool->parallel_for(2, len_t + 1, 256, [this](const int lo, const int hi)
+                {
+                    for (int j = lo; j < hi; j++) compute_edt_cell(1, j, 1);
+                });
+
+                // (i, j)はed_の行iの左側とedt_の列jの上側にだけ依存するので、i + jが等しいセルは独立
+                for (int diag = 4; diag <= len_s + len_t; diag++)
+                {
+                    int first = max(2, diag - len_t);
+                    int last = min(len_s, diag - 2);
+                    pool->parallel_for(first, last + 1, max(1, 16384 / diag), [this, diag](const int lo, const int hi)
+                    {
+                        for (int i = lo; i < hi; i++) compute_stage2_cell(i, diag - i);
+                    });
+                }
+            }
+            else
+            {
+                // edt_が1列分しかないときのために、1行目もその列を計算する直前に埋める
+                for (int j = 2; j <= len_t; j++)
+                {
+                    compute_edt_cell(1, j, 1);
+                    for (int i = 2; i <= len_s; i++) compute_stage2_cell(i, j);
+                }
+            }
+
+            return ed_(len_s, len_t);
+        }
+
+        // compute_stage2のmax_distance付き版
+        // 長さを1変える操作には少なくともc_minかかるので、(i, j)を通る編集パスのコストは
+        // ed_[i][j] + c_min * |(len_s - i) - (len_t - j)|以上、ed_[i][j]自体もc_min * |i - j|以上になる
+        // これがmax_distanceを超えるセルは計算せず、区間の分割位置hも長さmax_width以下の区間に限る
+        int compute_stage2_bounded(const int max_distance)
+        {
+            int len_s = s_.size();
+            int len_t = t_.size();
+            int exceeded = max_distance + 1;
+            int c_min = min_length_change_cost();
+            if (c_min <= 0)
+            {
+                int distance = compute_stage2();
+                return (distance <= max_distance) ? distance : exceeded;
+            }
+            if (static_cast<long long>(c_min) * abs(len_s - len_t) > max_distance) return exceeded;
+
+            int max_width = bounded_width(max_distance);
+            auto rest = [&](const int i, const int j) { return abs((len_s - i) - (len_t - j)); };
+            auto ed_pruned = [&](const int i, const int j)
+            {
+                return static_cast<long long>(c_min) * (abs(i - j) + rest(i, j)) > max_distance;
+            };
+            // edt_[k][i][j]はalphabet[k]がsource側とtarget側で1文字ずつ未消費なので1ずつ緩める
+            auto edt_pruned = [&](const int i, const int j)
+            {
+                return static_cast<long long>(c_min) * (max(0, abs(i - j) - 1) + max(0, rest(i, j) - 1)) > max_distance;
+            };
+            auto store_edt = [&](const int i, const int j)
+            {
+                compute_edt_cell(i, j, max(1, j - max_width), false);
+            };
+            // 列jで計算する行(2行目以降). ed_を帯状に持つときはこの外の行は別のセルと領域を共有している
+            auto first_row = [&](const int j) { return max(2, j - max_width - 1); };
+            auto last_row  = [&](const int j) { return min(len_s, j + max_width + 1); };
+            // 列jにmax_distance以内で完了できる編集パスが通りうるセルがあるか(帯の中の行だけを見る)
+            auto column_alive = [&](const int j)
+            {
+                auto alive = [&](const int i)
+                {
+                    return ed_.in_band(i, j) && ed_(i, j) + static_cast<long long>(c_min) * rest(i, j) <= max_distance;
+                };
+                for (int i : {0, 1})
+                {
+                    if (i <= len_s && alive(i)) return true;
+                }
+                for (int i = first_row(j); i <= last_row(j); i++)
+                {
+                    if (alive(i)) return true;
+                }
+                return false;
+            };
+
+            init_stage2();
             for (int j = 2; j <= len_t; j++)
             {
-                for (int i = j - 2; i >= 0; i--)
+                if (!edt_pruned(1, j)) store_edt(1, j);
+            }
+
+            // 編集パスが通るed_のセルの列は、先頭がmax_width以下、隣どうしの差もmax_width以下なので
+            // max_width列続けて生きたセルがなければmax_distance以内のパスは存在しない
+            int num_dead_columns = column_alive(1) ? 0 : 1;
+            for (int j = 2; j <= len_t; j++)
+            {
+                for (int i = first_row(j); i <= last_row(j); i++)
+                {
+                    if (!edt_pruned(i, j)) store_edt(i, j);
+                    if (!ed_pruned(i, j)) compute_ed_cell(i, j, max(1, i - max_width), false);
+                }
+
+                if (column_alive(j)) num_dead_columns = 0;
+                else if (++num_dead_columns >= max_width) return exceeded;
+            }
+
+            int distance = ed_(len_s, len_t);
+            return (distance <= max_distance) ? distance : exceeded;
+        }
+
+        // ed_の0, 1行目と0, 1列目をStage 1のテーブルから埋める
+        void init_stage2()
+        {
+            int len_s = s_.size();
+            int len_t = t_.size();
+
+            // s_[0]とt_[0]のalphabetのインデックス
+            int s0_idx = s_code_[0];
+            int t0_idx = t_code_[0];
+
+            // DPテーブルの初期化
+            // Stage 1を帯状に持っているときは、それより長い区間の分はallocate_tablesで埋めた値のまま
+            ed_(0, 0) = 0;
+            for (int i = 1; i <= min(len_t, target_.empty_.max_width_); i++)
+            {
+                ed_(0, i) = target_.empty_(0, i);
+                ed_(1, i) = target_.alphabet_(s0_idx, 0, i);
+            }
+            for (int i = 1; i <= min(len_s, source_.empty_.max_width_); i++)
+            {
+                ed_(i, 0) = source_.empty_(0, i);
+                ed_(i, 1) = source_.alphabet_(t0_idx, 0, i);
+            }
+        }
+
+        // Stage 1 (target側): 空文字 or alphabet[k]からt_[i, j)への編集距離
+        // max_widthより長い区間は計算しない(allocate_tablesで埋めた値のまま)
+        void compute_target_tables(const int max_width = INT_MAX)
+        {
+            int len_t = t_.size();
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            // DPテーブルの初期化
+            for (int i = 0; i < len_t; i++)
+            {
+                target_.empty_(i, i + 1) = target_.empty_col_(i, i + 1) = Cost::INS[t_code_[i]];
+            }
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                for (int i = 0; i < len_t; i++)
+                {
+                    target_.alphabet_(k, i, i + 1) = target_.alphabet_col_(k, i, i + 1) = Cost::MUT[k][t_code_[i]];
+                }
+            }
+
+            compute_band(len_t, max_width, [this](const int i, const int j) { compute_target_cell(i, j); });
+        }
+
+        // 区間[i, j) (j - i >= 2)についてEquation 1-3を計算する
+        void compute_target_cell(const int i, const int j)
+        {
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            Stage1Choices * choices = (traceback_mode_ == TracebackMode::FULL) ? &target_choices_ : nullptr;
+            size_t cell = target_.alphabet_.cell(i, j);
+
+            // Equation 3: alphabet[k]の1文字スタートかつ最初の操作がmutでない場合
+            Cell acc[3][NUM_ALPHABET];
+            int arg[3][NUM_ALPHABET];
+            reduce_split_terms(target_, i, j, acc, choices ? arg : nullptr, false);
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                int best = min<int>({acc[0][k], acc[1][k], Cost::DUP[k] + acc[2][k]});
+                target_.alphabet_nonmut_(k, i, j) = best;
+                if (choices) choices->split_[cell * num_alphabet + k] = encode_split(best, acc, arg, k);
+            }
+
+            // Equation 2: alphabet[k]の1文字スタートかつ最初の操作がalphabet[l]へのmutの場合
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                int best = INF_DISTANCE;
+                int best_l = 0;
+                for (int l = 0; l < num_alphabet; l++)
+                {
+                    int cost = Cost::MUT[k][l] + target_.alphabet_nonmut_(l, i, j);
+                    if (cost < best)
+                    {
+                        best = cost;
+                        best_l = l;
+                    }
+                }
+                target_.alphabet_(k, i, j) = target_.alphabet_col_(k, i, j) = best;
+                if (choices) choices->mut_[cell * num_alphabet + k] = best_l;
+            }
+
+            // Equation 1: 空文字スタートの場合
+            int best = INF_DISTANCE;
+            int best_k = 0;
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                int cost = Cost::INS[k] + target_.alphabet_(k, i, j);
+                if (cost < best)
+                {
+                    best = cost;
+                    best_k = k;
+                }
+            }
+            target_.empty_(i, j) = target_.empty_col_(i, j) = best;
+            if (choices) choices->empty_[cell] = best_k;
+        }
+
+        // Stage 1 (source側): s_[i, j)から空文字 or alphabet[k]への編集距離
+        void compute_source_tables(const int max_width = INT_MAX)
+        {
+            int len_s = s_.size();
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            // DPテーブルの初期化
+            for (int i = 0; i < len_s; i++)
+            {
+                source_.empty_(i, i + 1) = source_.empty_col_(i, i + 1) = Cost::DEL[s_code_[i]];
+            }
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                for (int i = 0; i < len_s; i++)
+                {
+                    source_.alphabet_(k, i, i + 1) = source_.alphabet_col_(k, i, i + 1) = Cost::MUT[s_code_[i]][k];
+                }
+            }
+
+            compute_band(len_s, max_width, [this](const int i, const int j) { compute_source_cell(i, j); });
+        }
+
+        // 区間[i, j) (j - i >= 2)についてEquation 4-6を計算する
+        void compute_source_cell(const int i, const int j)
+        {
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            Stage1Choices * choices = (traceback_mode_ == TracebackMode::FULL) ? &source_choices_ : nullptr;
+            size_t cell = source_.alphabet_.cell(i, j);
+
+            // Equation 6 : alphabet[k]の1文字で終わりかつ最後の操作がmutでない場合
+            Cell acc[3][NUM_ALPHABET];
+            int arg[3][NUM_ALPHABET];
+            reduce_split_terms(source_, i, j, acc, choices ? arg : nullptr, true);
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                int best = min<int>({acc[0][k], acc[1][k], Cost::CONT[k] + acc[2][k]});
+                source_.alphabet_nonmut_(k, i, j) = best;
+                if (choices) choices->split_[cell * num_alphabet + k] = encode_split(best, acc, arg, k);
+            }
+
+            // Equation 5: alphabet[k]の1文字で終わりかつ最後の操作がalphabet[l]からのmutの場合
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                int best = INF_DISTANCE;
+                int best_l = 0;
+                for (int l = 0; l < num_alphabet; l++)
+                {
+                    int cost = Cost::MUT[l][k] + source_.alphabet_nonmut_(l, i, j);
+                    if (cost < best)
+                    {
+                        best = cost;
+                        best_l = l;
+                    }
+                }
+                source_.alphabet_(k, i, j) = source_.alphabet_col_(k, i, j) = best;
+                if (choices) choices->mut_[cell * num_alphabet + k] = best_l;
+            }
+
+            // Equation 4: 空文字で終わりの場合
+            int best = INF_DISTANCE;
+            int best_k = 0;
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                int cost = Cost::DEL[k] + source_.alphabet_(k, i, j);
+                if (cost < best)
+                {
+                    best = cost;
+                    best_k = k;
+                }
+            }
+            source_.empty_(i, j) = source_.empty_col_(i, j) = best;
+            if (choices) choices->empty_[cell] = best_k;
+        }
+
+        // Equation 3/6の3つの項をh = i + 1, ..., j - 1についてまとめる
+        // acc[0]: alphabet[i, h) + empty[h, j), acc[1]: empty[i, h) + alphabet[h, j), acc[2]: alphabet[i, h) + alphabet[h, j)
+        // 行iは[i, h)を、ミラーの列jは[h, j)をhの順に連続して持つ. argがあれば最小を与えたh - i - 1も記録する
+        // runの内部の枝刈りが有効ならrunの内部の分割位置を下界で読み飛ばす(for_each_split)
+        void reduce_split_terms(const Stage1Views<Cell> & views, const int i, const int j, Cell (*acc)[NUM_ALPHABET], int (*arg)[NUM_ALPHABET],
+                                const bool is_source) const
+        {
+            constexpr int num_alphabet = NUM_ALPHABET;
+            for (int term = 0; term < 3; term++) fill(acc[term], acc[term] + num_alphabet, INF_DISTANCE);
+            if (arg)
+            {
+                for (int term = 0; term < 3; term++) fill(arg[term], arg[term] + num_alphabet, 0);
+            }
+            // 行iの[i, h)と列jの[h, j)はh = i + 1, ...の順に連続している
+            const Cell * row_alphabet = &views.alphabet_(0, i, i + 1);
+            const Cell * col_alphabet = &views.alphabet_col_(0, i + 1, j);
+            const Cell * row_empty = &views.empty_(i, i + 1);
+            const Cell * col_empty = &views.empty_col_(i + 1, j);
+            // h = lo, ..., hi - 1の分をまとめる
+            auto scan = [&](const int lo, const int hi)
+            {
+                int g0 = lo - i - 1;
+                const Cell * left = row_alphabet + g0 * num_alphabet;
+                const Cell * right = col_alphabet + g0 * num_alphabet;
+                if (hi - lo < MIN_KERNEL_SCAN)
+                {
+                    for (int g = g0; g < hi - i - 1; g++)
+                    {
+                        for (int k = 0; k < num_alphabet; k++)
+                        {
+                            int l = row_alphabet[g * num_alphabet + k];
+                            int r = col_alphabet[g * num_alphabet + k];
+                            int cost[3] = {l + col_empty[g], row_empty[g] + r, l + r};
+                            for (int term = 0; term < 3; term++)
+                            {
+                                if (cost[term] < acc[term][k])
+                                {
+                                    acc[term][k] = cost[term];
+                                    if (arg) arg[term][k] = g;
+                                }
+                            }
+                        }
+                    }
+                    return;
+                }
+                if (arg)
+                {
+                    int found[3][NUM_ALPHABET];
+                    for (int term = 0; term < 3; term++) fill(found[term], found[term] + num_alphabet, -1);
+                    kernels_->broadcast_arg  (left,  col_empty + g0, hi - lo, num_alphabet, acc[0], found[0]);
+                    kernels_->broadcast_arg  (right, row_empty + g0, hi - lo, num_alphabet, acc[1], found[1]);
+                    kernels_->interleaved_arg(left,  right,          hi - lo, num_alphabet, acc[2], found[2]);
+                    for (int term = 0; term < 3; term++)
+                    {
+                        for (int k = 0; k < num_alphabet; k++)
+                        {
+                            if (found[term][k] >= 0) arg[term][k] = g0 + found[term][k];
+                        }
+                    }
+                }
+                else
+                {
+                    kernels_->broadcast  (left,  col_empty + g0, hi - lo, num_alphabet, acc[0]);
+                    kernels_->broadcast  (right, row_empty + g0, hi - lo, num_alphabet, acc[1]);
+                    kernels_->interleaved(left,  right,          hi - lo, num_alphabet, acc[2]);
+                }
+            };
+            const RunIndex * runs = run_index(is_source);
+            if (!runs)
+            {
+                scan(i + 1, j);
+                return;
+            }
+            auto may_improve = [&](const int a, const int b)
+            {
+                const Cell * left = row_alphabet + (b - i - 1) * num_alphabet;
+                const Cell * right = col_alphabet + (a - i - 1) * num_alphabet;
+                int drop = run_slope(is_source, a) * (b - a);
+                int left_empty = row_empty[b - i - 1];
+                int right_empty = col_empty[a - i - 1];
+                for (int k = 0; k < num_alphabet; k++)
+                {
+                    if (left[k] + right_empty - drop < acc[0][k] || left_empty + right[k] - drop < acc[1][k] || left[k] + right[k] - drop < acc[2][k]) return true;
+                }
+                return false;
+            };
+            for_each_split(*runs, i + 1, j - 1, scan, may_improve);
+        }
+
+        // reduce_split_termsの結果からalphabet_nonmut_の値bestを与えた項と分割位置をStage1Choices::split_の形にする
+        static uint32_t encode_split(const int best, const Cell (*acc)[NUM_ALPHABET], const int (*arg)[NUM_ALPHABET], const int k)
+        {
+            int term = (best == acc[0][k]) ? 0 : (best == acc[1][k]) ? 1 : 2;
+            return static_cast<uint32_t>(arg[term][k]) << 2 | term;
+        }
+
+        // 長さ2以上max_width以下の全区間についてcompute_cell(i, j)を短い区間が先になる順に呼ぶ
+        template <class Func>
+        void compute_band(const int len, const int max_width, const Func & compute_cell)
+        {
+            WorkStealingPool * pool = fill_pool();
+            if (!pool)
+            {
+                for (int j = 2; j <= len; j++)
+                {
+                    for (int i = j - 2; i >= max(0, j - max_width); i--) compute_cell(i, j);
+                }
+                return;
+            }
+            // 同じ長さの区間どうしは独立
+            for (int width = 2; width <= min(len, max_width); width++)
+            {
+                pool->parallel_for(0, len - width + 1, max(1, 8192 / width), [&compute_cell, width](const int lo, const int hi)
+                {
+                    for (int i = lo; i < hi; i++) compute_cell(i, i + width);
+                });
+            }
+        }
+
+        // Equation 9と8でedt_[*][i][j]とed_[i][j]を計算する
+        void compute_stage2_cell(const int i, const int j)
+        {
+            // Equation 9: t_[0,j)の末尾だけalphabet1文字から生成されるようなs_[0,i)とt_[0,j)の編集パス
+            compute_edt_cell(i, j, 1);
+
+            // Equation 8: s_[0,i)とt_[0,j)の編集距離
+            compute_ed_cell(i, j, 1);
+        }
+
+        // Equation 8: ed_[i][j] = min_k min(ed_s_to_alphabet[k][0][i] + ed_alphabet_to_t_[k][0][j],
+        //                                   min_h edt_[k][h][j] + ed_s_to_alphabet[k][h][i]) (h_first <= h < i)
+        void compute_ed_cell(const int i, const int j, const int h_first, const bool use_runs = true)
+        {
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            // s_[h,i)がalphabet[k]に変換され、それがt_[0,j)の末尾になるようなs_[0,i)とt_[0,j)の編集パス
+            Cell acc[NUM_ALPHABET];
+            int arg[NUM_ALPHABET] = {};
+            fill(acc, acc + num_alphabet, INF_DISTANCE);
+            bool record = traceback_mode_ != TracebackMode::NONE;
+            // edt_の列jとsource_.alphabet_col_の列iはhの順に連続している
+            const Cell * edt_col = &edt_(0, h_first, j);
+            const Cell * source_col = &source_.alphabet_col_(0, h_first, i);
+            // h = lo, ..., hi - 1の分をまとめる
+            auto scan = [&](const int lo, const int hi)
+            {
+                const Cell * a = edt_col + (lo - h_first) * num_alphabet;
+                const Cell * b = source_col + (lo - h_first) * num_alphabet;
+                if (hi - lo < MIN_KERNEL_SCAN)
+                {
+                    for (int g = 0; g < hi - lo; g++)
+                    {
+                        for (int k = 0; k < num_alphabet; k++)
+                        {
+                            int cost = a[g * num_alphabet + k] + b[g * num_alphabet + k];
+                            if (cost < acc[k])
+                            {
+                                acc[k] = cost;
+                                arg[k] = lo + g - h_first;
+                            }
+                        }
+                    }
+                    return;
+                }
+                if (!record)
+                {
+                    kernels_->interleaved(a, b, hi - lo, num_alphabet, acc);
+                    return;
+                }
+                int found[NUM_ALPHABET];
+                fill(found, found + num_alphabet, -1);
+                kernels_->interleaved_arg(a, b, hi - lo, num_alphabet, acc, found);
+                for (int k = 0; k < num_alphabet; k++)
+                {
+                    if (found[k] >= 0) arg[k] = lo + found[k] - h_first;
+                }
+            };
+            const RunIndex * runs = use_runs ? run_index(true) : nullptr;
+            if (runs)
+            {
+                // edt_[k][h][j]はs_[0,h)の末尾に、alphabet_[k][h][i]はs_[h,i)の先頭にrunの文字を足せる
+                auto may_improve = [&](const int a, const int b)
+                {
+                    const Cell * left = edt_col + (b - h_first) * num_alphabet;
+                    const Cell * right = source_col + (a - h_first) * num_alphabet;
+                    int drop = run_slope(true, a) * (b - a);
+                    for (int k = 0; k < num_alphabet; k++)
+                    {
+                        if (left[k] + right[k] - drop < acc[k]) return true;
+                    }
+                    return false;
+                };
+                for_each_split(*runs, h_first, i - 1, scan, may_improve);
+            }
+            else scan(h_first, i);
+            int best = INF_DISTANCE;
+            uint32_t choice = 0;
+            for (int k = 0; k < num_alphabet; k++)
+            {
+                // s_[0,i)をalphabet[k]に変換し、それをさらにt_[0,j)に変換するときの編集距離 (帯状のStage 1に無い区間なら使わない)
+                int ed1 = (source_.alphabet_.in_band(0, i) && target_.alphabet_.in_band(0, j))
+                              ? source_.alphabet_(k, 0, i) + target_.alphabet_(k, 0, j) : INF_DISTANCE;
+                if (ed1 < best)
+                {
+                    best = ed1;
+                    choice = k;
+                }
+                if (acc[k] < best)
+                {
+                    best = acc[k];
+                    choice = static_cast<uint32_t>(h_first + arg[k]) << 4 | k;
+                }
+            }
+            ed_(i, j) = best;
+            if (record) ed_choice_[ed_.cell(i, j)] = choice;
+        }
+
+        // Equation 9: edt_[k][i][j] = min_h ed_[i][h] + ed_alphabet_to_t_[k][h][j] (h_first <= h < j)
+        void compute_edt_cell(const int i, const int j, const int h_first, const bool use_runs = true)
+        {
+            constexpr int num_alphabet = NUM_ALPHABET;
+            Cell acc[NUM_ALPHABET];
+            int arg[NUM_ALPHABET] = {};
+            fill(acc, acc + num_alphabet, INF_DISTANCE);
+            bool record = traceback_mode_ == TracebackMode::FULL;
+            // target_.alphabet_col_の列jとed_の行iはhの順に連続している
+            const Cell * target_col = &target_.alphabet_col_(0, h_first, j);
+            const Cell * ed_row = &ed_(i, h_first);
+            auto scan = [&](const int lo, const int hi)
+            {
+                const Cell * a = target_col + (lo - h_first) * num_alphabet;
+                const Cell * y = ed_row + (lo - h_first);
+                if (hi - lo < MIN_KERNEL_SCAN)
                 {
-                    // Equation 3: alphabet_[k]の1文字スタートかつ最初の操作がmutでない場合
-                    for (int k = 0; k < num_alphabet; k++)
+                    for (int g = 0; g < hi - lo; g++)
                     {
-                        vector<int> tmp1(j - i - 1, INT_MAX);
-                        vector<int> tmp2(j - i - 1, INT_MAX);
-                        vector<int> tmp3(j - i - 1, INT_MAX);
-                        for (int h = i + 1; h < j; h++)
+                        for (int k = 0; k < num_alphabet; k++)
                         {
-                            tmp1[h - i - 1] = ed_alphabet_to_t_[k][i][h] + ed_empty_to_t_[h][j];
-                            tmp2[h - i - 1] = ed_empty_to_t_[i][h] + ed_alphabet_to_t_[k][h][j];
-                            tmp3[h - i - 1] = dup(alphabet_[k]) + ed_alphabet_to_t_[k][i][h] + ed_alphabet_to_t_[k][h][j];
+                            int cost = a[g * num_alphabet + k] + y[g];
+                            if (cost < acc[k])
+                            {
+                                acc[k] = cost;
+                                arg[k] = lo + g - h_first;
+                            }
                         }
-                        int tmp1_min = *min_element(tmp1.begin(), tmp1.end());
-                        int tmp2_min = *min_element(tmp2.begin(), tmp2.end());
-                        int tmp3_min = *min_element(tmp3.begin(), tmp3.end());
-                        ed_alphabet_to_t_nonred_[k][i][j] = min({tmp1_min, tmp2_min, tmp3_min});
                     }
-
-                    // Equation 2: alphabet_[k]の1文字スタートかつ最初の操作がalphabet_[l]へのmutの場合
+                    return;
+                }
+                if (!record)
+                {
+                    kernels_->broadcast(a, y, hi - lo, num_alphabet, acc);
+                    return;
+                }
+                int found[NUM_ALPHABET];
+                fill(found, found + num_alphabet, -1);
+                kernels_->broadcast_arg(a, y, hi - lo, num_alphabet, acc, found);
+                for (int k = 0; k < num_alphabet; k++)
+                {
+                    if (found[k] >= 0) arg[k] = lo + found[k] - h_first;
+                }
+            };
+            const RunIndex * runs = use_runs ? run_index(false) : nullptr;
+            if (runs)
+            {
+                // ed_[i][h]はt_[0,h)の末尾に、alphabet_[k][h][j]はt_[h,j)の先頭にrunの文字を足せる
+                auto may_improve = [&](const int a, const int b)
+                {
+                    const Cell * right = target_col + (a - h_first) * num_alphabet;
+                    int left = ed_row[b - h_first] - run_slope(false, a) * (b - a);
                     for (int k = 0; k < num_alphabet; k++)
                     {
-                        vector<int> tmp;
-                        for (int l = 0; l < num_alphabet; l++)
-                        {
-                            tmp.push_back(mut(alphabet_[k], alphabet_[l]) + ed_alphabet_to_t_nonred_[l][i][j]);
-                        }
-                        ed_alphabet_to_t_[k][i][j] = *min_element(tmp.begin(), tmp.end());
+                        if (left + right[k] < acc[k]) return true;
                     }
+                    return false;
+                };
+                for_each_split(*runs, h_first, j - 1, scan, may_improve);
+            }
+            else scan(h_first, j);
+            for (int k = 0; k < num_alphabet; k++) edt_(k, i, j) = acc[k];
+            if (record)
+            {
+                for (int k = 0; k < num_alphabet; k++) edt_choice_[edt_.cell(i, j) * num_alphabet + k] = h_first + arg[k];
+            }
+        }
 
-                    // Equation 1: 空文字スタートの場合
-                    vector<int> tmp;
-                    for (int k = 0; k < num_alphabet; k++)
-                    {
-                        tmp.push_back(ins(alphabet_[k]) + ed_alphabet_to_t_[k][i][j]);
-                    }   
-                    ed_empty_to_t_[i][j] = *min_element(tmp.begin(), tmp.end());
+        // ed_(len_s, len_t)からEquation 8/9で選んだ候補を逆に辿り、s_の区間 -> alphabet[k] -> t_の区間 というブロックに分ける
+        // 各ブロックについてs_側の縮約、t_側の生成の順に操作を並べたものをscript_にする
+        void trace_stage2()
+        {
+            struct Block { int k, s_begin, s_end, t_begin, t_end; };
+            vector<Block> blocks;
+            int i = s_.size();
+            int j = t_.size();
+            while (i >= 2 && j >= 2)
+            {
+                uint32_t choice = ed_choice_[ed_.cell(i, j)];
+                int k = choice & 15;
+                int h = choice >> 4;
+                if (h == 0)
+                {
+                    // ed1の項: s_[0, i)全体がalphabet[k]を経由してt_[0, j)になる
+                    blocks.push_back({k, 0, i, 0, j});
+                    i = j = 0;
+                    break;
                 }
+                int h_t = edt_choice(k, h, j);
+                blocks.push_back({k, h, i, h_t, j});
+                i = h;
+                j = h_t;
             }
 
-            for (int j = 2; j <= len_s; j++)
+            // 残りはinit_stage2で埋めたセル
+            script_.clear();
+            if (i == 0 && j > 0) trace_target_empty(0, j, 0);
+            else if (j == 0 && i > 0) trace_source_empty(0, i, 0);
+            else if (i == 1 && j >= 2) blocks.push_back({s_code_[0], 0, 1, 0, j});
+            else if (i >= 1 && j == 1) blocks.push_back({t_code_[0], 0, i, 0, 1});
+            for (auto block = blocks.rbegin(); block != blocks.rend(); block++)
             {
-                for (int i = j - 2; i >= 0; i--)
-                {
-                    // Equation 6 : alphabet_[k]の1文字で終わりかつ最後の操作がmutでない場合
-                    for (int k = 0; k < num_alphabet; k++)
-                    {
-                        vector<int> tmp1(j - i - 1, INT_MAX);
-                        vector<int> tmp2(j - i - 1, INT_MAX);
-                        vector<int> tmp3(j - i - 1, INT_MAX);
-                        for (int h = i + 1; h < j; h++)
-                        {
-                            tmp1[h - i - 1] = ed_s_to_alphabet_[k][i][h] + ed_s_to_empty_[h][j];
-                            tmp2[h - i - 1] = ed_s_to_empty_[i][h] + ed_s_to_alphabet_[k][h][j];
-                            tmp3[h - i - 1] = cont(alphabet_[k]) + ed_s_to_alphabet_[k][i][h] + ed_s_to_alphabet_[k][h][j];
-                        }
-                        int tmp1_min = *min_element(tmp1.begin(), tmp1.end());
-                        int tmp2_min = *min_element(tmp2.begin(), tmp2.end());
-                        int tmp3_min = *min_element(tmp3.begin(), tmp3.end());
-                        ed_s_to_alphabet_nongen_[k][i][j] = min({tmp1_min, tmp2_min, tmp3_min});
-                    }
+                trace_source_alphabet(block->k, block->s_begin, block->s_end, block->t_begin, block->t_end);
+                trace_target_alphabet(block->k, block->t_begin, block->t_end, block->s_begin, block->s_end);
+            }
+        }
 
-                    // Equation 5: alphabet_[k]の1文字で終わりかつ最後の操作がalphabet_[l]からのmutの場合
-                    for (int k = 0; k < num_alphabet; k++)
-                    {
-                        vector<int> tmp;
-                        for (int l = 0; l < num_alphabet; l++)
-                        {
-                            tmp.push_back(mut(alphabet_[l], alphabet_[k]) + ed_s_to_alphabet_nongen_[l][i][j]);
-                        }
-                        ed_s_to_alphabet_[k][i][j] = *min_element(tmp.begin(), tmp.end());
-                    }
+        // Equation 9でedt_(k, i, j)を与えたh
+        int edt_choice(const int k, const int i, const int j) const
+        {
+            if (traceback_mode_ == TracebackMode::FULL) return edt_choice_[edt_.cell(i, j) * NUM_ALPHABET + k];
 
-                    // Equation 4: 空文字で終わりの場合
-                    vector<int> tmp;
-                    for (int k = 0; k < num_alphabet; k++)
-                    {
-                        tmp.push_back(del(alphabet_[k]) + ed_s_to_alphabet_[k][i][j]);
-                    }   
-                    ed_s_to_empty_[i][j] = *min_element(tmp.begin(), tmp.end());
+            // CHECKPOINTEDでは列jのedt_は残っていないので、ed_の行iから選び直す
+            int best = INF_DISTANCE;
+            int best_h = 1;
+            for (int h = 1; h < j; h++)
+            {
+                int cost = ed_(i, h) + target_.alphabet_(k, h, j);
+                if (cost < best)
+                {
+                    best = cost;
+                    best_h = h;
                 }
             }
+            return best_h;
+        }
 
-            // Stage 2: source文字列とtarget文字列のどちらも2文字以上の場合の編集距離を計算
-            // s_[0]とt_[0]のalphabet_のインデックスを取得
-            int s0_idx = 0;
-            int t0_idx = 0;
-            for (int i = 0; i < num_alphabet; i++)
+        // Equation 3/6でalphabet_nonmut_(l, a, b)を与えた分割位置hと項(encode_splitと同じ番号)
+        pair<int, int> split_choice(const bool is_source, const int l, const int a, const int b) const
+        {
+            const Stage1Views<Cell> & views = is_source ? source_ : target_;
+            if (traceback_mode_ == TracebackMode::FULL)
             {
-                if (s_[0] == alphabet_[i]) break;
-                else s0_idx++;
+                const Stage1Choices & choices = is_source ? source_choices_ : target_choices_;
+                uint32_t choice = choices.split_[views.alphabet_nonmut_.cell(a, b) * NUM_ALPHABET + l];
+                return {a + 1 + static_cast<int>(choice >> 2), static_cast<int>(choice & 3)};
             }
-            for (int i = 0; i < num_alphabet; i++)
+
+            // CHECKPOINTEDでは[a, b)の分割位置だけを走査し直す
+            int value = views.alphabet_nonmut_(l, a, b);
+            int merge_cost = is_source ? Cost::CONT[l] : Cost::DUP[l];
+            for (int h = a + 1; h < b; h++)
             {
-                if (t_[0] == alphabet_[i]) break;
-                else t0_idx++;
+                if (views.alphabet_(l, a, h) + views.empty_(h, b) == value) return {h, 0};
+                if (views.empty_(a, h) + views.alphabet_(l, h, b) == value) return {h, 1};
+                if (merge_cost + views.alphabet_(l, a, h) + views.alphabet_(l, h, b) == value) return {h, 2};
             }
+            return {a + 1, 2}; // ここには来ない
+        }
 
-            // DPテーブルの初期化
-            ed_[0][0] = 0;
-            for (int i = 1; i <= len_t; i++)
+        // Equation 2/5でalphabet_(k, a, b)を与えたl
+        int mut_choice(const bool is_source, const int k, const int a, const int b) const
+        {
+            const Stage1Views<Cell> & views = is_source ? source_ : target_;
+            if (traceback_mode_ == TracebackMode::FULL)
             {
-                ed_[0][i] = ed_empty_to_t_[0][i];
-                ed_[1][i] = ed_alphabet_to_t_[s0_idx][0][i];
+                const Stage1Choices & choices = is_source ? source_choices_ : target_choices_;
+                return choices.mut_[views.alphabet_.cell(a, b) * NUM_ALPHABET + k];
             }
-            for (int i = 1; i <= len_s; i++)
+
+            int value = views.alphabet_(k, a, b);
+            for (int l = 0; l < NUM_ALPHABET; l++)
             {
-                ed_[i][0] = ed_s_to_empty_[0][i];
-                ed_[i][1] = ed_s_to_alphabet_[t0_idx][0][i];
+                int cost = is_source ? Cost::MUT[l][k] : Cost::MUT[k][l];
+                if (cost + views.alphabet_nonmut_(l, a, b) == value) return l;
             }
-            // 論文には書いてないけどedt_の1行目もEquation 9で初期化しておく必要がある
-            for (int j = 2; j <= len_t; j++)
+            return k; // ここには来ない
+        }
+
+        // Equation 1/4でempty_(a, b)を与えたk
+        int empty_choice(const bool is_source, const int a, const int b) const
+        {
+            const Stage1Views<Cell> & views = is_source ? source_ : target_;
+            if (traceback_mode_ == TracebackMode::FULL)
             {
-                for (int k = 0; k < num_alphabet; k++)
-                {
-                    vector<int> tmp(j - 1, INT_MAX);
-                    for (int h = 1; h < j; h++)
-                    {
-                        tmp[h - 1] = ed_[1][h] + ed_alphabet_to_t_[k][h][j];
-                    }
-                    edt_[k][1][j] = *min_element(tmp.begin(), tmp.end());
-                }
+                const Stage1Choices & choices = is_source ? source_choices_ : target_choices_;
+                return choices.empty_[views.empty_.cell(a, b)];
             }
 
-            for (int j = 2; j <= len_t; j++)
+            int value = views.empty_(a, b);
+            for (int k = 0; k < NUM_ALPHABET; k++)
             {
-                for (int i = 2; i <= len_s; i++)
-                {
-                    // Equation 9: t_[0,j)の末尾だけalphabet1文字から生成されるようなs_[0,i)とt_[0,j)の編集パス
-                    for (int k = 0; k < num_alphabet; k++)
-                    {
-                        vector<int> tmp(j - 1, INT_MAX);
-                        for (int h = 1; h < j; h++)
-                        {
-                            tmp[h - 1] = ed_[i][h] + ed_alphabet_to_t_[k][h][j]; // s_[0,i)がt_[0,h)に変換され、alphabet_[k]がt_[h,j)に変換される場合の編集距離
-                        }
-                        edt_[k][i][j] = *min_element(tmp.begin(), tmp.end());
-                    }
+                int cost = is_source ? Cost::DEL[k] : Cost::INS[k];
+                if (cost + views.alphabet_(k, a, b) == value) return k;
+            }
+            return 0; // ここには来ない
+        }
 
-                    // Equation 8: s_[0,i)とt_[0,j)の編集距離
-                    vector<int> tmp((i - 1) * num_alphabet, INT_MAX);
-                    for (int k = 0; k < num_alphabet; k++)
-                    {
-                        for (int h = 1; h < i; h++)
-                        {
-                            int ed1 = ed_s_to_alphabet_[k][0][i] + ed_alphabet_to_t_[k][0][j]; // s_[0,i)をalphabet_[k]に変換し、それをさらにt_[0,j)に変換するときの編集距離
-                            int ed2 = edt_[k][h][j] + ed_s_to_alphabet_[k][h][i];              // s_[h,i)がalphabet_[k]に変換され、それがt_[0,j)の末尾になるようなs_[0,i)とt_[0,j)の編集パス
-                            tmp[(k * (i - 1)) + (h - 1)] = min({ed1, ed2});
-                        }
-                    }
-                    ed_[i][j] = *min_element(tmp.begin(), tmp.end());
-                }
+        // s_[a, b)をalphabet[k]に縮約する操作を適用順にscript_に追加する([t_begin, t_end)はその文字から生成されるt_の区間)
+        void trace_source_alphabet(const int k, const int a, const int b, const int t_begin, const int t_end)
+        {
+            char c = Cost::ALPHABET[k];
+            if (b - a == 1)
+            {
+                script_.push_back({s_code_[a] == k ? EditOperation::MATCH : EditOperation::MUTATION, s_[a], c, Cost::MUT[s_code_[a]][k], a, b, t_begin, t_end});
+                return;
             }
-            
-            return ed_[len_s][len_t];
+            int l = mut_choice(true, k, a, b);
+            trace_source_nonmut(l, a, b, t_begin, t_end);
+            if (l != k) script_.push_back({EditOperation::MUTATION, Cost::ALPHABET[l], c, Cost::MUT[l][k], a, b, t_begin, t_end});
         }
 
-        vector<vector<int>> &         get_ed_s_to_empty()           { return ed_s_to_empty_;           }
-        vector<vector<vector<int>>> & get_ed_s_to_alphabet()        { return ed_s_to_alphabet_;        }
-        vector<vector<vector<int>>> & get_ed_s_to_alphabet_nongen() { return ed_s_to_alphabet_nongen_; }
-        vector<vector<int>> &         get_ed_empty_to_t()           { return ed_empty_to_t_;           }
-        vector<vector<vector<int>>> & get_ed_alphabet_to_t()        { return ed_alphabet_to_t_;        }
-        vector<vector<vector<int>>> & get_ed_alphabet_to_t_nonred() { return ed_alphabet_to_t_nonred_; } 
-        vector<vector<vector<int>>> & get_edt()                     { return edt_;                     }
-        vector<vector<int>> &         get_ed()                      { return ed_;                      }
+        // Equation 6: 最後の操作がmutでない場合
+        void trace_source_nonmut(const int l, const int a, const int b, const int t_begin, const int t_end)
+        {
+            auto [h, term] = split_choice(true, l, a, b);
+            if (term == 0)
+            {
+                trace_source_alphabet(l, a, h, t_begin, t_end);
+                trace_source_empty(h, b, t_begin);
+            }
+            else if (term == 1)
+            {
+                trace_source_empty(a, h, t_begin);
+                trace_source_alphabet(l, h, b, t_begin, t_end);
+            }
+            else
+            {
+                trace_source_alphabet(l, a, h, t_begin, t_end);
+                trace_source_alphabet(l, h, b, t_begin, t_end);
+                script_.push_back({EditOperation::CONTRACTION, Cost::ALPHABET[l], Cost::ALPHABET[l], Cost::CONT[l], a, b, t_begin, t_end, h});
+            }
+        }
 
-    private:
-        const string                s_;                       // source文字列
-        const string                t_;                       // target文字列
-        vector<char>                alphabet_ = {'A', 'C', 'G', 'T'};
-        vector<vector<int>>         ed_s_to_empty_;           // s_[i, j]から空文字列への編集距離
-        vector<vector<vector<int>>> ed_s_to_alphabet_;        // s_[i, j]からalphabet_[k]への編集距離
-        vector<vector<vector<int>>> ed_s_to_alphabet_nongen_; // s_[i, j]からalphabet_[k]へのnon-generatingな操作による編集距離
-        vector<vector<int>>         ed_empty_to_t_;           // 空文字列からt_[i, j]への編集距離
-        vector<vector<vector<int>>> ed_alphabet_to_t_;        // alphabet_[k]からt_[i, j]への編集距離
-        vector<vector<vector<int>>> ed_alphabet_to_t_nonred_; // alphabet_[k]からt_[i, j]へのnon-reducingな操作による編集距離
-        vector<vector<vector<int>>> edt_;                     // alphabet_[k]を経由したs_[0, i]からt_[0, j]への編集距離
-        vector<vector<int>>         ed_;                      // s_[0, i]からt_[0, j]への編集距離
+        // Equation 4: s_[a, b)を全て削除する
+        void trace_source_empty(const int a, const int b, const int t_pos)
+        {
+            if (b - a == 1)
+            {
+                script_.push_back({EditOperation::DELETION, s_[a], '-', Cost::DEL[s_code_[a]], a, b, t_pos, t_pos});
+                return;
+            }
+            int k = empty_choice(true, a, b);
+            trace_source_alphabet(k, a, b, t_pos, t_pos);
+            script_.push_back({EditOperation::DELETION, Cost::ALPHABET[k], '-', Cost::DEL[k], a, b, t_pos, t_pos});
+        }
 
-        void print_dp_tables()
+        // alphabet[k]からt_[a, b)を生成する操作を適用順にscript_に追加する([s_begin, s_end)はその文字に縮約されたs_の区間)
+        void trace_target_alphabet(const int k, const int a, const int b, const int s_begin, const int s_end)
         {
-            cout << "ED: S to Empty:" << "\n";
-            for (auto & row : ed_s_to_empty_)
+            char c = Cost::ALPHABET[k];
+            if (b - a == 1)
+            {
+                script_.push_back({t_code_[a] == k ? EditOperation::MATCH : EditOperation::MUTATION, c, t_[a], Cost::MUT[k][t_code_[a]], s_begin, s_end, a, b});
+                return;
+            }
+            int l = mut_choice(false, k, a, b);
+            if (l != k) script_.push_back({EditOperation::MUTATION, c, Cost::ALPHABET[l], Cost::MUT[k][l], s_begin, s_end, a, b});
+            trace_target_nonmut(l, a, b, s_begin, s_end);
+        }
+
+        // Equation 3: 最初の操作がmutでない場合
+        void trace_target_nonmut(const int l, const int a, const int b, const int s_begin, const int s_end)
+        {
+            auto [h, term] = split_choice(false, l, a, b);
+            if (term == 0)
+            {
+                trace_target_alphabet(l, a, h, s_begin, s_end);
+                trace_target_empty(h, b, s_begin);
+            }
+            else if (term == 1)
+            {
+                trace_target_empty(a, h, s_begin);
+                trace_target_alphabet(l, h, b, s_begin, s_end);
+            }
+            else
+            {
+                script_.push_back({EditOperation::DUPLICATION, Cost::ALPHABET[l], Cost::ALPHABET[l], Cost::DUP[l], s_begin, s_end, a, b, h});
+                trace_target_alphabet(l, a, h, s_begin, s_end);
+                trace_target_alphabet(l, h, b, s_begin, s_end);
+            }
+        }
+
+        // Equation 1: t_[a, b)を全て挿入する
+        void trace_target_empty(const int a, const int b, const int s_pos)
+        {
+            if (b - a == 1)
+            {
+                script_.push_back({EditOperation::INSERTION, '-', t_[a], Cost::INS[t_code_[a]], s_pos, s_pos, a, b});
+                return;
+            }
+            int k = empty_choice(false, a, b);
+            script_.push_back({EditOperation::INSERTION, '-', Cost::ALPHABET[k], Cost::INS[k], s_pos, s_pos, a, b});
+            trace_target_alphabet(k, a, b, s_pos, s_pos);
+        }
+
+        void print_interval_table(const IntervalTableView<Cell> & table, const int k)
+        {
+            for (int i = 0; i <= table.len_; i++)
             {
-                for (const auto & val : row)
+                for (int j = 0; j <= table.len_; j++)
                 {
-                    cout << val << " ";
+                    cout << (j < i || !table.in_band(i, j) ? 0 : table(k, i, j)) << " ";
                 }
                 cout << "\n";
             }
-            
-            cout << "ED: S to Alphabet:" << "\n";
-            for (int i = 0; i < ed_s_to_alphabet_.size(); i++)
+        }
+
+        void print_matrix(const MatrixView<Cell> & table, const int k)
+        {
+            for (int i = 0; i < table.rows_; i++)
             {
-                cout << "Alphabet " << alphabet_[i] << ":\n";
-                for (const auto & row : ed_s_to_alphabet_[i])
+                for (int j = 0; j < table.cols_; j++)
                 {
-                    for (const auto & val : row)
-                    {
-                        cout << val << " ";
-                    }
-                    cout << "\n";
+                    cout << (table.in_band(i, j) ? table(k, i, j) : 0) << " ";
                 }
+                cout << "\n";
+            }
+        }
+
+        void print_dp_tables()
+        {
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            cout << "ED: S to Empty:" << "\n";
+            print_interval_table(source_.empty_, 0);
+
+            cout << "ED: S to Alphabet:" << "\n";
+            for (int i = 0; i < num_alphabet; i++)
+            {
+                cout << "Alphabet " << Cost::ALPHABET[i] << ":\n";
+                print_interval_table(source_.alphabet_, i);
             }
 
             cout << "ED: S to Alphabet non-gen:" << "\n";
-            for (int i = 0; i < ed_s_to_alphabet_nongen_.size(); i++)
+            for (int i = 0; i < num_alphabet; i++)
             {
-                cout << "Alphabet " << alphabet_[i] << ":\n";
-                for (const auto & row : ed_s_to_alphabet_nongen_[i])
-                {
-                    for (const auto & val : row)
-                    {
-                        cout << val << " ";
-                    }
-                    cout << "\n";
-                }
+                cout << "Alphabet " << Cost::ALPHABET[i] << ":\n";
+                print_interval_table(source_.alphabet_nonmut_, i);
             }
 
             cout << "ED: Empty to T:" << "\n";
-            for (const auto & row : ed_empty_to_t_)
+            print_interval_table(target_.empty_, 0);
+
+            cout << "ED: Alphabet to T:" << "\n";
+            for (int i = 0; i < num_alphabet; i++)
+            {
+                cout << "Alphabet " << Cost::ALPHABET[i] << ":\n";
+                print_interval_table(target_.alphabet_, i);
+            }
+
+            cout << "ED: Alphabet to T non-reducing:" << "\n";
+            for (int i = 0; i < num_alphabet; i++)
+            {
+                cout << "Alphabet " << Cost::ALPHABET[i] << ":\n";
+                print_interval_table(target_.alphabet_nonmut_, i);
+            }
+
+            cout << "EDT:" << "\n";
+            for (int i = 0; i < num_alphabet; i++)
+            {
+                cout << "Alphabet " << Cost::ALPHABET[i] << ":\n";
+                print_matrix(edt_, i);
+            }
+
+            cout << "ED:" << "\n";
+            print_matrix(ed_, 0);
+        }
+};
+
+//--------------------------------------------------------------------------------------------------------
+// 文字列の組ごとにDPテーブルのセルの型を選ぶEDDC
+// 編集距離の上界(compute_edit_distance(max_distance)ならmax_distance + 1)がCellTraits<int16_t>::INF未満なら
+// int16_tのセルでテーブルのメモリを半分、min-plusのSIMDのレーン数を倍にし、そうでなければintのセルを使う
+//--------------------------------------------------------------------------------------------------------
+template <class Cost = Kimura2ParameterCost<>>
+struct AdaptiveEDDC
+{
+    public:
+        AdaptiveEDDC(const string & s, const string & t, const int num_threads = 1, const DistanceEngine engine = DistanceEngine::AUTO)
+            : s_(s), t_(t), num_threads_(max(1, num_threads)), engine_(engine)
+            {}
+
+        void set_num_threads(const int num_threads)          { num_threads_ = max(1, num_threads); }
+        void set_run_pruning(const bool enabled)             { run_pruning_ = enabled;              }
+        void set_distance_engine(const DistanceEngine engine) { engine_ = engine;                    }
+
+        void set_strings(const string & s, const string & t)
+        {
+            s_ = s;
+            t_ = t;
+        }
+
+        // BANDED, AUTOなら上界がCellTraits<int16_t>::INF以上でも、編集距離自体が小さければint16_tで足りるので先に試す
+        int compute_edit_distance()
+        {
+            auto compute = [](auto & engine) { return engine.compute_edit_distance(); };
+            if (fits_narrow()) return dispatch(true, compute);
+            if (engine_ != DistanceEngine::CUBIC)
+            {
+                int distance = dispatch(true, compute);
+                if (distance < CellTraits<int16_t>::INF) return distance;
+            }
+            return dispatch(false, compute);
+        }
+
+        int compute_edit_distance(const int max_distance)
+        {
+            bool narrow = fits_narrow() || max_distance + 1 < CellTraits<int16_t>::INF;
+            return dispatch(narrow, [max_distance](auto & engine) { return engine.compute_edit_distance(max_distance); });
+        }
+
+        int compute_edit_script(const TracebackMode mode = TracebackMode::FULL)
+        {
+            return dispatch(fits_narrow(), [this, mode](auto & engine)
+            {
+                int distance = engine.compute_edit_script(mode);
+                script_ = engine.get_edit_script();
+                return distance;
+            });
+        }
+
+        const vector<EditOperation> & get_edit_script()   const { return script_;                                               }
+        bool                          uses_narrow_cells() const { return narrow_ != nullptr;                                    }
+        size_t                        get_arena_bytes()   const { return narrow_ ? narrow_->get_arena_bytes() : wide_ ? wide_->get_arena_bytes() : 0; }
+        StageTimes                    get_stage_times()   const { return narrow_ ? narrow_->get_stage_times() : wide_ ? wide_->get_stage_times() : StageTimes(); }
+        const char *                  get_kernel_name()   const { return narrow_ ? narrow_->get_kernel_name() : wide_ ? wide_->get_kernel_name() : "";           }
+        int                           get_num_threads()   const { return num_threads_;                                          }
+
+    private:
+        string                             s_;
+        string                             t_;
+        int                                num_threads_ {1};
+        bool                               run_pruning_ {false};
+        DistanceEngine                     engine_ {DistanceEngine::AUTO};
+        vector<EditOperation>              script_;
+        unique_ptr<EDDC<Cost, int16_t>>    narrow_;   // 直前の計算で使ったエンジン(使わない方は解放する)
+        unique_ptr<EDDC<Cost, int>>        wide_;
+
+        bool fits_narrow() const { return EDDC<Cost, int16_t>::distance_upper_bound(s_, t_) < CellTraits<int16_t>::INF; }
+
+        // 選んだ型のエンジンに文字列と設定を渡してfuncを呼ぶ
+        template <class Func>
+        int dispatch(const bool narrow, const Func & func)
+        {
+            auto run = [&](auto & engine, auto & other)
             {
-                for (const auto & val : row)
+                other.reset();
+                if (!engine) engine = make_unique<typename remove_reference_t<decltype(engine)>::element_type>(s_, t_, num_threads_);
+                else
                 {
-                    cout << val << " ";
+                    engine->set_strings(s_, t_);
+                    engine->set_num_threads(num_threads_);
                 }
-                cout << "\n";
+                engine->set_run_pruning(run_pruning_);
+                engine->set_distance_engine(engine_);
+                return func(*engine);
+            };
+            return narrow ? run(narrow_, wide_) : run(wide_, narrow_);
+        }
+};
+
+//--------------------------------------------------------------------------------------------------------
+// 多数の配列の全ペアについてEDDCを計算し、距離行列を作る
+// Stage 1のテーブルは1本の文字列だけで決まるので、配列ごとにsource側とtarget側を1度だけ計算し、
+// memory_budget_に収まる範囲でキャッシュして各ペアのStage 2に使い回す
+// 収まらないときは配列をsource側のタイルとtarget側のタイルに分け、タイルごとにキャッシュを入れ替える
+//--------------------------------------------------------------------------------------------------------
+template <class Cost = Kimura2ParameterCost<>>
+struct EDDCBatch
+{
+    public:
+        EDDCBatch(const vector<string> & seqs, const int num_threads = 1, const size_t memory_budget = static_cast<size_t>(1) << 30)
+            : seqs_(seqs), num_threads_(max(1, num_threads)), memory_budget_(memory_budget)
+            {}
+
+        // max_distance >= 0なら各ペアをEDDC::compute_edit_distance(max_distance)で計算する
+        // (max_distanceを超えるペアの値はmax_distance + 1になる)
+        void set_max_distance(const int max_distance) { max_distance_ = max_distance; }
+
+        // コストが対称ならi < jのペアだけ計算して写す。非対称なら両方向を計算し、
+        // get_distance_matrix()[a][b] = [b][a]はmin(d(seqs[a], seqs[b]), d(seqs[b], seqs[a]))、
+        // get_directed_distance_matrix()[a][b]はseqs[a]をseqs[b]に変える向きの距離d(seqs[a], seqs[b])になる
+        // 全てのペアで編集距離の上界(またはmax_distance + 1)がCellTraits<int16_t>::INF未満ならint16_tのセルで計算する
+        vector<vector<int>> & compute_distance_matrix()
+        {
+            long long max_source_bound = 0;
+            long long max_target_bound = 0;
+            for (auto & seq : seqs_)
+            {
+                max_source_bound = max(max_source_bound, EDDC<Cost, int16_t>::source_bound(seq));
+                max_target_bound = max(max_target_bound, EDDC<Cost, int16_t>::target_bound(seq));
             }
+            long long upper_bound = EDDC<Cost, int16_t>::block_bound() + max_source_bound + max_target_bound;
+            narrow_cells_ = upper_bound < CellTraits<int16_t>::INF || (max_distance_ >= 0 && max_distance_ + 1 < CellTraits<int16_t>::INF);
+            return narrow_cells_ ? compute_matrix<int16_t>() : compute_matrix<int>();
+        }
 
-            cout << "ED: Alphabet to T:" << "\n";
-            for (int i = 0; i < ed_alphabet_to_t_.size(); i++)
+        vector<vector<int>> & get_distance_matrix()           { return matrix_;                  }
+        vector<vector<int>> & get_directed_distance_matrix()  { return directed_;                }
+        int                   get_num_stage1_computations() { return num_stage1_computations_; }
+        bool                  uses_narrow_cells()           { return narrow_cells_;            }
+
+    private:
+        vector<string>      seqs_;
+        int                 num_threads_ {1};
+        size_t              memory_budget_ {0};               // Stage 1のキャッシュとStage 2のテーブルに使ってよいバイト数
+        int                 max_distance_ {-1};               // 負なら打ち切りなし
+        vector<vector<int>> matrix_;                          // 距離行列(対称)
+        vector<vector<int>> directed_;                        // 向きのある距離行列(コストが対称ならmatrix_と同じ)
+        int                 num_stage1_computations_ {0};     // Stage 1のテーブルを計算した回数(キャッシュの効き具合)
+        bool                narrow_cells_ {false};            // 直前の計算でint16_tのセルを使ったか
+
+        template <class Cell>
+        vector<vector<int>> & compute_matrix()
+        {
+            int num_seqs = seqs_.size();
+            matrix_.assign(num_seqs, vector<int>(num_seqs, 0));
+            directed_ = matrix_;
+            num_stage1_computations_ = 0;
+            if (num_seqs < 2) return matrix_;
+
+            unique_ptr<WorkStealingPool> pool;
+            if (num_threads_ > 1) pool = make_unique<WorkStealingPool>(num_threads_);
+            auto run = [&pool](const int count, const auto & func)
+            {
+                if (pool) pool->parallel_for(0, count, 1, [&func](const int lo, const int hi) { for (int x = lo; x < hi; x++) func(x); });
+                else for (int x = 0; x < count; x++) func(x);
+            };
+
+            // スレッドごとのStage 2用エンジン
+            vector<unique_ptr<EDDC<Cost, Cell>>> engines;
+            vector<EDDC<Cost, Cell> *> free_engines;
+            mutex engine_mutex;
+            for (int i = 0; i < num_threads_; i++)
             {
-                cout << "Alphabet " << alphabet_[i] << ":\n";
-                for (const auto & row : ed_alphabet_to_t_[i])
+                engines.push_back(make_unique<EDDC<Cost, Cell>>("", ""));
+                free_engines.push_back(engines.back().get());
+            }
+            auto with_engine = [&](const auto & func)
+            {
+                EDDC<Cost, Cell> * engine;
                 {
-                    for (const auto & val : row)
-                    {
-                        cout << val << " ";
-                    }
-                    cout << "\n";
+                    lock_guard<mutex> lock(engine_mutex);
+                    engine = free_engines.back();
+                    free_engines.pop_back();
                 }
-            }
+                func(*engine);
+                lock_guard<mutex> lock(engine_mutex);
+                free_engines.push_back(engine);
+            };
+            constexpr bool symmetric = EDDC<Cost, Cell>::has_symmetric_costs();
+            constexpr int num_alphabet = EDDC<Cost, Cell>::NUM_ALPHABET;
 
-            cout << "ED: Alphabet to T non-reducing:" << "\n";
-            for (int i = 0; i < ed_alphabet_to_t_nonred_.size(); i++)
+            // Stage 2のテーブルの分を除いた残りをsource側とtarget側のキャッシュで半分ずつ使う
+            // max_distance_ >= 0ならどちらもEDDC::allocate_tablesと同じく帯状の大きさで見積もる
+            int max_len = 0;
+            for (auto & seq : seqs_) max_len = max(max_len, static_cast<int>(seq.size()));
+            int max_width = (max_distance_ >= 0) ? EDDC<Cost, Cell>::bounded_width(max_distance_) : INT_MAX;
+            int band = (max_width <= max_len / 2) ? 2 * max_width + 1 : -1;
+            size_t stage2_bytes = MatrixView<Cell>::num_cells(max_len + 1, max_len + 1, band) * (num_alphabet + 1) * sizeof(Cell) * num_threads_;
+            size_t cache_budget = memory_budget_ > stage2_bytes ? memory_budget_ - stage2_bytes : 0;
+            vector<pair<int, int>> tiles = make_tiles<Cell>(num_alphabet, cache_budget / 2, max_width);
+
+            vector<Stage1Tables<Cell>> source_tables(num_seqs);
+            vector<Stage1Tables<Cell>> target_tables(num_seqs);
+            auto load = [&](vector<Stage1Tables<Cell>> & tables, const pair<int, int> & tile, const bool is_source)
+            {
+                run(tile.second - tile.first, [&](const int x)
+                {
+                    with_engine([&](EDDC<Cost, Cell> & engine) { engine.compute_stage1_tables(seqs_[tile.first + x], is_source, tables[tile.first + x], max_distance_); });
+                });
+                num_stage1_computations_ += tile.second - tile.first;
+            };
+            auto release = [](vector<Stage1Tables<Cell>> & tables, const pair<int, int> & tile)
+            {
+                for (int x = tile.first; x < tile.second; x++) tables[x] = Stage1Tables<Cell>();
+            };
+
+            if (tiles.size() == 1) load(target_tables, tiles[0], false); // 全部載るならtarget側は1度だけ
+            for (auto & row_tile : tiles)
             {
-                cout << "Alphabet " << alphabet_[i] << ":\n";
-                for (const auto & row : ed_alphabet_to_t_nonred_[i])
+                load(source_tables, row_tile, true);
+                for (auto & col_tile : tiles)
                 {
-                    for (const auto & val : row)
+                    // 対称なときはi < jのペアしか要らない
+                    if (symmetric && col_tile.second <= row_tile.first + 1) continue;
+                    if (tiles.size() > 1) load(target_tables, col_tile, false);
+
+                    vector<pair<int, int>> pairs;
+                    for (int a = row_tile.first; a < row_tile.second; a++)
                     {
-                        cout << val << " ";
+                        for (int b = col_tile.first; b < col_tile.second; b++)
+                        {
+                            if (symmetric ? a < b : a != b) pairs.emplace_back(a, b);
+                        }
                     }
-                    cout << "\n";
+                    run(pairs.size(), [&](const int x)
+                    {
+                        auto [a, b] = pairs[x];
+                        with_engine([&](EDDC<Cost, Cell> & engine)
+                        {
+                            if (max_distance_ >= 0) matrix_[a][b] = engine.compute_edit_distance(source_tables[a], target_tables[b], max_distance_);
+                            else                    matrix_[a][b] = engine.compute_edit_distance(source_tables[a], target_tables[b]);
+                        });
+                    });
+
+                    if (tiles.size() > 1) release(target_tables, col_tile);
                 }
+                release(source_tables, row_tile);
             }
 
-            cout << "EDT:" << "\n";
-            for (int i = 0; i < edt_.size(); i++)
+            for (int a = 0; a < num_seqs; a++)
             {
-                cout << "Alphabet " << alphabet_[i] << ":\n";
-                for (const auto & row : edt_[i])
+                for (int b = a + 1; b < num_seqs; b++)
                 {
-                    for (const auto & val : row)
-                    {
-                        cout << val << " ";
-                    }
-                    cout << "\n";
+                    if (symmetric) matrix_[b][a] = matrix_[a][b];
                 }
             }
+            directed_ = matrix_;
+            for (int a = 0; a < num_seqs; a++)
+            {
+                for (int b = a + 1; b < num_seqs; b++) matrix_[a][b] = matrix_[b][a] = min(directed_[a][b], directed_[b][a]);
+            }
+            return matrix_;
+        }
 
-            cout << "ED:" << "\n";
-            for (const auto & row : ed_)
+        // 配列を先頭から順に、Stage 1のテーブル1側分の合計がtile_budgetに収まるように区切る
+        template <class Cell>
+        vector<pair<int, int>> make_tiles(const int num_alphabet, const size_t tile_budget, const int max_width)
+        {
+            vector<pair<int, int>> tiles;
+            int num_seqs = seqs_.size();
+            int begin = 0;
+            size_t bytes = 0;
+            for (int x = 0; x < num_seqs; x++)
             {
-                for (const auto & val : row)
+                size_t seq_bytes = Stage1Views<Cell>::num_cells(seqs_[x].size(), num_alphabet, max_width) * sizeof(Cell);
+                if (x > begin && bytes + seq_bytes > tile_budget)
                 {
-                    cout << val << " ";
+                    tiles.emplace_back(begin, x);
+                    begin = x;
+                    bytes = 0;
                 }
-                cout << "\n";
+                bytes += seq_bytes;
             }
+            tiles.emplace_back(begin, num_seqs);
+            return tiles;
         }
 };
 
+// EDDCBenchmark.cppのように#includeして使うときはEDDC_NO_MAINを定義してこのmainを外す
+#ifndef EDDC_NO_MAIN
+// EDDCBatchの検査用: ins/del, dup/cont, mutの全てが非対称なコスト
+struct AsymmetricTestCost
+{
+    static constexpr int  NUM_ALPHABET = 4;
+    static constexpr char ALPHABET[NUM_ALPHABET] = {'A', 'C', 'G', 'T'};
+    static constexpr int  INS [NUM_ALPHABET] = {2, 3, 4, 3};
+    static constexpr int  DEL [NUM_ALPHABET] = {4, 3, 2, 5};
+    static constexpr int  DUP [NUM_ALPHABET] = {1, 2, 2, 1};
+    static constexpr int  CONT[NUM_ALPHABET] = {2, 1, 3, 2};
+    static constexpr int  MUT [NUM_ALPHABET][NUM_ALPHABET] =
+    {
+        {0, 1, 2, 3},
+        {3, 0, 1, 2},
+        {2, 3, 0, 1},
+        {1, 2, 3, 0},
+    };
+};
+
+// 短い反復を含むランダムな配列
+string random_test_seq(mt19937 & rng, const int max_len)
+{
+    string seq;
+    int len = 1 + rng() % max_len;
+    while (static_cast<int>(seq.size()) < len)
+    {
+        string unit;
+        for (int i = 0, unit_len = 1 + rng() % 4; i < unit_len; i++) unit += "ACGT"[rng() % 4];
+        for (int r = 0, num_copies = 1 + rng() % 3; r < num_copies; r++) seq += unit;
+    }
+    seq.resize(len);
+    return seq;
+}
+
+// EDDCBatchの距離行列(対称と向きあり)を1組ずつのEDDCと比べる. 不一致の数を返す
+template <class Cost>
+int check_batch(const vector<string> & seqs, const int num_threads, const size_t memory_budget, const int max_distance)
+{
+    EDDCBatch<Cost> batch(seqs, num_threads, memory_budget);
+    if (max_distance >= 0) batch.set_max_distance(max_distance);
+    vector<vector<int>> & matrix = batch.compute_distance_matrix();
+    vector<vector<int>> & directed = batch.get_directed_distance_matrix();
+    int num_seqs = seqs.size();
+    int num_invalid = 0;
+    for (int a = 0; a < num_seqs; a++)
+    {
+        for (int b = 0; b < num_seqs; b++)
+        {
+            if (a == b) continue;
+            int forward  = EDDC<Cost, int>(seqs[a], seqs[b]).compute_edit_distance();
+            int backward = EDDC<Cost, int>(seqs[b], seqs[a]).compute_edit_distance();
+            if (max_distance >= 0)
+            {
+                forward  = min(forward,  max_distance + 1);
+                backward = min(backward, max_distance + 1);
+            }
+            if (directed[a][b] != forward || matrix[a][b] != min(forward, backward)) num_invalid++;
+        }
+    }
+    // キャッシュに全部載らないときはtarget側のタイルを読み直すので、Stage 1の計算は配列の数の2倍より多くなる
+    if (memory_budget < 1024 && batch.get_num_stage1_computations() <= 2 * num_seqs) num_invalid++;
+    return num_invalid;
+}
+
 int main()
 {
     string s = "AAACCCGGGTTTAAACCCGGGTTTAAACCCGGGTTT";
     string t = "ACGTACGTACGT";
-    EDDC eddc(s, t);
+    EDDC<> eddc(s, t);
     int distance = eddc.compute_edit_distance();
     cout << "Edit Distance: " << distance << endl;
 
+    // 各エンジン(int16_t, 複数スレッド, runの内部の枝刈り, BANDED, max_distance付き)の距離がintのcubicと一致するか
+    mt19937 rng(1);
+    for (int trial = 0; trial < 100; trial++)
+    {
+        string a = random_test_seq(rng, 40);
+        string b = random_test_seq(rng, 40);
+        int expected = EDDC<>(a, b, 1, DistanceEngine::CUBIC).compute_edit_distance();
+        vector<int> results;
+        results.push_back(EDDC<>(a, b).compute_edit_distance());
+        results.push_back(EDDC<Kimura2ParameterCost<>, int16_t>(a, b).compute_edit_distance());
+        EDDC<> parallel(a, b, 3);
+        parallel.set_min_parallel_len(0);
+        results.push_back(parallel.compute_edit_distance());
+        EDDC<> run_pruning(a, b);
+        run_pruning.set_run_pruning(true);
+        results.push_back(run_pruning.compute_edit_distance());
+        EDDC<> banded(a, b);
+        banded.set_distance_engine(DistanceEngine::BANDED);
+        results.push_back(banded.compute_edit_distance());
+        results.push_back(EDDC<>(a, b).compute_edit_distance(expected));
+        if (expected > 0) results.push_back(EDDC<>(a, b).compute_edit_distance(expected - 1) == expected ? expected : -1);
+        // 編集スクリプト(FULL, CHECKPOINTED)をaに適用するとbになるか
+        for (auto mode : {TracebackMode::FULL, TracebackMode::CHECKPOINTED})
+        {
+            EDDC<> traced(a, b);
+            int distance = traced.compute_edit_script(mode);
+            results.push_back(replay_edit_script(a, b, traced.get_edit_script()) ? distance : -1);
+        }
+        for (int r : results)
+        {
+            if (r != expected)
+            {
+                cout << "Invalid case found" << "\n";
+                cout << a << " " << b << "\n";
+                return 1;
+            }
+        }
+    }
+
+    // AUTO (既定)が帯で済ませる、長さに比べて編集距離が小さい組
+    for (int trial = 0; trial < 4; trial++)
+    {
+        string a = random_test_seq(rng, 300);
+        string b = a;
+        for (int x = 0; x < 3; x++) b[rng() % b.size()] = "ACGT"[rng() % 4];
+        b.insert(rng() % b.size(), 1, "ACGT"[rng() % 4]);
+        if (EDDC<>(a, b).compute_edit_distance() != EDDC<>(a, b, 1, DistanceEngine::CUBIC).compute_edit_distance())
+        {
+            cout << "Invalid case found" << "\n";
+            cout << a << " " << b << "\n";
+            return 1;
+        }
+    }
+
+    // EDDCBatch: 対称/非対称なコスト、キャッシュに全部載る/1配列ずつのタイル、1/3スレッド、max_distance付き
+    vector<string> seqs;
+    for (int x = 0; x < 9; x++) seqs.push_back(random_test_seq(rng, 30));
+    int num_invalid = 0;
+    for (int num_threads : {1, 3})
+    {
+        for (size_t memory_budget : {static_cast<size_t>(1) << 30, static_cast<size_t>(1)})
+        {
+            num_invalid += check_batch<Kimura2ParameterCost<>>(seqs, num_threads, memory_budget, -1);
+            num_invalid += check_batch<AsymmetricTestCost>(seqs, num_threads, memory_budget, -1);
+            num_invalid += check_batch<AsymmetricTestCost>(seqs, num_threads, memory_budget, 12);
+        }
+    }
+    if (num_invalid > 0)
+    {
+        cout << "Invalid case found" << "\n";
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,398 @@
+//--------------------------------------------------------------------------------------------------------
+// EDDC.cppの各エンジンのベンチマーク
+// ランダムな配列の組と繰り返し構造のある配列の組を長さを倍にしながら作り、各エンジンについて
+// Stage 1 (source側, target側), Stage 2の時間, DPテーブルのメモリ, 1秒あたりのセル数をCSVで出力する
+// 各入力で全エンジンの結果を論文の式をそのまま書いた参照実装(ReferenceEDDC)と突き合わせる
+// 編集スクリプトはFULL, CHECKPOINTEDとも、コストの和が距離になることと、sに適用するとtになること(replay_edit_script)を確かめる
+// Usage: ./EDDCBenchmark [最大長 = 1024] [スレッド数 = コア数] [参照実装を使う最大長 = 512] [seed = 1] > result.csv
+// To compile, perform: g++ -std=c++20 -O2 -pthread -Wall --pedantic-errors -o EDDCBenchmark EDDCBenchmark.cpp
+//--------------------------------------------------------------------------------------------------------
+#define EDDC_NO_MAIN
+#include "EDDC.cpp"
+#include <random>
+#include <cstdlib>
+using namespace std;
+
+//--------------------------------------------------------------------------------------------------------
+// 参照実装: Equation 1-9をそのままループで計算する. 時間O(|Σ|^2 n^3), 最適化は一切しない
+//--------------------------------------------------------------------------------------------------------
+template <class Cost = Kimura2ParameterCost<>>
+struct ReferenceEDDC
+{
+    public:
+        static constexpr int NUM_ALPHABET = Cost::NUM_ALPHABET;
+
+        ReferenceEDDC(const string & s, const string & t)
+            : s_(encode(s)), t_(encode(t))
+            {}
+
+        int compute_edit_distance()
+        {
+            int len_s = s_.size();
+            int len_t = t_.size();
+            constexpr int num_alphabet = NUM_ALPHABET;
+
+            // Stage 1 (target側): Equation 1-3
+            vector<vector<int>>         empty_to_t(len_t + 1, vector<int>(len_t + 1, 0));
+            vector<vector<vector<int>>> alphabet_to_t(num_alphabet, vector<vector<int>>(len_t + 1, vector<int>(len_t + 1, 0)));
+            vector<vector<vector<int>>> alphabet_to_t_nonred(num_alphabet, vector<vector<int>>(len_t + 1, vector<int>(len_t + 1, 0)));
+            for (int i = 0; i < len_t; i++)
+            {
+                empty_to_t[i][i + 1] = Cost::INS[t_[i]];
+                for (int k = 0; k < num_alphabet; k++) alphabet_to_t[k][i][i + 1] = Cost::MUT[k][t_[i]];
+            }
+            for (int j = 2; j <= len_t; j++)
+            {
+                for (int i = j - 2; i >= 0; i--)
+                {
+                    for (int k = 0; k < num_alphabet; k++)
+                    {
+                        int best = INT_MAX;
+                        for (int h = i + 1; h < j; h++)
+                        {
+                            best = min({best, alphabet_to_t[k][i][h] + empty_to_t[h][j],
+                                              empty_to_t[i][h] + alphabet_to_t[k][h][j],
+                                              Cost::DUP[k] + alphabet_to_t[k][i][h] + alphabet_to_t[k][h][j]});
+                        }
+                        alphabet_to_t_nonred[k][i][j] = best;
+                    }
+                    for (int k = 0; k < num_alphabet; k++)
+                    {
+                        int best = INT_MAX;
+                        for (int l = 0; l < num_alphabet; l++) best = min(best, Cost::MUT[k][l] + alphabet_to_t_nonred[l][i][j]);
+                        alphabet_to_t[k][i][j] = best;
+                    }
+                    int best = INT_MAX;
+                    for (int k = 0; k < num_alphabet; k++) best = min(best, Cost::INS[k] + alphabet_to_t[k][i][j]);
+                    empty_to_t[i][j] = best;
+                }
+            }
+
+            // Stage 1 (source側): Equation 4-6
+            vector<vector<int>>         s_to_empty(len_s + 1, vector<int>(len_s + 1, 0));
+            vector<vector<vector<int>>> s_to_alphabet(num_alphabet, vector<vector<int>>(len_s + 1, vector<int>(len_s + 1, 0)));
+            vector<vector<vector<int>>> s_to_alphabet_nongen(num_alphabet, vector<vector<int>>(len_s + 1, vector<int>(len_s + 1, 0)));
+            for (int i = 0; i < len_s; i++)
+            {
+                s_to_empty[i][i + 1] = Cost::DEL[s_[i]];
+                for (int k = 0; k < num_alphabet; k++) s_to_alphabet[k][i][i + 1] = Cost::MUT[s_[i]][k];
+            }
+            for (int j = 2; j <= len_s; j++)
+            {
+                for (int i = j - 2; i >= 0; i--)
+                {
+                    for (int k = 0; k < num_alphabet; k++)
+                    {
+                        int best = INT_MAX;
+                        for (int h = i + 1; h < j; h++)
+                        {
+                            best = min({best, s_to_alphabet[k][i][h] + s_to_empty[h][j],
+                                              s_to_empty[i][h] + s_to_alphabet[k][h][j],
+                                              Cost::CONT[k] + s_to_alphabet[k][i][h] + s_to_alphabet[k][h][j]});
+                        }
+                        s_to_alphabet_nongen[k][i][j] = best;
+                    }
+                    for (int k = 0; k < num_alphabet; k++)
+                    {
+                        int best = INT_MAX;
+                        for (int l = 0; l < num_alphabet; l++) best = min(best, Cost::MUT[l][k] + s_to_alphabet_nongen[l][i][j]);
+                        s_to_alphabet[k][i][j] = best;
+                    }
+                    int best = INT_MAX;
+                    for (int k = 0; k < num_alphabet; k++) best = min(best, Cost::DEL[k] + s_to_alphabet[k][i][j]);
+                    s_to_empty[i][j] = best;
+                }
+            }
+
+            // Stage 2: Equation 8, 9
+            vector<vector<vector<int>>> edt(num_alphabet, vector<vector<int>>(len_s + 1, vector<int>(len_t + 1, 0)));
+            vector<vector<int>>         ed(len_s + 1, vector<int>(len_t + 1, 0));
+            for (int i = 1; i <= len_t; i++)
+            {
+                ed[0][i] = empty_to_t[0][i];
+                ed[1][i] = alphabet_to_t[s_[0]][0][i];
+            }
+            for (int i = 1; i <= len_s; i++)
+            {
+                ed[i][0] = s_to_empty[0][i];
+                ed[i][1] = s_to_alphabet[t_[0]][0][i];
+            }
+            auto compute_edt = [&](const int i, const int j)
+            {
+                for (int k = 0; k < num_alphabet; k++)
+                {
+                    int best = INT_MAX;
+                    for (int h = 1; h < j; h++) best = min(best, ed[i][h] + alphabet_to_t[k][h][j]);
+                    edt[k][i][j] = best;
+                }
+            };
+            for (int j = 2; j <= len_t; j++) compute_edt(1, j);
+            for (int j = 2; j <= len_t; j++)
+            {
+                for (int i = 2; i <= len_s; i++)
+                {
+                    compute_edt(i, j);
+                    int best = INT_MAX;
+                    for (int k = 0; k < num_alphabet; k++)
+                    {
+                        best = min(best, s_to_alphabet[k][0][i] + alphabet_to_t[k][0][j]);
+                        for (int h = 1; h < i; h++) best = min(best, edt[k][h][j] + s_to_alphabet[k][h][i]);
+                    }
+                    ed[i][j] = best;
+                }
+            }
+            return ed[len_s][len_t];
+        }
+
+    private:
+        vector<int> s_; // source文字列の各文字のCost::ALPHABETでの番号
+        vector<int> t_; // target文字列の各文字のCost::ALPHABETでの番号
+
+        static vector<int> encode(const string & seq)
+        {
+            vector<int> code;
+            for (char c : seq) code.push_back(find(Cost::ALPHABET, Cost::ALPHABET + NUM_ALPHABET, c) - Cost::ALPHABET);
+            return code;
+        }
+};
+
+//--------------------------------------------------------------------------------------------------------
+// ベンチマーク本体
+// 1行 = (入力, エンジン). cellsは同じ入力なら全エンジン共通の3乗版のDPテーブルのセル数で、
+// cells_per_secはその処理量をtotal_secで割ったもの(BANDEDのように一部しか計算しないエンジンでは実効値)
+//--------------------------------------------------------------------------------------------------------
+template <class Cost = Kimura2ParameterCost<>>
+struct EDDCBenchmark
+{
+    public:
+        EDDCBenchmark(const int num_threads, const int ref_max_len, const unsigned seed)
+            : num_threads_(max(1, num_threads)), ref_max_len_(ref_max_len), rng_(seed)
+            {}
+
+        // lengthsの各長さについて入力の種類ごとに1組ずつ作って全エンジンを測る. 参照実装と合わなかった行数を返す
+        int run(const vector<int> & lengths)
+        {
+            cout << "kind,len_s,len_t,variant,cell,threads,kernel,distance,expected,expected_from,check,"
+                 << "stage1_s_sec,stage1_t_sec,stage2_sec,traceback_sec,total_sec,peak_dp_bytes,cells,cells_per_sec\n";
+            int num_mismatches = 0;
+            for (int len : lengths)
+            {
+                for (const char * kind : {"random", "repeat", "runs", "long-runs"})
+                {
+                    auto [s, t] = make_pair_of_kind(kind, len);
+                    num_mismatches += run_pair(kind, s, t);
+                }
+            }
+            return num_mismatches;
+        }
+
+    private:
+        static constexpr int NUM_ALPHABET = Cost::NUM_ALPHABET;
+
+        struct BenchRow
+        {
+            string     variant_;
+            string     cell_;
+            int        num_threads_ {1};
+            string     kernel_;
+            int        distance_ {0};
+            bool       valid_ {true};        // distance_以外の検査(編集スクリプトのコストなど)が通ったか
+            int        expected_ {-1};       // 0以上なら組の期待値の代わりにこれと比べる(狭いmax_distanceで打ち切る行)
+            StageTimes times_;
+            double     total_sec_ {0.0};     // 呼び出し全体の経過時間 (Stage 1を並行に計算すると各段階の和より短い)
+            size_t     peak_dp_bytes_ {0};   // DPテーブル(arena)と、あればtracebackの記録の合計
+        };
+
+        int          num_threads_ {1};
+        int          ref_max_len_ {0};      // どちらかの配列がこれより長ければ参照実装の代わりにcubic-intと突き合わせる
+        mt19937      rng_;
+
+        // random: 独立な一様乱数の配列, repeat: 3-20文字の単位の縦列反復, runs: 長さ1-40の同じ文字の連続,
+        // long-runs: 長さ32-255の同じ文字の連続(runの内部の枝刈りが効く)
+        // random以外のtargetはsourceに4%の置換・欠失・重複を入れたもの
+        pair<string, string> make_pair_of_kind(const string & kind, const int len)
+        {
+            auto random_letter = [this] { return Cost::ALPHABET[rng_() % NUM_ALPHABET]; };
+            string s;
+            if (kind == "random")
+            {
+                string t;
+                for (int i = 0; i < len; i++) s += random_letter();
+                for (int i = 0; i < len; i++) t += random_letter();
+                return {s, t};
+            }
+            if (kind == "repeat")
+            {
+                string unit;
+                int unit_len = 3 + rng_() % 18;
+                for (int i = 0; i < unit_len; i++) unit += random_letter();
+                while (static_cast<int>(s.size()) < len) s += unit;
+            }
+            else if (kind == "runs")
+            {
+                while (static_cast<int>(s.size()) < len) s.append(1 + rng_() % 40, random_letter());
+            }
+            else
+            {
+                while (static_cast<int>(s.size()) < len) s.append(32 + rng_() % 224, random_letter());
+            }
+            s.resize(len);
+            return {s, mutate(s, 0.04)};
+        }
+
+        string mutate(const string & seq, const double rate)
+        {
+            string mutated;
+            uniform_real_distribution<double> uniform(0.0, 1.0);
+            for (char c : seq)
+            {
+                double x = uniform(rng_);
+                if (x < rate / 3) continue;
+                if (x < rate * 2 / 3) mutated += Cost::ALPHABET[rng_() % NUM_ALPHABET];
+                else if (x < rate) mutated.append(2, c);
+                else mutated += c;
+            }
+            if (mutated.empty()) mutated = seq.substr(0, 1);
+            return mutated;
+        }
+
+        int run_pair(const string & kind, const string & s, const string & t)
+        {
+            vector<BenchRow> rows;
+            rows.push_back(run_engine<int>("cubic", s, t, 1, [](auto & engine) { return engine.compute_edit_distance(); }));
+            if (EDDC<Cost, int16_t>::distance_upper_bound(s, t) < CellTraits<int16_t>::INF)
+            {
+                rows.push_back(run_engine<int16_t>("cubic", s, t, 1, [](auto & engine) { return engine.compute_edit_distance(); }));
+            }
+            if (num_threads_ > 1)
+            {
+                rows.push_back(run_engine<int>("cubic", s, t, num_threads_, [](auto & engine) { return engine.compute_edit_distance(); }));
+            }
+            // runの内部の枝刈りは枝刈り無し(cubic-int)とそのまま突き合わせる
+            BenchRow run_pruning = run_engine<int>("run-pruning", s, t, 1, [](auto & engine)
+            {
+                engine.set_run_pruning(true);
+                return engine.compute_edit_distance();
+            });
+            run_pruning.expected_ = rows[0].distance_;
+            rows.push_back(run_pruning);
+            rows.push_back(run_engine<int>("banded", s, t, 1, [](auto & engine)
+            {
+                engine.set_distance_engine(DistanceEngine::BANDED);
+                return engine.compute_edit_distance();
+            }));
+            rows.push_back(run_engine<int>("auto", s, t, 1, [](auto & engine)
+            {
+                engine.set_distance_engine(DistanceEngine::AUTO);
+                return engine.compute_edit_distance();
+            }));
+            rows.push_back(run_adaptive_banded(s, t));
+            for (auto mode : {TracebackMode::FULL, TracebackMode::CHECKPOINTED})
+            {
+                bool valid = true;
+                BenchRow row = run_engine<int>(mode == TracebackMode::FULL ? "script-full" : "script-checkpointed", s, t, 1, [mode, &valid, &s, &t](auto & engine)
+                {
+                    // コストの和が距離に等しく、sに適用するとtになること
+                    int distance = engine.compute_edit_script(mode);
+                    long long cost = 0;
+                    for (const auto & op : engine.get_edit_script()) cost += op.cost;
+                    valid = cost == distance && replay_edit_script(s, t, engine.get_edit_script());
+                    return distance;
+                });
+                row.valid_ = valid;
+                rows.push_back(row);
+            }
+
+            // 期待値: 参照実装、長すぎるならcubic (int, 1スレッド)
+            int expected = rows[0].distance_;
+            string expected_from = "cubic-int";
+            if (max(s.size(), t.size()) <= static_cast<size_t>(ref_max_len_))
+            {
+                expected = ReferenceEDDC<Cost>(s, t).compute_edit_distance();
+                expected_from = "reference";
+            }
+
+            // max_distance付きは期待値ちょうどなら期待値、1小さければ打ち切り(max_distance + 1 = 期待値)になるはず
+            // 測るのは前者だけ
+            BenchRow bounded = run_engine<int>("bounded", s, t, 1, [expected](auto & engine) { return engine.compute_edit_distance(expected); });
+            if (expected > 0) bounded.valid_ = EDDC<Cost, int>(s, t).compute_edit_distance(expected - 1) == expected;
+            rows.push_back(bounded);
+
+            // 帯が長い方の長さの1/4程度(分割位置の幅が1/8)になる狭いmax_distanceでも、max_distance無しと一致する(超えればmax_distance + 1)か
+            int narrow = EDDC<Cost, int>::min_length_change_cost() * (static_cast<int>(max(s.size(), t.size())) / 8);
+            BenchRow bounded_narrow = run_engine<int>("bounded-narrow", s, t, 1, [narrow](auto & engine) { return engine.compute_edit_distance(narrow); });
+            bounded_narrow.expected_ = min(expected, narrow + 1);
+            rows.push_back(bounded_narrow);
+
+            size_t cells = Stage1Views<int>::num_cells(s.size(), NUM_ALPHABET) + Stage1Views<int>::num_cells(t.size(), NUM_ALPHABET) +
+                           (s.size() + 1) * (t.size() + 1) * (NUM_ALPHABET + 1);
+            int num_mismatches = 0;
+            for (const auto & row : rows)
+            {
+                int row_expected = (row.expected_ >= 0) ? row.expected_ : expected;
+                bool ok = row.valid_ && row.distance_ == row_expected;
+                if (!ok)
+                {
+                    num_mismatches++;
+                    cerr << "MISMATCH: " << kind << " " << s.size() << "x" << t.size() << " " << row.variant_ << " (" << row.cell_ << ", "
+                         << row.num_threads_ << " threads): " << row.distance_ << " != " << row_expected << "\n";
+                }
+                cout << kind << "," << s.size() << "," << t.size() << "," << row.variant_ << "," << row.cell_ << "," << row.num_threads_ << ","
+                     << row.kernel_ << "," << row.distance_ << "," << row_expected << "," << expected_from << "," << (ok ? "ok" : "MISMATCH") << ","
+                     << row.times_.stage1_source_ << "," << row.times_.stage1_target_ << "," << row.times_.stage2_ << ","
+                     << row.times_.traceback_ << "," << row.total_sec_ << "," << row.peak_dp_bytes_ << "," << cells << ","
+                     << (row.total_sec_ > 0.0 ? cells / row.total_sec_ : 0.0) << "\n";
+            }
+            return num_mismatches;
+        }
+
+        // 新しいエンジン(CUBIC)を作ってcompute(engine)を1回測る
+        template <class Cell, class Func>
+        BenchRow run_engine(const string & variant, const string & s, const string & t, const int num_threads, const Func & compute)
+        {
+            EDDC<Cost, Cell> engine(s, t, num_threads, DistanceEngine::CUBIC);
+            BenchRow row;
+            row.variant_ = variant;
+            row.cell_ = is_same_v<Cell, int16_t> ? "int16" : "int32";
+            row.num_threads_ = num_threads;
+            row.kernel_ = engine.get_kernel_name();
+            auto start = chrono::steady_clock::now();
+            row.distance_ = compute(engine);
+            row.total_sec_ = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            row.times_ = engine.get_stage_times();
+            row.peak_dp_bytes_ = engine.get_arena_bytes() + engine.get_traceback_bytes();
+            return row;
+        }
+
+        // AdaptiveEDDCは上界が大きくても先にint16_tの帯で試すので、選ばれた型を記録する
+        BenchRow run_adaptive_banded(const string & s, const string & t)
+        {
+            AdaptiveEDDC<Cost> engine(s, t, 1, DistanceEngine::BANDED);
+            BenchRow row;
+            row.variant_ = "adaptive-banded";
+            auto start = chrono::steady_clock::now();
+            row.distance_ = engine.compute_edit_distance();
+            row.total_sec_ = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            row.cell_ = engine.uses_narrow_cells() ? "int16" : "int32";
+            row.kernel_ = engine.get_kernel_name();
+            row.times_ = engine.get_stage_times();
+            row.peak_dp_bytes_ = engine.get_arena_bytes();
+            return row;
+        }
+};
+
+int main(int argc, char ** argv)
+{
+    int max_len     = (argc > 1) ? atoi(argv[1]) : 1024;
+    int num_threads = (argc > 2) ? atoi(argv[2]) : static_cast<int>(thread::hardware_concurrency());
+    int ref_max_len = (argc > 3) ? atoi(argv[3]) : 512;
+    unsigned seed   = (argc > 4) ? atoi(argv[4]) : 1;
+
+    vector<int> lengths;
+    for (int len = 64; len <= max_len; len *= 2) lengths.push_back(len);
+
+    EDDCBenchmark<> benchmark(num_threads, ref_max_len, seed);
+    int num_mismatches = benchmark.run(lengths);
+    cerr << num_mismatches << " mismatches\n";
+    return (num_mismatches == 0) ? 0 : 1;
+}
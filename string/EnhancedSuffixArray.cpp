@@ -0,0 +1,391 @@
+//--------------------------------------------------------------------------------------------------------
+// SALS.cppで構築したsuffix arrayにLCP配列を加えたenhanced suffix array
+// LCP配列はKasai法(isa_を使う線形時間)か、isa_を使わず間引いたΦ配列から求める省メモリの方法で作る
+// Reference: Toru Kasai, Gunho Lee, Hiroki Arimura, Setsuo Arikawa and Kunsoo Park.
+// "Linear-Time Longest-Common-Prefix Computation in Suffix Arrays and Its Applications" CPM 2001, LNCS 2089: 181-192.
+// Reference: Juha Kärkkäinen, Giovanni Manzini and Simon J. Puglisi.
+// "Permuted Longest-Common-Prefix Array" CPM 2009, LNCS 5577: 181-192.
+// LCP配列の区間最小値(RMQ)で任意の2つのsuffixのLCPをO(1)で求め、LCP区間(仮想的なsuffix tree)を下から順に
+// たどってmaximal repeatとsupermaximal repeatを線形時間で列挙する
+// Reference: Mohamed I. Abouelhoda, Stefan Kurtz and Enno Ohlebusch.
+// "Replacing suffix trees with enhanced suffix arrays" Journal of Discrete Algorithms, 2 (2004): 53-86.
+// To compile, perform: g++ -std=c++20 -O2 -pthread -Wall --pedantic-errors -o EnhancedSuffixArray EnhancedSuffixArray.cpp
+// lcp_[i]はsuffix sa_[i - 1]とsa_[i]の最長共通接頭辞の長さで、lcp_[0] = 0とする。
+//--------------------------------------------------------------------------------------------------------
+#define SALS_NO_MAIN
+#include "SALS.cpp"
+#include <bit>
+#include <map>
+using namespace std;
+
+// 配列の区間最小値をO(1)で答える
+// 32要素のブロックの中は、各位置までの単調スタックをビットマスクで持って最下位ビットで答え、
+// ブロックをまたぐ部分はブロックごとの最小値のsparse tableで答える(n + (n / 32) log nワード程度)
+struct RangeMinQuery
+{
+    public:
+        void build(const vector<int> & values)
+        {
+            values_ = &values;
+            int n = values.size();
+            masks_.assign(n, 0);
+            int num_blocks = (n + BLOCK - 1) / BLOCK;
+            table_.assign(1, vector<int>(num_blocks));
+            for (int b = 0; b < num_blocks; b++)
+            {
+                int begin = b * BLOCK;
+                int end = min(n, begin + BLOCK);
+                uint32_t stack = 0;
+                for (int i = begin; i < end; i++)
+                {
+                    // スタックにはvalues[i]より小さいものだけを残す
+                    while (stack != 0 && values[begin + 31 - countl_zero(stack)] >= values[i]) stack ^= 1u << (31 - countl_zero(stack));
+                    stack |= 1u << (i - begin);
+                    masks_[i] = stack;
+                }
+                table_[0][b] = values[begin + countr_zero(masks_[end - 1])];
+            }
+            for (int k = 1; (1 << k) <= num_blocks; k++)
+            {
+                int len = num_blocks - (1 << k) + 1;
+                table_.emplace_back(len);
+                for (int b = 0; b < len; b++) table_[k][b] = min(table_[k - 1][b], table_[k - 1][b + (1 << (k - 1))]);
+            }
+        }
+
+        // values[left, right]の最小値(left <= right)
+        int query(const int left, const int right) const
+        {
+            int left_block = left / BLOCK;
+            int right_block = right / BLOCK;
+            if (left_block == right_block) return in_block(left, right);
+            int result = min(in_block(left, left_block * BLOCK + BLOCK - 1), in_block(right_block * BLOCK, right));
+            if (left_block + 1 < right_block)
+            {
+                int k = 31 - countl_zero(static_cast<uint32_t>(right_block - left_block - 1));
+                result = min({result, table_[k][left_block + 1], table_[k][right_block - (1 << k)]});
+            }
+            return result;
+        }
+
+    private:
+        static constexpr int BLOCK = 32;
+        const vector<int> *  values_ {nullptr}; // 元の配列(buildに渡したものを参照する)
+        vector<uint32_t>     masks_;            // masks_[i]のビットjは、ブロックの先頭+jがvalues[.., i]の単調スタックにあること
+        vector<vector<int>>  table_;            // table_[k][b]はブロックb, ..., b + 2^k - 1の最小値
+
+        // 同じブロックの[left, right]. rightでのスタックのうちleft以降で最も左にあるものが最小
+        int in_block(const int left, const int right) const
+        {
+            int begin = left / BLOCK * BLOCK;
+            uint32_t stack = masks_[right] & (~0u << (left - begin));
+            return (*values_)[begin + countr_zero(stack)];
+        }
+};
+
+// sa_[left_idx_, right_idx_]のsuffixが長さlcp_の接頭辞を共有し、その先が全て同じではないLCP区間
+struct LcpInterval
+{
+    int  lcp_ {0};
+    int  left_idx_ {0};
+    int  right_idx_ {0};
+    bool has_child_interval_ {false}; // 子がsuffix(葉)だけでなければtrue
+    bool is_left_diverse_ {false};    // 直前の文字が全て同じではない(先頭のsuffixを含む場合もtrue)
+};
+
+struct EnhancedSuffixArray
+{
+    public:
+        // salsはbuild_suffix_array済みであること(文字列はget_charで読むので、pack_text済みでもよい)
+        EnhancedSuffixArray(SaLs & sals)
+            : sals_(sals), sa_(sals.get_sa()), len_seq_(sals.get_seq_len())
+            {}
+
+        // Kasai法: suffix 0, 1, 2, ...の順に、直前のsuffixとのLCPが1ずつしか減らないことを使う
+        void build_lcp()
+        {
+            span<const int> isa = sals_.get_isa();
+            lcp_.assign(len_seq_, 0);
+            int l = 0;
+            for (int i = 0; i < len_seq_; i++)
+            {
+                int j = isa[i];
+                if (j == 0)
+                {
+                    l = 0;
+                    continue;
+                }
+                l = extend(i, sa_[j - 1], l);
+                lcp_[j] = l;
+                if (l > 0) l--;
+            }
+        }
+
+        // isa_を使わない省メモリのLCP: sample_rateおきの位置iだけ、Φ[i](sa上でsuffix iの直前のsuffix)と
+        // PLCP[i](suffix iとΦ[i]のLCP)をn / sample_rate要素で求め、残りはPLCP[i] >= PLCP[i'] - (i - i')
+        // (i'はi以下で最も近い標本)から伸ばして求める. 時間はO(n sample_rate)
+        void build_lcp_sparse_phi(const int sample_rate = 32)
+        {
+            int q = max(1, sample_rate);
+            int num_samples = (len_seq_ + q - 1) / q;
+            vector<int> sampled(num_samples, -1); // 最初はΦ、求めた後はPLCP
+            for (int j = 1; j < len_seq_; j++)
+            {
+                if (sa_[j] % q == 0) sampled[sa_[j] / q] = sa_[j - 1];
+            }
+            int l = 0;
+            for (int t = 0; t < num_samples; t++)
+            {
+                int i = t * q;
+                l = (sampled[t] < 0) ? 0 : extend(i, sampled[t], l);
+                sampled[t] = l;
+                l = max(0, l - q);
+            }
+
+            lcp_.assign(len_seq_, 0);
+            for (int j = 1; j < len_seq_; j++)
+            {
+                int i = sa_[j];
+                lcp_[j] = extend(i, sa_[j - 1], max(0, sampled[i / q] - i % q));
+            }
+        }
+
+        // LCP配列の区間最小値. build_lcpの後で呼ぶ
+        void build_rmq() { rmq_.build(lcp_); }
+
+        // sa_上の位置left < rightのsuffixのLCP. build_rmqの後で呼ぶ
+        int get_lcp_of_positions(const int left, const int right) const { return rmq_.query(left + 1, right); }
+
+        // suffix aとsuffix bのLCP(sa_での位置はisa_で引く). build_rmqの後で呼ぶ
+        int get_lcp_of_suffixes(const int a, const int b) const
+        {
+            if (a == b) return len_seq_ - a;
+            span<const int> isa = sals_.get_isa();
+            return get_lcp_of_positions(min(isa[a], isa[b]), max(isa[a], isa[b]));
+        }
+
+        // 全てのLCP区間を、子が親より先になる順(下から)にfunc(const LcpInterval &)へ渡す
+        // 根(lcp_ = 0, sa_全体)も最後に渡す. スタックの深さは最大のLCP値まで
+        template <class Func>
+        void for_each_lcp_interval(const Func & func) const
+        {
+            if (len_seq_ == 0) return;
+            vector<Node> stack;
+            stack.push_back({0, 0, NONE, false});
+            for (int i = 1; i <= len_seq_; i++)
+            {
+                int l = (i < len_seq_) ? lcp_[i] : -1;
+                if (l > stack.back().lcp_)
+                {
+                    // suffix sa_[i - 1]はLCPがより長い新しい区間の葉
+                    stack.push_back({l, i - 1, left_char(i - 1), false});
+                    continue;
+                }
+                add_left_char(stack.back(), left_char(i - 1));
+                while (!stack.empty() && l < stack.back().lcp_)
+                {
+                    Node node = stack.back();
+                    stack.pop_back();
+                    func(LcpInterval {node.lcp_, node.left_idx_, i - 1, node.has_child_interval_, node.left_char_ == DIVERSE});
+                    if (stack.empty() || l > stack.back().lcp_)
+                    {
+                        // 閉じた区間は、次に開く長さlの区間の子
+                        stack.push_back({l, node.left_idx_, NONE, false});
+                    }
+                    add_left_char(stack.back(), node.left_char_);
+                    stack.back().has_child_interval_ = true;
+                }
+                if (l < 0) return;
+            }
+        }
+
+        // 長さmin_len以上のmaximal repeat(左にも右にも延ばすと出現が減る繰り返し)をfunc(const LcpInterval &)へ渡す
+        // 出現位置はsa_[left_idx_, right_idx_]
+        template <class Func>
+        void for_each_maximal_repeat(const int min_len, const Func & func) const
+        {
+            for_each_lcp_interval([&](const LcpInterval & interval)
+            {
+                if (interval.lcp_ >= max(1, min_len) && interval.is_left_diverse_) func(interval);
+            });
+        }
+
+        // 長さmin_len以上のsupermaximal repeat(他のmaximal repeatの部分文字列でないもの)をfunc(const LcpInterval &)へ渡す
+        // 子が葉だけの区間で直前の文字が全て異なるもの. 子が葉だけの区間は互いに重ならないので、調べるのは全体でO(n)
+        template <class Func>
+        void for_each_supermaximal_repeat(const int min_len, const Func & func) const
+        {
+            for_each_lcp_interval([&](const LcpInterval & interval)
+            {
+                if (interval.lcp_ < max(1, min_len) || interval.has_child_interval_ || !interval.is_left_diverse_) return;
+                array<bool, 256> seen {};
+                for (int i = interval.left_idx_; i <= interval.right_idx_; i++)
+                {
+                    int c = left_char(i);
+                    if (c == DIVERSE) continue;
+                    if (seen[c]) return;
+                    seen[c] = true;
+                }
+                func(interval);
+            });
+        }
+
+        vector<int> &         get_lcp()      { return lcp_; }
+        const RangeMinQuery & get_rmq()      { return rmq_; }
+        SaLs &                get_sals()     { return sals_; }
+
+    private:
+        // 区間の葉の直前の文字: NONEはまだ葉がない、DIVERSEは2種類以上(または先頭のsuffixを含む)
+        static constexpr int NONE    = -1;
+        static constexpr int DIVERSE = 256;
+
+        // 下からたどるときのスタックの要素. 右端は閉じるときに決まる
+        struct Node
+        {
+            int  lcp_;
+            int  left_idx_;
+            int  left_char_;
+            bool has_child_interval_;
+        };
+
+        SaLs &        sals_;
+        span<int>     sa_;
+        int           len_seq_;
+        vector<int>   lcp_;   // lcp_[i]はsa_[i - 1]とsa_[i]のLCP
+        RangeMinQuery rmq_;   // lcp_の区間最小値
+
+        // suffix aとbの先頭l文字が等しいとして、LCPまで伸ばす
+        int extend(const int a, const int b, int l) const
+        {
+            while (a + l < len_seq_ && b + l < len_seq_ && sals_.get_char(a + l) == sals_.get_char(b + l)) l++;
+            return l;
+        }
+
+        // sa_[i]の直前の文字. 先頭のsuffixは他のどれとも違うものとしてDIVERSEにする
+        int left_char(const int i) const { return (sa_[i] == 0) ? DIVERSE : static_cast<unsigned char>(sals_.get_char(sa_[i] - 1)); }
+
+        static void add_left_char(Node & node, const int c)
+        {
+            if (c == NONE || node.left_char_ == c) return;
+            node.left_char_ = (node.left_char_ == NONE) ? c : DIVERSE;
+        }
+};
+
+// SALS.cppのmainと同じくランダムなDNAで、2つのLCPの作り方が一致すること、RMQによるLCPが直接比べたものと一致すること、
+// 列挙したrepeatが実際に左右に延ばせないことを確かめる
+// 短い文字列では、maximal repeatとsupermaximal repeatの集合(と各区間の出現数)が全ての部分文字列を調べたものと一致することも確かめる
+#ifndef ESA_NO_MAIN
+// seq ('$'で終わる)の2回以上出現する部分文字列を定義どおりに調べ、maximal repeatとsupermaximal repeatをそれぞれ出現数と共に返す
+pair<map<string, int>, map<string, int>> brute_force_repeats(const string & seq)
+{
+    int n = seq.size();
+    map<string, int> maximal;
+    for (int len = 1; len < n; len++)
+    {
+        for (int first = 0; first + len < n; first++)
+        {
+            string w = seq.substr(first, len);
+            if (maximal.count(w)) continue;
+            // 直前・直後の文字(先頭の前は他のどれとも違う文字とする)
+            vector<int> lefts, rights;
+            for (size_t pos = seq.find(w); pos != string::npos; pos = seq.find(w, pos + 1))
+            {
+                lefts.push_back(pos == 0 ? -1 - static_cast<int>(lefts.size()) : seq[pos - 1]);
+                rights.push_back(seq[pos + len]);
+            }
+            if (lefts.size() < 2) continue;
+            bool left_maximal = count(lefts.begin(), lefts.end(), lefts[0]) != static_cast<int>(lefts.size());
+            bool right_maximal = count(rights.begin(), rights.end(), rights[0]) != static_cast<int>(rights.size());
+            if (left_maximal && right_maximal) maximal[w] = lefts.size();
+        }
+    }
+    // 他のmaximal repeatの部分文字列でないもの
+    map<string, int> supermaximal;
+    for (const auto & [w, num] : maximal)
+    {
+        bool contained = false;
+        for (const auto & other : maximal)
+        {
+            if (other.first != w && other.first.find(w) != string::npos) contained = true;
+        }
+        if (!contained) supermaximal[w] = num;
+    }
+    return {maximal, supermaximal};
+}
+
+int main()
+{
+    vector<int> len_seq = {1, 10, 73, 100, 240, 777, 1000, 3511, 10000};
+    mt19937 rng(1);
+    for (int len : len_seq)
+    {
+        cout << "Testing length: " << len << "\n";
+        for (int j = 1; j <= 100; j++)
+        {
+            SaLs sals(len);
+            sals.build_suffix_array();
+            EnhancedSuffixArray esa(sals);
+            esa.build_lcp_sparse_phi(1 + rng() % 64);
+            vector<int> sparse = esa.get_lcp();
+            esa.build_lcp();
+            esa.build_rmq();
+            if (sparse != esa.get_lcp()) cout << "Invalid LCP found: " << sals.get_seq() << "\n";
+
+            string & seq = sals.get_seq();
+            int n = seq.size();
+            for (int k = 0; k < 100; k++)
+            {
+                int a = rng() % n;
+                int b = rng() % n;
+                int l = 0;
+                while (a + l < n && b + l < n && seq[a + l] == seq[b + l]) l++;
+                if (esa.get_lcp_of_suffixes(a, b) != l) cout << "Invalid RMQ found: " << seq << " " << a << " " << b << "\n";
+            }
+
+            esa.for_each_maximal_repeat(1, [&](const LcpInterval & interval)
+            {
+                span<int> sa = sals.get_sa();
+                int first = sa[interval.left_idx_];
+                int last = sa[interval.right_idx_];
+                bool right_maximal = first + interval.lcp_ == n || last + interval.lcp_ == n || seq[first + interval.lcp_] != seq[last + interval.lcp_];
+                bool left_maximal = false;
+                for (int k = interval.left_idx_; k <= interval.right_idx_; k++)
+                {
+                    if (sa[k] == 0 || seq[sa[k] - 1] != seq[first - 1]) left_maximal = true;
+                }
+                if (!right_maximal || !left_maximal) cout << "Invalid repeat found: " << seq.substr(first, interval.lcp_) << "\n";
+            });
+        }
+    }
+
+    // 列挙に漏れがないか: 短い文字列(2文字と4文字のアルファベット)で全ての部分文字列と比べる
+    for (int j = 0; j < 2000; j++)
+    {
+        string seq;
+        for (int i = 0, len = 1 + rng() % 24; i < len; i++) seq += (j % 2 == 0) ? "AC"[rng() % 2] : "ACGT"[rng() % 4];
+        seq += '$';
+        SaLs sals(seq);
+        sals.build_suffix_array();
+        EnhancedSuffixArray esa(sals);
+        esa.build_lcp();
+        span<int> sa = sals.get_sa();
+        auto collect = [&](map<string, int> & found)
+        {
+            return [&](const LcpInterval & interval)
+            {
+                found[seq.substr(sa[interval.left_idx_], interval.lcp_)] += interval.right_idx_ - interval.left_idx_ + 1;
+            };
+        };
+        map<string, int> maximal, supermaximal;
+        esa.for_each_maximal_repeat(1, collect(maximal));
+        esa.for_each_supermaximal_repeat(1, collect(supermaximal));
+        auto [expected_maximal, expected_supermaximal] = brute_force_repeats(seq);
+        if (maximal != expected_maximal || supermaximal != expected_supermaximal)
+        {
+            cout << "Invalid case found" << "\n";
+            cout << "seq: " << seq << "\n";
+        }
+    }
+    return 0;
+}
+#endif
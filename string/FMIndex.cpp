@@ -0,0 +1,379 @@
+//--------------------------------------------------------------------------------------------------------
+// SALS.cppで構築したsuffix arrayからBWTを作り、DNA(4塩基と末尾の'$')のFM-indexとする
+// Reference: Paolo Ferragina and Giovanni Manzini.
+// "Opportunistic data structures with applications" FOCS 2000: 390-398.
+// BWTは64バイト(キャッシュライン1本)のブロックごとに、ブロックより前の各塩基の数(32bit x 4)と
+// 192塩基を2bitずつ詰めたもの(64bit x 6)を並べ、rankはブロック1つとpopcountで求める(1塩基あたり約2.7bit)
+// locateには文字列上の位置がsample_rateの倍数のsuffixだけsaの値を持ち、印のある行に着くまでLFで戻る
+// テキストとsaは持たないので、構築後はSaLsを捨ててよい
+// To compile, perform: g++ -std=c++20 -O2 -pthread -Wall --pedantic-errors -o FMIndex FMIndex.cpp
+// BWTの'$'の位置はdollar_pos_として別に持ち、詰めた塩基の列ではAとして置いて数えるときに除く。
+//--------------------------------------------------------------------------------------------------------
+#define SALS_NO_MAIN
+#include "SALS.cpp"
+#include <bit>
+#include <chrono>
+using namespace std;
+
+struct FMIndex
+{
+    public:
+        // salsはbuild_suffix_array済みで、'$'以外の文字がA, C, G, Tのどれかであること(pack_text済みでもよい)
+        FMIndex(SaLs & sals, const int sa_sample_rate = 32)
+            : len_seq_(sals.get_seq_len()), sample_rate_(max(1, sa_sample_rate))
+            { init_code(); build(sals); }
+
+        // patternの出現回数
+        int count(const string & pattern) const
+        {
+            Range range = {0, len_seq_, static_cast<int>(pattern.size())};
+            while (step(range, pattern)) {}
+            return range.ep_ - range.sp_;
+        }
+
+        // patternの出現位置(昇順とは限らない)をpositionsに追加する
+        void locate(const string & pattern, vector<int> & positions) const
+        {
+            Range range = {0, len_seq_, static_cast<int>(pattern.size())};
+            while (step(range, pattern)) {}
+            for (int i = range.sp_; i < range.ep_; i++) positions.push_back(locate_row(i));
+        }
+
+        // 複数のパターンの出現回数. BATCH本ずつ1文字ずつ交互に進め、次に読むブロックを先読みしてメモリの待ちを重ねる
+        vector<int> count(const vector<string> & patterns) const
+        {
+            vector<Range> ranges = search(patterns);
+            int num_patterns = patterns.size();
+            vector<int> counts(num_patterns);
+            for (int p = 0; p < num_patterns; p++) counts[p] = ranges[p].ep_ - ranges[p].sp_;
+            return counts;
+        }
+
+        // 複数のパターンの出現位置. LFで戻る行もBATCH個ずつ交互に進める
+        vector<vector<int>> locate(const vector<string> & patterns) const
+        {
+            vector<Range> ranges = search(patterns);
+            int num_patterns = patterns.size();
+            vector<vector<int>> positions(num_patterns);
+            vector<pair<int, int>> rows; // (パターン, BWTの行)
+            for (int p = 0; p < num_patterns; p++)
+            {
+                for (int i = ranges[p].sp_; i < ranges[p].ep_; i++) rows.emplace_back(p, i);
+            }
+            int num_rows = rows.size();
+            for (int first = 0; first < num_rows; first += BATCH)
+            {
+                int num = min(BATCH, num_rows - first);
+                array<int, BATCH> row;
+                array<int, BATCH> steps {};
+                int num_active = 0;
+                for (int q = 0; q < num; q++)
+                {
+                    row[q] = rows[first + q].second;
+                    num_active++;
+                }
+                while (num_active > 0)
+                {
+                    num_active = 0;
+                    for (int q = 0; q < num; q++)
+                    {
+                        if (row[q] < 0) continue;
+                        if (is_marked(row[q]))
+                        {
+                            positions[rows[first + q].first].push_back(samples_[rank_marks(row[q])] + steps[q]);
+                            row[q] = -1;
+                            continue;
+                        }
+                        row[q] = lf(row[q]);
+                        steps[q]++;
+                        __builtin_prefetch(&blocks_[row[q] / SYMBOLS_PER_BLOCK]);
+                        num_active++;
+                    }
+                }
+            }
+            return positions;
+        }
+
+        int    get_seq_len()    const { return len_seq_; }
+        int    get_dollar_pos() const { return dollar_pos_; }
+        // 索引全体のバイト数
+        size_t get_bytes()      const { return blocks_.size() * sizeof(RankBlock) + marks_.size() * sizeof(uint64_t) + mark_ranks_.size() * sizeof(int) + samples_.size() * sizeof(int); }
+
+    private:
+        static constexpr int SYMBOLS_PER_BLOCK = 192;
+        static constexpr int BATCH = 16;
+
+        // 64バイトに揃えたrankのブロック
+        struct alignas(64) RankBlock
+        {
+            uint32_t counts_[4];  // ブロックより前の各塩基の数
+            uint64_t symbols_[6]; // 塩基kはsymbols_[k / 32]のビット2(k % 32)から
+        };
+
+        // 後ろ向き検索の途中の状態. pattern[0, remain_)が残っていて、BWTの行[sp_, ep_)がそれまでの接尾辞に一致する
+        struct Range
+        {
+            int sp_;
+            int ep_;
+            int remain_;
+        };
+
+        int                len_seq_ {0};    // '$'を含む文字列の長さ
+        int                sample_rate_;    // locateのためにsaを持つ間隔
+        int                dollar_pos_ {0}; // BWTで'$'のある行
+        array<int, 4>      c_table_ {};     // c_table_[c]は塩基cより小さい文字('$'を含む)の数
+        array<int, 256>    code_;           // 文字から塩基の番号(A, C, G, T以外は-1)
+        vector<RankBlock>  blocks_;
+        vector<uint64_t>   marks_;          // BWTの行のsaの値がsample_rate_の倍数なら1
+        vector<int>        mark_ranks_;     // mark_ranks_[w]はmarks_[0, 8w)の1の数
+        vector<int>        samples_;        // 印のある行のsaの値(行の順)
+
+        void init_code()
+        {
+            code_.fill(-1);
+            for (int c = 0; c < 4; c++) code_[static_cast<unsigned char>("ACGT"[c])] = c;
+        }
+
+        // 'A', 'C', 'G', 'T'以外の文字は最初の1つだけ報告してAとして扱う
+        void build(SaLs & sals)
+        {
+            span<const int> sa = sals.get_sa();
+            bool reported = false;
+            int num_blocks = len_seq_ / SYMBOLS_PER_BLOCK + 1;
+            blocks_.assign(num_blocks, RankBlock {});
+            marks_.assign(len_seq_ / 64 + 1, 0);
+            array<int, 4> counts {};
+            for (int i = 0; i < len_seq_; i++)
+            {
+                RankBlock & block = blocks_[i / SYMBOLS_PER_BLOCK];
+                if (i % SYMBOLS_PER_BLOCK == 0) copy(counts.begin(), counts.end(), block.counts_);
+                int c = 0;
+                if (sa[i] == 0) dollar_pos_ = i;
+                else
+                {
+                    char prev = sals.get_char(sa[i] - 1);
+                    c = code_[static_cast<unsigned char>(prev)];
+                    if (c < 0 && !reported)
+                    {
+                        reported = true;
+                        cerr << "Invalid character found: " << prev << " at " << sa[i] - 1 << "\n";
+                    }
+                    c = max(c, 0);
+                    counts[c]++;
+                }
+                int k = i % SYMBOLS_PER_BLOCK;
+                block.symbols_[k / 32] |= static_cast<uint64_t>(c) << (2 * (k % 32));
+                if (sa[i] % sample_rate_ == 0)
+                {
+                    marks_[i / 64] |= 1ULL << (i % 64);
+                    samples_.push_back(sa[i]);
+                }
+            }
+            if (len_seq_ % SYMBOLS_PER_BLOCK == 0) copy(counts.begin(), counts.end(), blocks_.back().counts_);
+            int sum = 1;
+            for (int c = 0; c < 4; c++)
+            {
+                c_table_[c] = sum;
+                sum += counts[c];
+            }
+            int num_words = marks_.size();
+            mark_ranks_.assign(num_words / 8 + 1, 0);
+            for (int w = 0, ones = 0; w < num_words; w++)
+            {
+                if (w % 8 == 0) mark_ranks_[w / 8] = ones;
+                ones += popcount(marks_[w]);
+            }
+        }
+
+        // BWT[0, i)にある塩基cの数
+        int rank(const int c, const int i) const
+        {
+            const RankBlock & block = blocks_[i / SYMBOLS_PER_BLOCK];
+            int k = i % SYMBOLS_PER_BLOCK;
+            int result = block.counts_[c];
+            for (int w = 0; w < k / 32; w++) result += popcount(match(block.symbols_[w], c));
+            if (k % 32 != 0) result += popcount(match(block.symbols_[k / 32], c) & ((1ULL << (2 * (k % 32))) - 1));
+            if (c == 0 && dollar_pos_ >= i - k && dollar_pos_ < i) result--; // 同じブロックの'$'はAとして詰めてある
+            return result;
+        }
+
+        // wの2bitずつの塩基のうちcに等しいものの下位ビットを立てる
+        static uint64_t match(const uint64_t w, const int c)
+        {
+            uint64_t x = ~(w ^ (0x5555555555555555ULL * c));
+            return x & (x >> 1) & 0x5555555555555555ULL;
+        }
+
+        // 行iのsuffixの1つ前のsuffixの行(LF mapping). iは'$'の行でないこと
+        int lf(const int i) const
+        {
+            const RankBlock & block = blocks_[i / SYMBOLS_PER_BLOCK];
+            int k = i % SYMBOLS_PER_BLOCK;
+            int c = (block.symbols_[k / 32] >> (2 * (k % 32))) & 3;
+            return c_table_[c] + rank(c, i);
+        }
+
+        // rangeを1文字進める. 続ける必要がなければfalse
+        bool step(Range & range, const string & pattern) const
+        {
+            if (range.remain_ == 0 || range.sp_ >= range.ep_) return false;
+            int c = code_[static_cast<unsigned char>(pattern[--range.remain_])];
+            if (c < 0)
+            {
+                range.sp_ = range.ep_ = 0;
+                return false;
+            }
+            range.sp_ = c_table_[c] + rank(c, range.sp_);
+            range.ep_ = c_table_[c] + rank(c, range.ep_);
+            return true;
+        }
+
+        // patternsの各パターンに一致するBWTの行の範囲を求める
+        vector<Range> search(const vector<string> & patterns) const
+        {
+            int num_patterns = patterns.size();
+            vector<Range> ranges(num_patterns);
+            for (int first = 0; first < num_patterns; first += BATCH)
+            {
+                int num = min(BATCH, num_patterns - first);
+                for (int q = 0; q < num; q++) ranges[first + q] = {0, len_seq_, static_cast<int>(patterns[first + q].size())};
+                int num_active = num;
+                while (num_active > 0)
+                {
+                    num_active = 0;
+                    for (int q = 0; q < num; q++)
+                    {
+                        Range & range = ranges[first + q];
+                        if (!step(range, patterns[first + q])) continue;
+                        __builtin_prefetch(&blocks_[range.sp_ / SYMBOLS_PER_BLOCK]);
+                        __builtin_prefetch(&blocks_[range.ep_ / SYMBOLS_PER_BLOCK]);
+                        num_active++;
+                    }
+                }
+            }
+            return ranges;
+        }
+
+        bool is_marked(const int i) const { return (marks_[i / 64] >> (i % 64)) & 1; }
+
+        // marks_[0, i)の1の数
+        int rank_marks(const int i) const
+        {
+            int w = i / 64;
+            int result = mark_ranks_[w / 8];
+            for (int v = w / 8 * 8; v < w; v++) result += popcount(marks_[v]);
+            return result + popcount(marks_[w] & ((1ULL << (i % 64)) - 1));
+        }
+
+        int locate_row(int i) const
+        {
+            int steps = 0;
+            while (!is_marked(i))
+            {
+                i = lf(i);
+                steps++;
+            }
+            return samples_[rank_marks(i)] + steps;
+        }
+};
+
+// SALS.cppのmainと同じくランダムなDNAで、文字列の一部や無作為なパターンの出現回数と位置を直接の探索と比べる
+#ifndef FMINDEX_NO_MAIN
+int main()
+{
+    vector<int> len_seq = {1, 10, 73, 100, 240, 777, 1000, 3511, 10000};
+    mt19937 rng(1);
+    for (int len : len_seq)
+    {
+        cout << "Testing length: " << len << "\n";
+        for (int j = 1; j <= 100; j++)
+        {
+            SaLs sals(len);
+            string seq = sals.get_seq();
+            if (j % 2 == 0) sals.pack_text(); // 詰めた文字列からも同じ索引を作れること
+            sals.build_suffix_array();
+            FMIndex fm(sals, 1 + rng() % 40);
+
+            vector<string> patterns;
+            for (int k = 0; k < 20; k++)
+            {
+                int l = 1 + rng() % 12;
+                if (k % 2 == 0 && l < len) patterns.push_back(seq.substr(rng() % (len - l), l));
+                else
+                {
+                    string p;
+                    for (int t = 0; t < l; t++) p += "ACGT"[rng() % 4];
+                    patterns.push_back(p);
+                }
+            }
+            vector<vector<int>> located = fm.locate(patterns);
+            vector<int> counts = fm.count(patterns);
+            for (int k = 0; k < static_cast<int>(patterns.size()); k++)
+            {
+                vector<int> expected;
+                for (size_t pos = seq.find(patterns[k]); pos != string::npos; pos = seq.find(patterns[k], pos + 1)) expected.push_back(pos);
+                sort(located[k].begin(), located[k].end());
+                int num_expected = expected.size();
+                if (located[k] != expected || counts[k] != num_expected || fm.count(patterns[k]) != num_expected)
+                {
+                    cout << "Invalid case found" << "\n";
+                    cout << "seq: " << seq << "\n";
+                    cout << "pattern: " << patterns[k] << "\n";
+                }
+            }
+        }
+    }
+
+    // 索引がキャッシュに載らない長さで、1本ずつと複数まとめたcount / locateの1秒あたりのパターン数を比べる
+    // パターンの半分は文字列から取り、残りはランダム(ほとんど出現しない)
+    {
+        const int len = 1 << 24;
+        SaLs sals(len);
+        string seq = sals.get_seq();
+        sals.build_suffix_array();
+        FMIndex fm(sals);
+        vector<string> patterns;
+        for (int k = 0; k < 200000; k++)
+        {
+            string p;
+            if (k % 2 == 0) p = seq.substr(rng() % (len - 16), 16);
+            else for (int t = 0; t < 16; t++) p += "ACGT"[rng() % 4];
+            patterns.push_back(p);
+        }
+        auto timed = [&](const char * name, const auto & func)
+        {
+            auto start = chrono::steady_clock::now();
+            long long checksum = func();
+            double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << name << ": " << patterns.size() / sec << " patterns/sec (" << checksum << " hits)\n";
+            return checksum;
+        };
+        long long single_count = timed("count (single)", [&]
+        {
+            long long hits = 0;
+            for (const auto & p : patterns) hits += fm.count(p);
+            return hits;
+        });
+        long long batch_count = timed("count (batched)", [&]
+        {
+            long long hits = 0;
+            for (int c : fm.count(patterns)) hits += c;
+            return hits;
+        });
+        long long single_locate = timed("locate (single)", [&]
+        {
+            vector<int> positions;
+            for (const auto & p : patterns) fm.locate(p, positions);
+            return static_cast<long long>(positions.size());
+        });
+        long long batch_locate = timed("locate (batched)", [&]
+        {
+            long long hits = 0;
+            for (const auto & positions : fm.locate(patterns)) hits += positions.size();
+            return hits;
+        });
+        if (single_count != batch_count || single_locate != batch_locate || single_count != single_locate) cout << "Invalid case found" << "\n";
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,228 @@
+//--------------------------------------------------------------------------------------------------------
+// 複数の配列(コンティグやリード)をまとめて1つのsuffix arrayにするgeneralized suffix array
+// 配列dの後ろに区切り文字#_dを置いてつなぎ、#_0 < #_1 < ... < (どの塩基)となる整数の列としてSALS.cppのSA-ISで並べる
+// 区切り文字は1つずつ別の値なので、異なる配列のsuffixの比較はどちらかの区切り文字で必ず止まり、
+// 配列の終わりまで等しいsuffixは配列の番号の順に並ぶ(saの先頭m行は区切り文字から始まるsuffixで、配列の順に並ぶ)
+// saの各行がどの配列のどの位置かは、文字列上の配列の先頭に1を立てたビット列のrankで求める(n + n / 8ビット程度)
+// To compile, perform: g++ -std=c++20 -O2 -pthread -Wall --pedantic-errors -o GeneralizedSuffixArray GeneralizedSuffixArray.cpp
+//--------------------------------------------------------------------------------------------------------
+#define SALS_NO_MAIN
+#include "SALS.cpp"
+#include <bit>
+#include <map>
+#include <set>
+#include <tuple>
+using namespace std;
+
+struct GeneralizedSuffixArray
+{
+    public:
+        // alphabetにない文字はalphabet[0]に置き換え、get_num_replacedで数を返す
+        GeneralizedSuffixArray(const vector<string> & seqs, const vector<char> & alphabet = {'A', 'C', 'G', 'T'})
+            : alphabet_(alphabet)
+            { build(seqs); }
+
+        // sa_[i]のsuffixがある配列の番号
+        int get_document(const int i) const { return rank_starts(sa_[i] + 1) - 1; }
+        // sa_[i]のsuffixの、配列の中での開始位置
+        int get_offset(const int i) const { return sa_[i] - starts_[get_document(i)]; }
+
+        // saの行ごとの配列の番号(document array). 繰り返し引くときにget_documentの代わりに使う
+        vector<int> build_document_array() const
+        {
+            vector<int> documents(len_text_);
+            for (int i = 0; i < len_text_; i++) documents[i] = get_document(i);
+            return documents;
+        }
+
+        // Kasai法のLCP配列. 区切り文字どうしは一致しないものとして数える
+        void build_lcp()
+        {
+            vector<int> isa(len_text_);
+            for (int i = 0; i < len_text_; i++) isa[sa_[i]] = i;
+            lcp_.assign(len_text_, 0);
+            int l = 0;
+            for (int i = 0; i < len_text_; i++)
+            {
+                int j = isa[i];
+                if (j == 0)
+                {
+                    l = 0;
+                    continue;
+                }
+                int k = sa_[j - 1];
+                while (i + l < len_text_ && k + l < len_text_ && text_[i + l] == text_[k + l] && text_[i + l] != SEPARATOR) l++;
+                lcp_[j] = l;
+                if (l > 0) l--;
+            }
+        }
+
+        // 長さkの同じ部分文字列から始まり、2つ以上の配列にまたがるsaの区間[left, right]ごとにfunc(left, right)を呼ぶ
+        // (k-merを共有する配列の組や、重なりの候補を1回の走査で集める). build_lcpの後で呼ぶ
+        template <class Func>
+        void for_each_shared_kmer(const int k, const Func & func) const
+        {
+            int left = 0;
+            for (int i = 1; i <= len_text_; i++)
+            {
+                if (i < len_text_ && lcp_[i] >= k) continue;
+                // [left, i)はk文字が等しい区間(長さkに満たないsuffixは1行だけの区間になる)
+                if (i - left >= 2)
+                {
+                    int first = get_document(left);
+                    for (int j = left + 1; j < i; j++)
+                    {
+                        if (get_document(j) != first)
+                        {
+                            func(left, i - 1);
+                            break;
+                        }
+                    }
+                }
+                left = i;
+            }
+        }
+
+        int               get_num_seqs()     const { return starts_.size(); }
+        int               get_text_len()     const { return len_text_; }
+        int               get_num_replaced() const { return num_replaced_; }
+        vector<int> &     get_sa()                 { return sa_; }
+        vector<int> &     get_lcp()                { return lcp_; }
+        vector<int> &     get_starts()             { return starts_; }
+        // 文字列のi文字目(区切り文字は'#')
+        char              get_char(const int i) const { return (text_[i] == SEPARATOR) ? '#' : alphabet_[text_[i]]; }
+
+    private:
+        static constexpr uint8_t SEPARATOR = 0xFF;
+
+        vector<char>     alphabet_;
+        int              len_text_ {0};       // 区切り文字を含む長さ
+        vector<uint8_t>  text_;               // alphabet_の番号の列(区切り文字は#_dのdによらず全てSEPARATOR)
+        vector<int>      sa_;
+        vector<int>      lcp_;                // lcp_[i]はsa_[i - 1]とsa_[i]のLCP(区切り文字の手前まで)
+        vector<int>      starts_;             // 各配列の先頭の位置
+        vector<uint64_t> start_bits_;         // 配列の先頭の位置に1
+        vector<int>      start_ranks_;        // start_ranks_[w]はstart_bits_[0, 8w)の1の数
+        int              num_replaced_ {0};
+
+        void build(const vector<string> & seqs)
+        {
+            int num_seqs = seqs.size();
+            array<int, 256> code;
+            code.fill(-1);
+            for (int c = 0; c < static_cast<int>(alphabet_.size()); c++) code[static_cast<unsigned char>(alphabet_[c])] = c;
+            for (const string & seq : seqs) len_text_ += seq.size() + 1;
+
+            // 区切り文字#_dはd、alphabet_のc番目の文字はnum_seqs + cとした列をSA-ISで並べる
+            vector<int> work(len_text_);
+            text_.resize(len_text_);
+            start_bits_.assign(len_text_ / 64 + 1, 0);
+            int pos = 0;
+            for (int d = 0; d < num_seqs; d++)
+            {
+                starts_.push_back(pos);
+                start_bits_[pos / 64] |= 1ULL << (pos % 64);
+                for (char ch : seqs[d])
+                {
+                    int c = code[static_cast<unsigned char>(ch)];
+                    if (c < 0)
+                    {
+                        c = 0;
+                        num_replaced_++;
+                    }
+                    text_[pos] = c;
+                    work[pos++] = num_seqs + c;
+                }
+                text_[pos] = SEPARATOR;
+                work[pos++] = d;
+            }
+            sa_.resize(len_text_);
+            SaLs::sort_integer_text(work.data(), sa_.data(), len_text_, num_seqs + alphabet_.size());
+
+            int num_words = start_bits_.size();
+            start_ranks_.assign(num_words / 8 + 1, 0);
+            for (int w = 0, ones = 0; w < num_words; w++)
+            {
+                if (w % 8 == 0) start_ranks_[w / 8] = ones;
+                ones += popcount(start_bits_[w]);
+            }
+        }
+
+        // start_bits_[0, i)の1の数
+        int rank_starts(const int i) const
+        {
+            int w = i / 64;
+            int result = start_ranks_[w / 8];
+            for (int v = w / 8 * 8; v < w; v++) result += popcount(start_bits_[v]);
+            if (i % 64 != 0) result += popcount(start_bits_[w] & ((1ULL << (i % 64)) - 1));
+            return result;
+        }
+};
+
+// ランダムな長さのDNAの組で、saを(suffixの配列の終わりまでの文字列, 配列の番号)の順に直接並べたものと比べ、
+// document array、LCP配列と、2つ以上の配列に現れるk-merを直接求めたものと比べる
+#ifndef GENERALIZEDSUFFIXARRAY_NO_MAIN
+int main()
+{
+    vector<int> num_seqs = {1, 2, 5, 30, 200};
+    mt19937 rng(1);
+    for (int m : num_seqs)
+    {
+        cout << "Testing sequences: " << m << "\n";
+        for (int j = 1; j <= 20; j++)
+        {
+            vector<string> seqs(m);
+            for (string & seq : seqs)
+            {
+                int len = rng() % 60;
+                for (int t = 0; t < len; t++) seq += "ACGT"[rng() % ((j % 2 == 0) ? 2 : 4)]; // 偶数回目は2文字だけで一致を増やす
+            }
+            GeneralizedSuffixArray gsa(seqs);
+            gsa.build_lcp();
+
+            vector<tuple<string, int, int>> expected; // (配列の終わりまでのsuffix, 配列, 位置)
+            for (int d = 0; d < m; d++)
+            {
+                for (int o = 0; o <= static_cast<int>(seqs[d].size()); o++) expected.emplace_back(seqs[d].substr(o), d, o);
+            }
+            sort(expected.begin(), expected.end());
+            vector<int> documents = gsa.build_document_array();
+            bool ok = static_cast<int>(expected.size()) == gsa.get_text_len();
+            for (int i = 0; ok && i < gsa.get_text_len(); i++)
+            {
+                auto & [suffix, d, o] = expected[i];
+                ok = gsa.get_document(i) == d && documents[i] == d && gsa.get_offset(i) == o && gsa.get_sa()[i] == gsa.get_starts()[d] + o;
+                if (ok && i > 0)
+                {
+                    const string & prev = get<0>(expected[i - 1]);
+                    int l = 0;
+                    while (l < static_cast<int>(min(prev.size(), suffix.size())) && prev[l] == suffix[l]) l++;
+                    ok = gsa.get_lcp()[i] == l;
+                }
+            }
+
+            int k = 4;
+            set<string> shared;
+            gsa.for_each_shared_kmer(k, [&](const int left, const int right)
+            {
+                string kmer;
+                for (int t = 0; t < k; t++) kmer += gsa.get_char(gsa.get_sa()[left] + t);
+                shared.insert(kmer);
+                for (int i = left; i <= right; i++) ok = ok && gsa.get_lcp()[i] >= ((i == left) ? 0 : k);
+            });
+            map<string, set<int>> occurrences;
+            for (int d = 0; d < m; d++)
+            {
+                for (int o = 0; o + k <= static_cast<int>(seqs[d].size()); o++) occurrences[seqs[d].substr(o, k)].insert(d);
+            }
+            set<string> expected_shared;
+            for (auto & [kmer, docs] : occurrences)
+            {
+                if (docs.size() >= 2) expected_shared.insert(kmer);
+            }
+            if (!ok || shared != expected_shared) cout << "Invalid case found" << "\n";
+        }
+    }
+    return 0;
+}
+#endif
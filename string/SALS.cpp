@@ -2,88 +2,922 @@
 // suffix array (sa)をdoubling法で構築するクラス
 // Reference: N. Jesper Larsson and Kunihiko Sadakane. 
 // "Faster suffix sorting” Theoretical Computer Science, 387 (2007): 258-272.
-// To compile, perform: g++ -std=c++20 -Wall --pedantic-errors -o SALS SALS.cpp
-// debugする際の注意として、sa_は絶対値を取ること。isa_はisa_[sa_[i]]の形で参照すること。
-// sa_の要素は負の値を持つことがある。これは、ある要素のsuffix array中の位置が確定した(ソート済みグループである)ことを示す。
+// SuffixSortEngine::SAISを選ぶとinduced sortingで線形時間で構築する
+// Reference: Ge Nong, Sen Zhang and Wai Hong Chan.
+// "Two Efficient Algorithms for Linear Time Suffix Array Construction" IEEE Transactions on Computers, 60(10) (2011): 1471-1484.
+// To compile, perform: g++ -std=c++20 -O2 -pthread -Wall --pedantic-errors -o SALS SALS.cpp
+// 構築中のisa_[i]はsuffix iが属するグループの番号(グループのsa_中の最後の位置)で、その場で細分していく。
+// sa_の要素は構築中に負の値を持つことがある。sa_[i] = -lはsa_[i, i + l)がソート済みであることを示し、
+// ソート済みの区間はO(1)で読み飛ばす(区間の先頭以外の要素は意味を持たない)。構築後のsa_はisa_から作り直す。
+// DNAのように'$'以外が4文字以下なら、先頭k文字(32まで)を2bitずつ詰めたキーの基数ソートで最初のグループを作り、h = kから始める。
+// 添字の型Indexはテンプレート引数で、int(SaLs)ならそのまま、int64_t(SaLs64)なら2^31を超える長さも扱える。
+// 構築中のsa_に負の値を置くので符号付きの型に限る。
+// pack_textで文字列を1塩基2bitに詰めて持てる('$'は詰めず、その位置をsentinel_pos_に持つ)。
+// load_fastaはFASTAをmmapして読み、save_indexは構築したsa_(とisa_, LCP配列)を版とchecksumの付いたバイナリ形式で保存する。
+// load_indexはそのファイルをmmapし、構築し直さずコピーもせずにget_sa, get_isa, get_lcpから見せる。
+// build_suffix_array_externalは文字列以外のメモリを予算内に抑え、suffixを先頭の文字でディスク上のバケツに分けて
+// バケツごとにメモリ上でソートし、save_indexと同じ形式のファイルへ順に書き出す。
+// 文字列は最小の文字'$'で終わるものとする。
 //--------------------------------------------------------------------------------------------------------
 #include <iostream>
 #include <string>
 #include <vector>
-#include <map>
 #include <random>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include <span>
+#include <fstream>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <filesystem>
+#include <bit>
+#include <tuple>
 using namespace std;
 
-struct SaLs
+// DOUBLING: Larsson-Sadakaneのprefix doubling. O(n log n)
+// SAIS:     SA-IS. O(n)で、sa_のほかにL/S型のnバイトとバケツ、再帰の分だけを使う
+//           (num_order_は0のまま、num_sorted_groups_は全suffixの数になる)
+enum class SuffixSortEngine { DOUBLING, SAIS };
+
+// ファイル全体をmmapする. MAP_PRIVATEなので書き換えてもファイルには反映されない(書いたページだけがコピーされる)
+struct MappedFile
+{
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator=(const MappedFile &) = delete;
+        ~MappedFile() { close(); }
+
+        // 空のファイルは開けないものとする
+        bool open(const string & path)
+        {
+            close();
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+            {
+                void * data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED)
+                {
+                    data_ = static_cast<char *>(data);
+                    size_ = st.st_size;
+                }
+            }
+            ::close(fd);
+            return data_ != nullptr;
+        }
+
+        void close()
+        {
+            if (data_ != nullptr) munmap(data_, size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+        void advise_sequential() const { if (data_ != nullptr) madvise(data_, size_, MADV_SEQUENTIAL); }
+
+        char * data()    const { return data_; }
+        size_t size()    const { return size_; }
+        bool   is_open() const { return data_ != nullptr; }
+
+    private:
+        char * data_ {nullptr};
+        size_t size_ {0};
+};
+
+// save_indexのファイルの先頭(HEADER_BYTESに切り上げる). 続く各区間は64バイト境界から始まり、ないときは長さ0
+// 数値はすべて書き込んだ計算機のバイト順で、同じ種類の計算機で読み直すものとする
+struct SaLsIndexHeader
+{
+    enum Section { TEXT, SA, ISA, LCP, NUM_SECTIONS };
+    static constexpr char     MAGIC[8] = {'S', 'A', 'L', 'S', 'I', 'D', 'X', '\0'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t   MAX_ALPHABET = 64;
+
+    char     magic_[8];
+    uint32_t version_;
+    uint32_t index_bytes_;               // sizeof(Index)
+    uint64_t len_seq_;
+    int64_t  sentinel_pos_;              // 文字列を詰めたときの'$'の位置
+    uint32_t is_packed_;                 // 1なら文字列はuint64_tに2bitずつ詰めたもの、0なら1文字1バイト
+    uint32_t num_alphabet_;
+    char     alphabet_[MAX_ALPHABET];
+    uint64_t offset_[NUM_SECTIONS];      // 各区間のファイルの先頭からの位置
+    uint64_t bytes_[NUM_SECTIONS];       // 各区間のバイト数(64バイト境界までの詰め物は含まない)
+    uint64_t checksum_;                  // ヘッダより後ろ全体(詰め物を含む)のindex_checksum
+};
+constexpr size_t HEADER_BYTES = (sizeof(SaLsIndexHeader) + 63) / 64 * 64;
+
+// 8バイトずつのFNV-1a. bytesは8の倍数であること
+inline uint64_t index_checksum(const char * data, const size_t bytes, uint64_t hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < bytes; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// save_indexの形式のファイルを先頭から順に書く. 区間はTEXT, SA, ISA, LCPの順にbegin_section, write, end_sectionで書き
+// (書かない区間もbegin_sectionとend_sectionは呼ぶ)、finishで区間の位置とchecksumを入れたヘッダを書き戻す
+struct IndexFileWriter
 {
     public:
-        SaLs(const int len_seq)
-            : seq_(""),  len_seq_(len_seq),    sa_(len_seq, 0),  isa_(len_seq, 0) 
+        bool open(const string & path)
+        {
+            out_.open(path, ios::binary | ios::trunc);
+            if (!out_) return false;
+            header_ = SaLsIndexHeader {};
+            offset_ = 0;
+            hash_ = index_checksum(nullptr, 0);
+            out_.write(string(HEADER_BYTES, '\0').data(), HEADER_BYTES);
+            offset_ = HEADER_BYTES;
+            return out_.good();
+        }
+
+        // magic_, version_, 区間の位置とchecksum以外はここに入れておく
+        SaLsIndexHeader & header() { return header_; }
+
+        void begin_section(const int k)
+        {
+            section_ = k;
+            header_.offset_[k] = offset_;
+            header_.bytes_[k] = 0;
+        }
+
+        void write(const char * data, const size_t bytes)
+        {
+            put(data, bytes);
+            header_.bytes_[section_] += bytes;
+        }
+
+        // 64バイト境界まで0を詰める
+        void end_section()
+        {
+            const char zeros[64] {};
+            put(zeros, (64 - offset_ % 64) % 64);
+        }
+
+        bool finish()
+        {
+            memcpy(header_.magic_, SaLsIndexHeader::MAGIC, sizeof(header_.magic_));
+            header_.version_ = SaLsIndexHeader::VERSION;
+            header_.checksum_ = hash_;
+            out_.seekp(0);
+            out_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+            out_.close();
+            return !out_.fail();
+        }
+
+    private:
+        ofstream        out_;
+        SaLsIndexHeader header_ {};
+        int             section_ {0};
+        uint64_t        offset_ {0};   // 次に書くファイル上の位置
+        uint64_t        hash_ {0};
+        char            carry_[8] {};  // checksumに加えていない8バイト未満の端
+        size_t          carry_len_ {0};
+
+        void put(const char * data, const size_t bytes)
+        {
+            out_.write(data, bytes);
+            offset_ += bytes;
+            size_t i = 0;
+            if (carry_len_ > 0)
+            {
+                i = min(bytes, 8 - carry_len_);
+                memcpy(carry_ + carry_len_, data, i);
+                carry_len_ += i;
+                if (carry_len_ < 8) return;
+                hash_ = index_checksum(carry_, 8, hash_);
+                carry_len_ = 0;
+            }
+            size_t whole = (bytes - i) / 8 * 8;
+            hash_ = index_checksum(data + i, whole, hash_);
+            i += whole;
+            carry_len_ = bytes - i;
+            memcpy(carry_, data + i, carry_len_);
+        }
+};
+
+template <class Index>
+struct BasicSaLs
+{
+    static_assert(is_signed_v<Index>, "sa_ holds negative run lengths during construction");
+
+    public:
+        // load_fastaかload_indexで文字列を読むときに使う
+        BasicSaLs()
+            { init_rng(); }
+        BasicSaLs(const Index len_seq)
+            : seq_(""),  len_seq_(len_seq) 
             { init_rng(); gen_random_seq(); }
-        SaLs(const string & seq)
-            : seq_(seq), len_seq_(seq.size()), sa_(len_seq_, 0), isa_(len_seq_, 0) 
+        BasicSaLs(const string & seq)
+            : seq_(seq), len_seq_(seq.size()) 
             { init_rng(); }
-        SaLs(const string & seq, const vector<char> & alphabet)
-            : seq_(seq), len_seq_(seq.size()), sa_(len_seq_, 0), isa_(len_seq_, 0), alphabet_(alphabet) 
+        BasicSaLs(const string & seq, const vector<char> & alphabet)
+            : seq_(seq), len_seq_(seq.size()), alphabet_(alphabet) 
             { init_rng(); }
+
+        // seq_を1塩基2bitでpacked_に詰め、seq_を空にする(以後はget_charで読む)
+        // アルファベットがデフォルトのDNAで、'$'が高々1つのときだけ詰めてtrueを返す
+        bool pack_text()
+        {
+            if (is_packed_) return true;
+            if (alphabet_ != vector<char> {'$', 'A', 'C', 'G', 'T'}) return false;
+            create_alphabet_map();
+            Index sentinel_pos = -1;
+            for (Index i = 0; i < len_seq_; i++)
+            {
+                int c = code_[static_cast<unsigned char>(seq_[i])];
+                if (c == 0 && (seq_[i] != '$' || sentinel_pos >= 0)) return false;
+                if (c == 0) sentinel_pos = i;
+            }
+            packed_.assign(len_seq_ / 32 + 1, 0);
+            for (Index i = 0; i < len_seq_; i++)
+            {
+                if (i != sentinel_pos) packed_[i / 32] |= static_cast<uint64_t>(code_[static_cast<unsigned char>(seq_[i])] - 1) << (2 * (i % 32));
+            }
+            sentinel_pos_ = sentinel_pos;
+            is_packed_ = true;
+            packed_words_ = packed_;
+            string().swap(seq_);
+            return true;
+        }
+
+        // FASTAの配列を(複数あれば区切らずに)つないで末尾に'$'を置き、文字列とする. 見出しと開始位置はget_recordsで得る
+        // 小文字は大文字にし、alphabet_にない文字(NやIUPACの曖昧な塩基、'$')はalphabet_[1]に置き換えてget_num_replacedで数える
+        // packでアルファベットがデフォルトのDNAなら、読みながら2bitに詰める(1塩基1バイトのseq_を経由しない)
+        bool load_fasta(const string & path, const bool pack = false)
+        {
+            MappedFile file;
+            if (!file.open(path))
+            {
+                cerr << "Cannot open " << path << "\n";
+                return false;
+            }
+            file.advise_sequential();
+            mapped_.close();
+            create_alphabet_map();
+            bool packing = pack && alphabet_ == vector<char> {'$', 'A', 'C', 'G', 'T'};
+            string().swap(seq_);
+            packed_.clear();
+            records_.clear();
+            num_replaced_ = 0;
+            if (packing) packed_.reserve(file.size() / 32 + 2);
+            Index len = 0;
+            auto append = [&](const int c)
+            {
+                if (packing)
+                {
+                    if (len % 32 == 0) packed_.push_back(0);
+                    packed_.back() |= static_cast<uint64_t>(c - 1) << (2 * (len % 32));
+                }
+                else seq_.push_back(alphabet_[c]);
+                len++;
+            };
+
+            const char * p = file.data();
+            const char * end = p + file.size();
+            while (p < end)
+            {
+                if (*p == '>')
+                {
+                    const char * eol = find(p, end, '\n');
+                    string header(p + 1, eol);
+                    if (!header.empty() && header.back() == '\r') header.pop_back();
+                    records_.emplace_back(header, len);
+                    p = eol;
+                    continue;
+                }
+                unsigned char ch = *p++;
+                if (isspace(ch)) continue;
+                int c = code_[toupper(ch)];
+                if (c == 0)
+                {
+                    c = 1;
+                    num_replaced_++;
+                }
+                append(c);
+            }
+
+            if (packing)
+            {
+                sentinel_pos_ = len;
+                len++;
+                packed_.resize(len / 32 + 1, 0);
+                packed_words_ = packed_;
+            }
+            else
+            {
+                seq_.push_back(alphabet_[0]);
+                len++;
+            }
+            is_packed_ = packing;
+            len_seq_ = len;
+            return true;
+        }
+
+        // sa_を(with_isaならisa_も、lcpを与えればそれも)pathに書く. build_suffix_arrayかload_indexの後に呼ぶ
+        bool save_index(const string & path, const bool with_isa = false, span<const Index> lcp = {})
+        {
+            IndexFileWriter writer;
+            if (!open_index_writer(path, writer)) return false;
+            span<const Index> sa = get_sa();
+            span<const Index> isa = with_isa ? get_isa() : span<Index> {};
+            writer.begin_section(SaLsIndexHeader::SA);
+            writer.write(reinterpret_cast<const char *>(sa.data()), sa.size_bytes());
+            writer.end_section();
+            writer.begin_section(SaLsIndexHeader::ISA);
+            writer.write(reinterpret_cast<const char *>(isa.data()), isa.size_bytes());
+            writer.end_section();
+            writer.begin_section(SaLsIndexHeader::LCP);
+            writer.write(reinterpret_cast<const char *>(lcp.data()), lcp.size_bytes());
+            writer.end_section();
+            return writer.finish();
+        }
+
+        // sa_, isa_を持たずに、save_indexと同じ形式(ISA, LCPなし)のsuffix arrayをindex_pathに書いてload_indexで読み直す
+        // 文字列(pack_textしておけば1塩基2bit)はメモリに置き、それ以外をおよそmemory_budgetバイトに抑える
+        // suffixを先頭の数文字でバケツに分け、メモリに収まる分ずつscratch_dirのファイルへ順に書き出してから、
+        // バケツを辞書順に1つずつ読んでソートし、index_pathのSAの区間へ順に書き足す
+        // 収まらないほど大きいバケツはその先の文字で分け直し、1つのprefixだけのバケツは周期が崩れる位置で分ける
+        // 予算が小さいほどファイルを読み書きする回数が増えるが、バケツは最低でもMIN_BUCKET_CAPACITY個までメモリに置いて進める
+        // scratchファイルは失敗したときも含めて全て消す
+        // '$'は末尾に1つだけであること
+        bool build_suffix_array_external(const string & index_path, const string & scratch_dir, const size_t memory_budget)
+        {
+            if (mapped_.is_open()) return true;
+            create_alphabet_map();
+            for (Index i = 0; i + 1 < len_seq_; i++)
+            {
+                if (is_packed_ ? i == sentinel_pos_ : code_at(i) == 0)
+                {
+                    cerr << "'$' must appear only at the end\n";
+                    return false;
+                }
+            }
+            if (len_seq_ > 0 && code_at(len_seq_ - 1) != 0)
+            {
+                cerr << "'$' must appear only at the end\n";
+                return false;
+            }
+            vector<Index>().swap(sa_);
+            vector<Index>().swap(isa_);
+
+            ExternalSort sort;
+            sort.scratch_dir_ = scratch_dir;
+            sort.bits_per_char_ = is_packed_ ? 2 : max(1, static_cast<int>(bit_width(alphabet_.size() - 2)));
+            sort.chars_per_key_ = 64 / sort.bits_per_char_;
+            sort.prefix_len_ = 1;
+            size_t text_bytes = is_packed_ ? packed_words_.size_bytes() : seq_.size();
+            size_t rest = (memory_budget > text_bytes) ? memory_budget - text_bytes : 0;
+            // バケツの数え上げの表(8バイト x 2^(ビット数))は残りの1/8以下、2^20以下にする
+            while (sort.bits_per_char_ * (sort.prefix_len_ + 1) <= 20 && (sizeof(uint64_t) << (sort.bits_per_char_ * (sort.prefix_len_ + 1))) <= rest / 8)
+            {
+                sort.prefix_len_++;
+            }
+            rest -= min(rest, (sizeof(uint64_t) << (sort.bits_per_char_ * sort.prefix_len_)) + MAX_SCRATCH_FILES * SCRATCH_BUFFER * sizeof(Index));
+            sort.capacity_ = max<size_t>(MIN_BUCKET_CAPACITY, rest / sizeof(pair<uint64_t, Index>));
+
+            IndexFileWriter writer;
+            if (!open_index_writer(index_path, writer)) return false;
+            writer.begin_section(SaLsIndexHeader::SA);
+            sort.writer_ = &writer;
+            bool ok = sort_buckets(sort);
+            writer.end_section();
+            for (int k : {SaLsIndexHeader::ISA, SaLsIndexHeader::LCP})
+            {
+                writer.begin_section(k);
+                writer.end_section();
+            }
+            ok = writer.finish() && ok;
+            num_passes_ = sort.num_passes_;
+            return ok && load_index(index_path);
+        }
+
+        // save_indexで書いたpathをmmapし、sa_, isa_, LCP配列と詰めた文字列をコピーせずにget_sa, get_isa, get_lcp, get_charから見せる
+        // 詰めていない文字列だけはseq_にコピーする. verify_checksumならファイル全体を読んでchecksumを確かめる
+        bool load_index(const string & path, const bool verify_checksum = false)
+        {
+            auto fail = [&](const string & reason)
+            {
+                mapped_.close();
+                cerr << "Cannot load " << path << ": " << reason << "\n";
+                return false;
+            };
+            if (!mapped_.open(path)) return fail("cannot map");
+            if (mapped_.size() < HEADER_BYTES) return fail("too short");
+            SaLsIndexHeader header;
+            memcpy(&header, mapped_.data(), sizeof(header));
+            if (memcmp(header.magic_, SaLsIndexHeader::MAGIC, sizeof(header.magic_)) != 0) return fail("not an index file");
+            if (header.version_ != SaLsIndexHeader::VERSION) return fail("unsupported version " + to_string(header.version_));
+            if (header.index_bytes_ != sizeof(Index)) return fail("index width " + to_string(header.index_bytes_) + " bytes");
+            if (header.num_alphabet_ > SaLsIndexHeader::MAX_ALPHABET) return fail("broken header");
+
+            uint64_t len = header.len_seq_;
+            uint64_t text_bytes = header.is_packed_ ? (len / 32 + 1) * 8 : len;
+            uint64_t array_bytes = len * sizeof(Index);
+            auto section_ok = [&](const int k, const bool optional, const uint64_t bytes)
+            {
+                uint64_t size = header.bytes_[k];
+                if (optional && size == 0) return true;
+                return size == bytes && header.offset_[k] % 64 == 0 && header.offset_[k] <= mapped_.size() && size <= mapped_.size() - header.offset_[k];
+            };
+            if (!section_ok(SaLsIndexHeader::TEXT, false, text_bytes) || !section_ok(SaLsIndexHeader::SA, false, array_bytes)
+                || !section_ok(SaLsIndexHeader::ISA, true, array_bytes) || !section_ok(SaLsIndexHeader::LCP, true, array_bytes))
+            {
+                return fail("broken header");
+            }
+            if (verify_checksum && index_checksum(mapped_.data() + HEADER_BYTES, (mapped_.size() - HEADER_BYTES) / 8 * 8) != header.checksum_)
+            {
+                return fail("checksum mismatch");
+            }
+
+            auto view = [this, &header](const int k) { return span<Index>(reinterpret_cast<Index *>(mapped_.data() + header.offset_[k]), header.bytes_[k] / sizeof(Index)); };
+            len_seq_ = len;
+            alphabet_.assign(header.alphabet_, header.alphabet_ + header.num_alphabet_);
+            create_alphabet_map();
+            is_packed_ = header.is_packed_;
+            sentinel_pos_ = header.sentinel_pos_;
+            packed_.clear();
+            string().swap(seq_);
+            const char * text = mapped_.data() + header.offset_[SaLsIndexHeader::TEXT];
+            if (is_packed_) packed_words_ = span<const uint64_t>(reinterpret_cast<const uint64_t *>(text), text_bytes / 8);
+            else            seq_.assign(text, len);
+            sa_view_ = view(SaLsIndexHeader::SA);
+            isa_view_ = view(SaLsIndexHeader::ISA);
+            lcp_view_ = view(SaLsIndexHeader::LCP);
+            vector<Index>().swap(sa_);
+            vector<Index>().swap(isa_);
+            num_sorted_groups_ = len_seq_;
+            num_order_ = 0;
+            num_initial_sorted_groups_ = 0;
+            return true;
+        }
         
         void build_suffix_array()
         {
+            if (mapped_.is_open()) return; // load_indexで読んだ索引は構築済み
             create_alphabet_map();
+            sa_.assign(len_seq_, 0); // sa_, isa_は構築するときに確保する(build_suffix_array_externalでは確保しない)
+            isa_.assign(len_seq_, 0);
+            num_sorted_groups_ = 0;
+            num_order_ = 0;
+            num_initial_sorted_groups_ = 0;
+            report_invalid_bases();
+            if (engine_ == SuffixSortEngine::SAIS) build_by_induced_sorting();
+            else                                   build_by_doubling();
+            if (verify_) verify_sa();
+        }
+
+        // sa_(load_index後は読んだsa)が正しいsuffix arrayならtrue. 違えば最初に見つけた位置を報告する
+        // saが置換で、隣り合うsuffix sa[i], sa[i + 1]ごとに、先頭の文字が小さいか、等しくて1文字先のsuffixの順位が小さければ正しい
+        // 文字列を比べないので線形時間で、isa_がなければ順位をn要素作る
+        // Reference: Stefan Burkhardt and Juha Kärkkäinen.
+        // "Fast Lightweight Suffix Array Construction and Checking" CPM 2003, LNCS 2676: 55-69.
+        bool verify_sa()
+        {
+            span<const Index> sa = get_sa();
+            span<const Index> isa = get_isa();
+            vector<Index> rank;
+            auto report = [](const string & reason, const Index i)
+            {
+                cout << "Invalid case found" << "\n";
+                cout << reason << " at position: " << i << "\n";
+                return false;
+            };
+            if (static_cast<Index>(sa.size()) != len_seq_) return report("wrong length", 0);
+            if (static_cast<Index>(isa.size()) != len_seq_)
+            {
+                rank.assign(len_seq_, -1);
+                for (Index i = 0; i < len_seq_; i++)
+                {
+                    if (sa[i] < 0 || sa[i] >= len_seq_ || rank[sa[i]] >= 0) return report("not a permutation", i);
+                    rank[sa[i]] = i;
+                }
+                isa = rank;
+            }
+            else
+            {
+                for (Index i = 0; i < len_seq_; i++)
+                {
+                    if (sa[i] < 0 || sa[i] >= len_seq_ || isa[sa[i]] != i) return report("not a permutation", i);
+                }
+            }
+            auto next_rank = [&](const Index pos) { return (pos + 1 < len_seq_) ? isa[pos + 1] : -1; };
+            for (Index i = 0; i + 1 < len_seq_; i++)
+            {
+                int c1 = code_at(sa[i]);
+                int c2 = code_at(sa[i + 1]);
+                if (c1 > c2 || (c1 == c2 && next_rank(sa[i]) > next_rank(sa[i + 1]))) return report("unsorted", i);
+            }
+            return true;
+        }
+
+        // 整数の列text[0, n) (各値は[0, num_alphabet))のsuffix arrayをsaにSA-ISで求める
+        // GeneralizedSuffixArray.cppのように、区切り文字ごとに別の値を割り当てた列を並べるときに使う
+        static void sort_integer_text(const Index * text, Index * sa, const Index n, const Index num_alphabet) { induced_sort(text, sa, n, num_alphabet); }
+
+        void set_engine(const SuffixSortEngine engine) { engine_ = engine; }
+        // 2以上ならDOUBLINGの各ラウンドのグループの分割と、最初のソートをスレッドで分担する
+        void set_num_threads(const int num_threads)    { num_threads_ = max(1, num_threads); }
+        // trueならbuild_suffix_arrayの最後にverify_saで検査する
+        void set_verify(const bool verify)             { verify_ = verify; }
+        // DOUBLINGの最初のソートに使う先頭の文字数(4の倍数に切り上げ、32まで). 0なら長さから決め、1なら先頭の1文字だけ
+        void set_kmer_length(const int kmer_length)    { kmer_length_ = max(0, kmer_length); }
+        
+        // pack_text後は空. 詰めたかどうかによらずget_charで1文字ずつ読める
+        string &         get_seq()               { return seq_; }
+        Index            get_seq_len()           { return len_seq_; }
+        // load_index後はmmapした領域を指す. 保存しなかったisa_は空
+        span<Index>      get_sa()                { return mapped_.is_open() ? sa_view_ : span<Index>(sa_); }
+        span<Index>      get_isa()               { return mapped_.is_open() ? isa_view_ : span<Index>(isa_); }
+        // load_indexで読んだLCP配列(なければ空)
+        span<Index>      get_lcp()               { return lcp_view_; }
+        // load_fastaで読んだ各配列の見出しと、文字列での開始位置
+        vector<pair<string, Index>> & get_records() { return records_; }
+        Index            get_num_replaced()      { return num_replaced_; }
+        // build_suffix_array_externalでsuffixをファイルへ振り分けた回数
+        int              get_num_passes()        { return num_passes_; }
+        vector<char> &   get_alphabet()          { return alphabet_; }
+        // 文字からalphabet_の番号への表(alphabet_にない文字は0番として扱う)
+        array<int, 256> & get_code_table()       { return code_; }
+        // 直前のbuild_suffix_arrayで見つけたalphabet_にない文字の数
+        Index            get_num_invalid_bases() { return num_invalid_bases_; }
+        Index            get_num_sorted_groups() { return num_sorted_groups_.load(); }
+        Index            get_num_order()         { return num_order_; }
+        SuffixSortEngine get_engine()            { return engine_; }
+        int              get_num_threads()       { return num_threads_; }
+        int              get_kmer_length()       { return kmer_length_; }
+        // DOUBLINGの最初のソートだけで確定したsuffixの数(doublingのラウンドを経ずに済んだもの)
+        Index            get_num_initial_sorted_groups() { return num_initial_sorted_groups_; }
+        bool             is_packed() const       { return is_packed_; }
+        // 詰めた文字列での'$'の位置(なければ-1)
+        Index            get_sentinel_pos() const { return sentinel_pos_; }
+        char             get_char(const Index i) const
+        {
+            if (!is_packed_) return seq_[i];
+            return (i == sentinel_pos_) ? '$' : "ACGT"[packed_base(i)];
+        }
+
+    private:
+        string           seq_ {""};                             // suffix arrayを構築する対象文字列(pack_text後は空)
+        Index            len_seq_ {0};                          // seq_の長さ
+        vector<Index>    sa_;                                   // suffix array
+        vector<Index>    isa_;                                  // inverse suffix array
+        vector<char>     alphabet_ = {'$', 'A', 'C', 'G', 'T'}; // アルファベット(デフォルトはDNAの4塩基と'$')
+        array<int, 256>  code_ {};                              // 文字からalphabet_の番号への表(ない文字は0番)
+        Index            num_invalid_bases_ {0};                // alphabet_にない文字の数
+        bool             is_packed_ {false};                    // 文字列をpacked_に詰めたか
+        vector<uint64_t> packed_;                               // i文字目の塩基(A, C, G, Tが0-3)はpacked_[i / 32]のビット2(i % 32)から
+        span<const uint64_t> packed_words_;                     // 詰めた文字列(packed_かmmapした領域). 読むときはこちらを使う
+        Index            sentinel_pos_ {-1};                    // packed_で'$'のある位置(packed_にはAとして置く)
+        MappedFile       mapped_;                               // load_indexでmmapしたファイル
+        span<Index>      sa_view_;                              // mapped_の中のsa
+        span<Index>      isa_view_;
+        span<Index>      lcp_view_;
+        vector<pair<string, Index>> records_;                   // load_fastaで読んだ(見出し, 開始位置)
+        Index            num_replaced_ {0};                     // load_fastaでalphabet_[1]に置き換えた文字の数
+        int              num_passes_ {0};                       // build_suffix_array_externalで振り分けた回数
+
+        static constexpr size_t MIN_BUCKET_CAPACITY = 1 << 16;
+        static constexpr int    MAX_SCRATCH_FILES = 64;      // 1回の振り分けで同時に書くファイルの数
+        static constexpr size_t SCRATCH_BUFFER = 1 << 14;    // ファイルごとの書き込みバッファの要素数
+
+        // build_suffix_array_externalの設定と状態
+        struct ExternalSort
+        {
+            string            scratch_dir_;
+            int               bits_per_char_;    // キーの1文字のビット数
+            int               chars_per_key_;    // 64bitのキーに入る文字数
+            int               prefix_len_;       // バケツに分ける文字数
+            size_t            capacity_;         // メモリに置くバケツの要素数の上限
+            IndexFileWriter * writer_;
+            int               num_files_ {0};    // scratchファイルの名前に使う通し番号
+            int               num_passes_ {0};
+            vector<string>    files_;            // 作ったscratchファイル. 途中で失敗しても残さないよう、最後に全て消す
+
+            ExternalSort() = default;
+            ExternalSort(const ExternalSort &) = delete;
+            ExternalSort & operator=(const ExternalSort &) = delete;
+            ~ExternalSort()
+            {
+                for (const string & path : files_) remove_file(path);
+            }
+
+            string new_file()
+            {
+                files_.push_back((filesystem::path(scratch_dir_) / ("sals_" + to_string(getpid()) + "_" + to_string(num_files_++) + ".tmp")).string());
+                return files_.back();
+            }
+
+            void remove_file(const string & path)
+            {
+                error_code ec;
+                if (!path.empty()) filesystem::remove(path, ec);
+            }
+        };
+        atomic<Index>    num_sorted_groups_ {0};                // ソート済みグループの数(最初のソートで確定したものを含む)
+        Index            num_order_ {0};                        // h-order(最初のソートの文字数kから始まる)
+        Index            num_initial_sorted_groups_ {0};        // 最初のソートで確定したグループの数
+        mt19937          rng_;                                  // 乱数生成器
+        SuffixSortEngine engine_ {SuffixSortEngine::DOUBLING};  // 構築方法
+        bool             verify_ {false};                       // 構築後にverify_saで検査するか
+        int              num_threads_ {1};                      // 構築に使うスレッド数
+        vector<Index>    keys_;                                 // 並列時のh-orderのキー(sa_と同じ添字). 構築中だけ持つ
+        int              kmer_length_ {0};                      // 最初のソートの文字数(0なら自動)
+
+        static constexpr Index INSERTION_SORT_MAX = 16;  // これ以下の区間は挿入ソート
+        static constexpr Index COUNTING_SORT_MIN = 64;   // これ以上でキーの幅が要素数以下の区間は数え上げソート
+        static constexpr Index PREFETCH_DISTANCE = 16;   // キーを読むときに先読みする距離
+
+        // sort_groupの作業領域. parallel_forのworker番号ごとに1つ持ち、大きくなったまま構築の終わりまで使い回すので、
+        // doublingのラウンドの中では(各workerが最大のグループを1度見た後は)ヒープを使わない
+        struct SortScratch
+        {
+            vector<Index>         keys_;     // 1スレッドのときのグループのキー
+            vector<Index>         sa_;       // 数え上げソートの書き込み先
+            vector<Index>         tmp_keys_;
+            vector<Index>         counts_;
+            vector<array<Index, 3>> tasks_;  // 再帰の代わりのスタック(lo, hi, SORTかSETTLE)
+        };
+        vector<SortScratch> sort_scratches_;                    // worker番号ごとのsort_groupの作業領域. 構築中だけ持つ
+        vector<mt19937>     pivot_rngs_;                        // worker番号ごとのピボットの乱数. rng_から種を取るので再現できる
+
+        int packed_base(const Index i) const { return (packed_words_[i / 32] >> (2 * (i % 32))) & 3; }
+
+        // i文字目のalphabet_の番号. 詰めた文字列でも詰めていない文字列でも使える
+        int code_at(const Index i) const
+        {
+            if (is_packed_) return (i == sentinel_pos_) ? 0 : 1 + packed_base(i);
+            return code_[static_cast<unsigned char>(seq_[i])];
+        }
+
+        void build_by_doubling()
+        {
+            sort_scratches_.assign(num_threads_, SortScratch {});
+            pivot_rngs_.clear();
+            for (int t = 0; t < num_threads_; t++) pivot_rngs_.emplace_back(rng_());
             init_sa_and_isa();
-            num_order_ = 1;
+            num_initial_sorted_groups_ = num_sorted_groups_.load();
 
-            while (num_sorted_groups_ < len_seq_ && num_order_ <= len_seq_) 
-            // 2番目の条件がないとsa_[len_seq_ - 1] = 0のときに無限ループ(例: seq="TGGGCCCCA$")
+            // sa_全体が1つのソート済み区間になるまでh-orderを倍にする
+            // 1スレッドなら見つけたグループをすぐ分割する(更新したisa_が同じラウンドの後のグループのキーにも効く)
+            // 並列ならラウンド内の未ソートのグループを集めてからまとめて分割する
+            vector<pair<Index, Index>> groups;
+            while (len_seq_ > 0 && sa_[0] > -len_seq_)
             {
-                // h-orderのソート済みグループを見つける
-                int left_idx = 0; // unsorted groupの左端
+                groups.clear();
+                Index left_idx = 0;   // 見ているグループの左端
+                Index sorted_len = 0; // left_idxの直前まで続くソート済み区間の長さ(負)
                 while (left_idx < len_seq_)
                 {
-                    if (sa_[left_idx] < 0) { left_idx++; continue; }
-
-                    int right_idx = left_idx;
-                    while (right_idx < (len_seq_ - 1) 
-                        && isa_[abs(sa_[right_idx + 1])] == isa_[abs(sa_[left_idx])]) 
+                    if (sa_[left_idx] < 0)
                     {
-                        right_idx++;
+                        // ソート済み区間は読み飛ばし、隣り合うものはまとめる
+                        sorted_len += sa_[left_idx];
+                        left_idx -= sa_[left_idx];
+                        continue;
                     }
-
-                    // ソート済みグループのisa_とsa_を更新
-                    ternary_split_quick_sort(left_idx, right_idx);
-                    update_isa_and_sa(left_idx, right_idx);
+                    if (sorted_len < 0)
+                    {
+                        sa_[left_idx + sorted_len] = sorted_len;
+                        sorted_len = 0;
+                    }
+                    // グループ番号はグループの最後の位置
+                    Index right_idx = isa_[sa_[left_idx]];
+                    if (num_threads_ == 1) split_group(left_idx, right_idx);
+                    else                   groups.emplace_back(left_idx, right_idx);
                     left_idx = right_idx + 1;
                 }
+                if (sorted_len < 0) sa_[left_idx + sorted_len] = sorted_len;
+                if (!groups.empty()) split_groups_in_parallel(groups);
                 num_order_ *= 2;
             }
-            
-            // sa_の要素は全て負なので-1倍して元に戻す
-            for (int i = 0; i < len_seq_; i++)
+            vector<Index>().swap(keys_);
+            vector<SortScratch>().swap(sort_scratches_);
+            vector<mt19937>().swap(pivot_rngs_);
+
+            // isa_は各suffixの最終的な位置になっているので、そこからsa_を作り直す
+            parallel_for(len_seq_, 1 << 16, [this](const Index lo, const Index hi)
+            {
+                for (Index i = lo; i < hi; i++) sa_[isa_[i]] = i;
+            });
+        }
+
+        // groupsの各グループ[left, right]を並列に分割する
+        // 先に全グループのキーをkeys_に写してから(ここだけ全スレッドで同期)分割するので、
+        // 分割中の各スレッドは自分のグループの範囲のsa_, keys_と、そのsuffixのisa_にしか触れない
+        void split_groups_in_parallel(const vector<pair<Index, Index>> & groups)
+        {
+            Index num_groups = groups.size();
+            Index grain = max<Index>(1, num_groups / (num_threads_ * 64));
+            keys_.resize(len_seq_);
+            parallel_for(num_groups, grain, [this, &groups](const Index lo, const Index hi)
+            {
+                for (Index g = lo; g < hi; g++) load_keys(groups[g].first, groups[g].second, keys_.data() + groups[g].first);
+            });
+            parallel_for(num_groups, grain, [this, &groups](const Index lo, const Index hi, const int worker)
             {
-                if (sa_[i] < 0) sa_[i] *= -1;
+                for (Index g = lo; g < hi; g++) sort_group(groups[g].first, groups[g].second, keys_.data() + groups[g].first, worker);
+            });
+        }
+
+        // 1スレッドのとき、見つけたグループのキーを使い回す作業領域に写してから分割する
+        void split_group(const Index left_idx, const Index right_idx)
+        {
+            if (left_idx == right_idx)
+            {
+                update_isa_and_sa(left_idx, right_idx);
+                return;
             }
-            is_valid_sa();
+            vector<Index> & keys = sort_scratches_[0].keys_;
+            if (static_cast<Index>(keys.size()) < right_idx - left_idx + 1) keys.resize(right_idx - left_idx + 1);
+            load_keys(left_idx, right_idx, keys.data());
+            sort_group(left_idx, right_idx, keys.data(), 0);
+        }
+
+        // keys[i]にsa_[left_idx + i]のh-orderのキーを読む. isa_はランダムに読むので先読みする
+        void load_keys(const Index left_idx, const Index right_idx, Index * keys) const
+        {
+            for (Index i = left_idx; i <= right_idx; i++)
+            {
+                if (i + PREFETCH_DISTANCE <= right_idx)
+                {
+                    Index ahead = sa_[i + PREFETCH_DISTANCE] + num_order_;
+                    if (ahead < len_seq_) __builtin_prefetch(&isa_[ahead]);
+                }
+                keys[i - left_idx] = sort_key(sa_[i]);
+            }
+        }
+
+        // [0, count)をgrain個ずつに分け、num_threads_本のスレッドが空いた順に取ってfunc(lo, hi)を呼ぶ
+        // funcが3つ目の引数を取るならworker番号(呼び出したスレッドが0、作ったスレッドが1, 2, ...)も渡す
+        // ラウンドごとに数回しか呼ばないので、スレッドはその都度作る(スレッドごとの状態はworker番号で引くメンバに持つ)
+        template <class Func>
+        void parallel_for(const Index count, const Index grain, const Func & func)
+        {
+            auto call = [&func](const Index lo, const Index hi, const int worker)
+            {
+                if constexpr (is_invocable_v<const Func &, Index, Index, int>) func(lo, hi, worker);
+                else                                                          func(lo, hi);
+            };
+            if (num_threads_ == 1 || count <= grain)
+            {
+                call(0, count, 0);
+                return;
+            }
+            atomic<Index> next {0};
+            auto work = [&](const int worker)
+            {
+                while (true)
+                {
+                    Index lo = next.fetch_add(grain);
+                    if (lo >= count) return;
+                    call(lo, min(count, lo + grain), worker);
+                }
+            };
+            vector<thread> threads;
+            for (int t = 1; t < num_threads_; t++) threads.emplace_back(work, t);
+            work(0);
+            for (auto & t : threads) t.join();
+        }
+
+        // 文字をalphabet_の番号にした列をisa_に置き(作業領域として使う)、SA-ISでsa_を求めてからisa_を作る
+        void build_by_induced_sorting()
+        {
+            for (Index i = 0; i < len_seq_; i++) isa_[i] = code_at(i);
+            induced_sort(isa_.data(), sa_.data(), len_seq_, alphabet_.size());
+            for (Index i = 0; i < len_seq_; i++) isa_[sa_[i]] = i;
+            num_sorted_groups_ = len_seq_;
+        }
+
+        // SA-IS: text[0, n) (各値は[0, num_alphabet))のsuffix arrayをsaに求める
+        // text[n]に他のどの文字より小さい仮想的な番兵があるものとして扱うので、'$'で終わらない文字列にも使える
+        // 縮約した文字列はsaの後半に、その答えはsaの前半に置いて再帰する
+        static void induced_sort(const Index * text, Index * sa, const Index n, const Index num_alphabet)
+        {
+            if (n == 0) return;
+            if (n == 1)
+            {
+                sa[0] = 0;
+                return;
+            }
+
+            // suffix iがS型(suffix i + 1より小さい)ならis_s[i] = 1. 仮想的な番兵があるのでn - 1はL型
+            vector<uint8_t> is_s(n, 0);
+            for (Index i = n - 2; i >= 0; i--) is_s[i] = text[i] < text[i + 1] || (text[i] == text[i + 1] && is_s[i + 1]);
+            auto is_lms = [&is_s](const Index i) { return i > 0 && is_s[i] && !is_s[i - 1]; };
+
+            // 文字cのバケツはsa[bucket[c], bucket[c + 1])
+            vector<Index> bucket(num_alphabet + 1, 0);
+            for (Index i = 0; i < n; i++) bucket[text[i] + 1]++;
+            for (Index c = 0; c < num_alphabet; c++) bucket[c + 1] += bucket[c];
+            vector<Index> pos(num_alphabet);
+            auto set_bucket_ends = [&] { for (Index c = 0; c < num_alphabet; c++) pos[c] = bucket[c + 1]; };
+
+            // saに置いたLMS suffixから、L型を前から、S型を後ろから順に並べる
+            auto induce = [&]
+            {
+                for (Index c = 0; c < num_alphabet; c++) pos[c] = bucket[c];
+                sa[pos[text[n - 1]]++] = n - 1;
+                for (Index i = 0; i < n; i++)
+                {
+                    Index j = sa[i] - 1;
+                    if (j >= 0 && !is_s[j]) sa[pos[text[j]]++] = j;
+                }
+                set_bucket_ends();
+                for (Index i = n - 1; i >= 0; i--)
+                {
+                    Index j = sa[i] - 1;
+                    if (j >= 0 && is_s[j]) sa[--pos[text[j]]] = j;
+                }
+            };
+
+            // LMS部分文字列をソートする
+            fill(sa, sa + n, -1);
+            set_bucket_ends();
+            for (Index i = n - 1; i >= 1; i--)
+            {
+                if (is_lms(i)) sa[--pos[text[i]]] = i;
+            }
+            induce();
+
+            // ソートされたLMS部分文字列をsaの先頭に詰め、同じものに同じ名前を付ける
+            // LMSの位置は2以上離れているので、位置pの名前はsa[num_lms + p / 2]に置ける
+            Index num_lms = 0;
+            for (Index i = 0; i < n; i++)
+            {
+                if (is_lms(sa[i])) sa[num_lms++] = sa[i];
+            }
+            fill(sa + num_lms, sa + n, -1);
+            Index num_names = 0;
+            Index prev = -1;
+            for (Index i = 0; i < num_lms; i++)
+            {
+                Index p = sa[i];
+                bool is_new = prev < 0;
+                for (Index d = 0; !is_new; d++)
+                {
+                    if (p + d == n || prev + d == n || text[p + d] != text[prev + d] || is_s[p + d] != is_s[prev + d])
+                    {
+                        is_new = true;
+                    }
+                    else if (d > 0 && (is_lms(p + d) || is_lms(prev + d)))
+                    {
+                        is_new = !(is_lms(p + d) && is_lms(prev + d));
+                        break;
+                    }
+                }
+                if (is_new)
+                {
+                    num_names++;
+                    prev = p;
+                }
+                sa[num_lms + p / 2] = num_names - 1;
+            }
+
+            // 名前を位置の順にsaの末尾へ詰めて縮約した文字列にし、そのsuffix arrayをsaの先頭に求める
+            for (Index i = n - 1, j = n - 1; i >= num_lms; i--)
+            {
+                if (sa[i] >= 0) sa[j--] = sa[i];
+            }
+            Index * reduced = sa + n - num_lms;
+            if (num_names < num_lms) induced_sort(reduced, sa, num_lms, num_names);
+            else
+            {
+                for (Index i = 0; i < num_lms; i++) sa[reduced[i]] = i;
+            }
+
+            // 縮約した文字列の順をLMS suffixの順に戻し、バケツの末尾に置き直して全体を並べる
+            for (Index i = 1, j = 0; i < n; i++)
+            {
+                if (is_lms(i)) reduced[j++] = i;
+            }
+            for (Index i = 0; i < num_lms; i++) sa[i] = reduced[sa[i]];
+            fill(sa + num_lms, sa + n, -1);
+            set_bucket_ends();
+            for (Index i = num_lms - 1; i >= 0; i--)
+            {
+                Index j = sa[i];
+                sa[i] = -1;
+                sa[--pos[text[j]]] = j;
+            }
+            induce();
         }
-        
-        string &         get_seq()               { return seq_; }
-        int              get_seq_len()           { return len_seq_; }
-        vector<int> &    get_sa()                { return sa_; }
-        vector<int> &    get_isa()               { return isa_; }
-        vector<char> &   get_alphabet()          { return alphabet_; }
-        map<char, int> & get_alphabet_map()      { return alphabet_map_; }
-        int              get_num_sorted_groups() { return num_sorted_groups_; }
-        int              get_num_order()         { return num_order_; }
 
-    private:
-        string         seq_ {""};                             // suffix arrayを構築する対象文字列
-        int            len_seq_ {0};                          // seq_の長さ
-        vector<int>    sa_;                                   // suffix array
-        vector<int>    isa_;                                  // inverse suffix array
-        vector<char>   alphabet_ = {'$', 'A', 'C', 'G', 'T'}; // アルファベット(デフォルトはDNAの4塩基と'$')
-        map<char, int> alphabet_map_;                         // アルファベットを整数に対応させるmap
-        int            num_sorted_groups_ {0};                // ソート済みグループの数
-        int            num_order_ {0};                        // h-order
-        mt19937        rng_;                                  // 乱数生成器
-        
         void init_rng()
         {
             random_device seed_gen;
@@ -94,161 +928,692 @@ struct SaLs
         void gen_random_seq()
         {
             uniform_int_distribution<int> d(1, alphabet_.size() - 1);
-            for (int i = 0; i < len_seq_; i++)
+            for (Index i = 0; i < len_seq_; i++)
             {
                 if (i < len_seq_ - 1) seq_.push_back(alphabet_[d(rng_)]);
                 else seq_.push_back(alphabet_[0]); // 最後の1文字だけが'$'
             }
         }
 
-        // アルファベットを整数に対応させるマップの作成
+        // 文字からalphabet_の番号への256要素の表の作成
         void create_alphabet_map()
         {
-            for (int i = 0; i < alphabet_.size(); i++) alphabet_map_[alphabet_[i]] = i;
+            code_.fill(0);
+            for (int i = 0; i < static_cast<int>(alphabet_.size()); i++) code_[static_cast<unsigned char>(alphabet_[i])] = i;
+        }
+
+        // alphabet_にない文字(N, 小文字, IUPACの曖昧な塩基など)を数え、文字ごとの数と最初の位置をcerrに報告する
+        // それらは0番(alphabet_[0])として扱われる. 詰めた文字列にはないので調べない
+        void report_invalid_bases()
+        {
+            num_invalid_bases_ = 0;
+            if (is_packed_) return;
+            array<bool, 256> valid {};
+            for (char c : alphabet_) valid[static_cast<unsigned char>(c)] = true;
+            array<Index, 256> counts {};
+            for (Index i = 0; i < len_seq_; i++) counts[static_cast<unsigned char>(seq_[i])] += !valid[static_cast<unsigned char>(seq_[i])];
+            for (int c = 0; c < 256; c++)
+            {
+                if (counts[c] == 0) continue;
+                num_invalid_bases_ += counts[c];
+                Index first = seq_.find(static_cast<char>(c));
+                cerr << "Invalid base '" << static_cast<char>(c) << "' x " << counts[c] << " (first at " << first << ")\n";
+            }
+        }
+
+        // sa_[left_idx, right_idx]を1つのグループとし、グループ番号right_idxをisa_にその場で書き込む
+        // 要素が1つならソート済みとしてsa_に-1を置く
+        void update_isa_and_sa(const Index left_idx, const Index right_idx)
+        {
+            for (Index i = left_idx; i <= right_idx; i++) isa_[sa_[i]] = right_idx;
+            if (left_idx == right_idx)
+            {
+                sa_[left_idx] = -1;
+                num_sorted_groups_.fetch_add(1, memory_order_relaxed);
+            }
+        }
+
+        // suffix posのh-orderのソートキー. 文字列の末尾を越えたら最小
+        Index sort_key(const Index pos) const
+        {
+            return (pos + num_order_ < len_seq_) ? isa_[pos + num_order_] : -1;
         }
 
-        void update_isa_and_sa(const int left_idx, const int right_idx)
+        // 先頭のk文字でsa_を初期化し、先頭k文字が同じsuffixを1つのグループとしてnum_order_ = kから始める
+        // DNAのように'$'以外の文字が4種類以下で'$'が末尾だけなら、k文字を2bitずつ詰めたキーで基数ソートする
+        // (それ以外はk = 1で、先頭の1文字のcounting sort)
+        // 文字はcode_atで読むので、詰めた文字列でもそのまま使える
+        void init_sa_and_isa()
         {
-            // update中に更新したisa_を参照するとうまくいかない(例: "GGGGGATTTCTTTCTTCTCAACGGGTACC$")
-            vector<int> tmp_isa = isa_;
+            int k = choose_kmer_length();
+            if (k == 1) init_by_first_char();
+            else        init_by_kmer(k);
+            num_order_ = k;
+        }
 
-            // 代表元を決定してtmp_isaを更新
-            int rep_idx = right_idx; // グループの代表元
-            for (int i = right_idx; i >= left_idx; i--)
+        // 2bitに詰められないとき、または長さ4以下の文字列では1
+        int choose_kmer_length() const
+        {
+            if (kmer_length_ == 1 || alphabet_.size() > 5 || len_seq_ <= 4) return 1;
+            if (code_at(len_seq_ - 1) != 0) return 1;
+            if (is_packed_)
             {
-                if (num_order_ == 0) // 0-orderのときはisa_がセットされていないのでseq_を参照
+                if (sentinel_pos_ != len_seq_ - 1) return 1;
+            }
+            else
+            {
+                for (Index i = 0; i < len_seq_ - 1; i++)
                 {
-                    if (seq_[sa_[i]] != seq_[sa_[rep_idx]])
-                    {
-                        rep_idx = i; // 異なるグループが来たら代表元を更新
-                    }
+                    if (code_at(i) == 0) return 1;
                 }
-                else
+            }
+            if (kmer_length_ > 0) return min(32, (kmer_length_ + 3) / 4 * 4);
+            // 自動なら4^k >= len_seq_となる最小の4の倍数より4文字長くし、ランダムな部分のほとんどをここで確定させる
+            int k = 4;
+            while ((1LL << (2 * k)) < len_seq_) k += 4;
+            return min(32, k + 4);
+        }
+
+        void init_by_first_char()
+        {
+            int num_alphabet = alphabet_.size();
+            auto digit = [this](const Index i) { return code_at(i); };
+            vector<Index> bucket_end;
+            counting_sort_pass(nullptr, sa_.data(), num_alphabet, digit, bucket_end);
+
+            // isa_にはバケツの最後の位置をグループ番号として入れる
+            parallel_for(len_seq_, 1 << 16, [&](const Index lo, const Index hi)
+            {
+                for (Index i = lo; i < hi; i++) isa_[i] = bucket_end[code_at(i)] - 1;
+            });
+
+            // 要素が1つのバケツはソート済み
+            for (int c = 0; c < num_alphabet; c++)
+            {
+                Index bucket_begin = (c == 0) ? 0 : bucket_end[c - 1];
+                if (bucket_end[c] - bucket_begin == 1) update_isa_and_sa(bucket_begin, bucket_begin);
+            }
+        }
+
+        // 先頭k文字(kは4の倍数)を2bitずつ詰めた2k bitのキーで、4文字(1バイト)ずつLSD基数ソートする
+        // quad[j]はj文字目からの4文字を詰めたもので、'$'と末尾より後ろは最小の0として詰める
+        // 窓に'$'が入るsuffix(末尾のk個)は詰めたキーが他と等しくても真に小さく、短いほど小さいので、
+        // 最初に短い順に並べておけば安定な基数ソートでその順になる. それぞれ1つでソート済みのグループにする
+        // isa_は基数ソートの作業領域として使う
+        // 詰めた文字列('$'はAとして詰めてあり、末尾より後ろも0)ではquadを作らず、packed_から8bitを切り出して並びを逆にする
+        void init_by_kmer(const int k)
+        {
+            Index num_tails = min<Index>(k, len_seq_);
+            Index num_heads = len_seq_ - num_tails;
+            vector<uint8_t> quad;
+            array<uint8_t, 256> reversed {}; // 2bitずつの並びを逆にした値
+            if (is_packed_)
+            {
+                for (int v = 0; v < 256; v++) reversed[v] = (v & 3) << 6 | (v >> 2 & 3) << 4 | (v >> 4 & 3) << 2 | v >> 6;
+            }
+            else
+            {
+                auto base_at = [this](const Index j) { return (j < len_seq_ - 1) ? code_at(j) - 1 : 0; };
+                quad.resize(len_seq_);
+                parallel_for(len_seq_, 1 << 16, [&](const Index lo, const Index hi)
                 {
-                    if (isa_[abs(sa_[i]) + num_order_] != isa_[abs(sa_[rep_idx]) + num_order_]) 
-                    {
-                        rep_idx = i;
-                    }
-                }
-                tmp_isa[abs(sa_[i])] = rep_idx;
+                    for (Index j = lo; j < hi; j++) quad[j] = base_at(j) << 6 | base_at(j + 1) << 4 | base_at(j + 2) << 2 | base_at(j + 3);
+                });
             }
-            
-            // sa_[i]がsorted groupなら-1倍して目印とし、ソート済みグループの数を更新する
-            for (int i = left_idx; i <= right_idx; i++)
+            auto quad_at = [&](const Index j) -> int
+            {
+                if (!is_packed_) return quad[j];
+                int shift = 2 * (j % 32);
+                uint64_t bits = packed_words_[j / 32] >> shift;
+                if (shift > 56 && j / 32 + 1 < static_cast<Index>(packed_words_.size())) bits |= packed_words_[j / 32 + 1] << (64 - shift);
+                return reversed[bits & 0xFF];
+            };
+
+            for (Index x = 0; x < num_tails; x++) isa_[x] = len_seq_ - 1 - x;
+            for (Index i = 0; i < num_heads; i++) isa_[num_tails + i] = i;
+            vector<Index> bucket_end;
+            for (int offset = k - 4; offset >= 0; offset -= 4)
             {
-                bool is_sorted = false;
-                if (i == left_idx)
+                auto digit = [this, &quad_at, offset](const Index i) { return (i + offset < len_seq_) ? quad_at(i + offset) : 0; };
+                counting_sort_pass(isa_.data(), sa_.data(), 256, digit, bucket_end);
+                swap(sa_, isa_);
+            }
+            swap(sa_, isa_);
+
+            // 後ろから見て、隣と先頭k文字が違うところでグループを切る. 切ったときに右のグループが1つならソート済み
+            auto same_kmer = [&](const Index a, const Index b)
+            {
+                if (a >= num_heads || b >= num_heads) return false;
+                for (int offset = 0; offset < k; offset += 4)
                 {
-                    if (isa_[abs(sa_[i])] != isa_[abs(sa_[i + 1])]) is_sorted = true;
+                    if (quad_at(a + offset) != quad_at(b + offset)) return false;
                 }
-                else if (i == right_idx)
+                return true;
+            };
+            Index group_end = len_seq_ - 1;
+            for (Index x = len_seq_ - 1; x >= 0; x--)
+            {
+                if (x < len_seq_ - 1 && !same_kmer(sa_[x], sa_[x + 1]))
                 {
-                    if (isa_[abs(sa_[i])] != isa_[abs(sa_[i - 1])]) is_sorted = true;
+                    if (group_end == x + 1) update_isa_and_sa(x + 1, x + 1);
+                    group_end = x;
                 }
-                else
+                isa_[sa_[x]] = group_end;
+            }
+            if (group_end == 0) update_isa_and_sa(0, 0);
+        }
+
+        // srcに並んだsuffix(nullptrなら0, 1, ..., len_seq_ - 1)を、digit(suffix)(0以上num_buckets未満)の順に安定にdstへ並べる
+        // srcをスレッド数のブロックに分け、ブロックごとに数えてから、値の順・同じ値はブロックの順に書き込む
+        // bucket_end[v]は値vのバケツの終わり
+        template <class Digit>
+        void counting_sort_pass(const Index * src, Index * dst, const int num_buckets, const Digit & digit, vector<Index> & bucket_end)
+        {
+            int num_blocks = num_threads_;
+            auto block_begin = [this, num_blocks](const int b) { return static_cast<Index>(static_cast<long long>(len_seq_) * b / num_blocks); };
+            auto suffix_at = [src](const Index x) { return src ? src[x] : x; };
+            vector<vector<Index>> cnt(num_blocks, vector<Index>(num_buckets, 0));
+
+            // 各ブロックで各値の出現回数を数える
+            parallel_for(num_blocks, 1, [&](const int lo, const int hi)
+            {
+                for (int b = lo; b < hi; b++)
                 {
-                    if (isa_[abs(sa_[i])] != isa_[abs(sa_[i + 1])] && 
-                        isa_[abs(sa_[i])] != isa_[abs(sa_[i - 1])]) is_sorted = true;
+                    for (Index x = block_begin(b); x < block_begin(b + 1); x++) cnt[b][digit(suffix_at(x))]++;
                 }
-                if (is_sorted)
+            });
+
+            // 累積和に変換し、各ブロックの各値の書き込み開始位置にする
+            bucket_end.assign(num_buckets, 0);
+            Index sum = 0;
+            for (int v = 0; v < num_buckets; v++)
+            {
+                for (int b = 0; b < num_blocks; b++)
                 {
-                    sa_[i] *= -1;
-                    num_sorted_groups_++;
+                    Index c = cnt[b][v];
+                    cnt[b][v] = sum;
+                    sum += c;
                 }
+                bucket_end[v] = sum;
             }
 
-            // 更新したisaを反映
-            isa_ = tmp_isa;
+            parallel_for(num_blocks, 1, [&](const int lo, const int hi)
+            {
+                for (int b = lo; b < hi; b++)
+                {
+                    for (Index x = block_begin(b); x < block_begin(b + 1); x++)
+                    {
+                        Index suffix = suffix_at(x);
+                        dst[cnt[b][digit(suffix)]++] = suffix;
+                    }
+                }
+            });
         }
 
-        void init_sa_and_isa()
+        // sa_[left_idx, right_idx]をkeys(keys[i]はsa_[left_idx + i]のh-orderのキー)で並べ、
+        // キーの小さい部分から順にグループ番号(update_isa_and_sa)をその場で更新する
+        // 分割し終えた部分グループの番号は細分前の番号以下で、2h-orderと矛盾しないので、
+        // 同じラウンドの後のグループがそれをキーとして読んでもよい(Larsson-Sadakane)
+        // Bentley-McIlroyの3分割で、小さい部分、等しい部分の確定、大きい部分の順の仕事をスタックに積んで再帰しない
+        // 小さい区間は挿入ソート、キーの幅が狭い区間は数え上げソートで並べ、等しいキーの並びごとに確定させる
+        // Reference: Jon L. Bentley and M. Douglas McIlroy. "Engineering a Sort Function" Software: Practice and Experience, 23(11) (1993): 1249-1265.
+        void sort_group(const Index left_idx, const Index right_idx, Index * keys, const int worker)
         {
-            int num_alphabet = alphabet_.size();
-            vector<int> cnt_alphabet(num_alphabet, 0);
+            enum { SORT, SETTLE };
+            Index * sa = sa_.data() + left_idx;
+            SortScratch & scratch = sort_scratches_[worker];
+            mt19937 & rng = pivot_rngs_[worker];
+            auto & tasks = scratch.tasks_;
+            tasks.clear();
+            tasks.push_back({0, right_idx - left_idx, SORT});
+            auto swap_at = [sa, keys](const Index i, const Index j)
+            {
+                swap(sa[i], sa[j]);
+                swap(keys[i], keys[j]);
+            };
+            // 並べ終えた[lo, hi]を、等しいキーの並びごとに左から確定させる
+            auto settle_runs = [&](const Index lo, const Index hi)
+            {
+                for (Index i = lo; i <= hi; )
+                {
+                    Index j = i;
+                    while (j < hi && keys[j + 1] == keys[i]) j++;
+                    update_isa_and_sa(left_idx + i, left_idx + j);
+                    i = j + 1;
+                }
+            };
 
-            // 各文字の出現回数を数える
-            for (int i = 0; i < len_seq_; i++) cnt_alphabet[alphabet_map_[seq_[i]]]++;
-            
-            // 累積和に変換
-            for (int i = num_alphabet - 1; i >= 0; i--)
+            while (!tasks.empty())
             {
-                if (i == num_alphabet - 1) cnt_alphabet[i] = len_seq_ - cnt_alphabet[i];
-                else                       cnt_alphabet[i] = cnt_alphabet[i + 1] - cnt_alphabet[i];
+                auto [lo, hi, task] = tasks.back();
+                tasks.pop_back();
+                if (task == SETTLE || lo == hi)
+                {
+                    update_isa_and_sa(left_idx + lo, left_idx + hi);
+                    continue;
+                }
+                Index n = hi - lo + 1;
+                if (n <= INSERTION_SORT_MAX)
+                {
+                    for (Index i = lo + 1; i <= hi; i++)
+                    {
+                        for (Index j = i; j > lo && keys[j - 1] > keys[j]; j--) swap_at(j - 1, j);
+                    }
+                    settle_runs(lo, hi);
+                    continue;
+                }
+                if (n >= COUNTING_SORT_MIN)
+                {
+                    auto [min_key, max_key] = minmax_element(keys + lo, keys + hi + 1);
+                    if (*max_key - *min_key < n)
+                    {
+                        counting_sort_range(sa + lo, keys + lo, n, *min_key, *max_key - *min_key + 1, scratch);
+                        settle_runs(lo, hi);
+                        continue;
+                    }
+                }
+
+                // 3つの無作為な位置の中央値をピボットにする
+                uniform_int_distribution<Index> d(lo, hi);
+                Index k1 = keys[d(rng)];
+                Index k2 = keys[d(rng)];
+                Index k3 = keys[d(rng)];
+                Index pivot = max(min(k1, k2), min(max(k1, k2), k3));
+
+                // [lo, a)と(d, hi]にピボットと等しいもの、[a, b)に小さいもの、(c, d]に大きいものを集め、等しいものを中央へ移す
+                Index a = lo, b = lo, c = hi, e = hi;
+                while (true)
+                {
+                    while (b <= c && keys[b] <= pivot)
+                    {
+                        if (keys[b] == pivot) swap_at(a++, b);
+                        b++;
+                    }
+                    while (b <= c && keys[c] >= pivot)
+                    {
+                        if (keys[c] == pivot) swap_at(c, e--);
+                        c--;
+                    }
+                    if (b > c) break;
+                    swap_at(b++, c--);
+                }
+                Index num_small = b - a;
+                Index num_large = e - c;
+                for (Index s = min(a - lo, num_small), i = 0; i < s; i++) swap_at(lo + i, b - s + i);
+                for (Index s = min(e - c, hi - e), i = 0; i < s; i++) swap_at(b + i, hi - s + 1 + i);
+
+                // small, equal, largeの順に確定させる(後に積んだものから取り出す)
+                if (num_large > 0) tasks.push_back({hi - num_large + 1, hi, SORT});
+                tasks.push_back({lo + num_small, hi - num_large, SETTLE});
+                if (num_small > 0) tasks.push_back({lo, lo + num_small - 1, SORT});
+            }
+        }
+
+        // sa[0, n)をkeys(min_key以上min_key + range未満)で安定に数え上げソートする
+        void counting_sort_range(Index * sa, Index * keys, const Index n, const Index min_key, const Index range, SortScratch & scratch)
+        {
+            if (static_cast<Index>(scratch.sa_.size()) < n)
+            {
+                scratch.sa_.resize(n);
+                scratch.tmp_keys_.resize(n);
+            }
+            scratch.counts_.assign(range + 1, 0);
+            Index * counts = scratch.counts_.data();
+            for (Index i = 0; i < n; i++) counts[keys[i] - min_key + 1]++;
+            for (Index v = 0; v < range; v++) counts[v + 1] += counts[v];
+            for (Index i = 0; i < n; i++)
+            {
+                Index pos = counts[keys[i] - min_key]++;
+                scratch.sa_[pos] = sa[i];
+                scratch.tmp_keys_[pos] = keys[i];
             }
+            copy(scratch.sa_.begin(), scratch.sa_.begin() + n, sa);
+            copy(scratch.tmp_keys_.begin(), scratch.tmp_keys_.begin() + n, keys);
+        }
 
-            // sa_を初期化
-            for (int i = 0; i < len_seq_; i++)
+        // 文字列の情報を書いたwriterを開き、TEXTの区間まで書く
+        bool open_index_writer(const string & path, IndexFileWriter & writer)
+        {
+            if (alphabet_.size() > SaLsIndexHeader::MAX_ALPHABET || !writer.open(path))
             {
-                int idx = alphabet_map_[seq_[i]];
-                sa_[cnt_alphabet[idx]] = i;
-                cnt_alphabet[idx]++;
+                cerr << "Cannot write " << path << "\n";
+                return false;
             }
+            SaLsIndexHeader & header = writer.header();
+            header.index_bytes_ = sizeof(Index);
+            header.len_seq_ = len_seq_;
+            header.sentinel_pos_ = sentinel_pos_;
+            header.is_packed_ = is_packed_;
+            header.num_alphabet_ = alphabet_.size();
+            copy(alphabet_.begin(), alphabet_.end(), header.alphabet_);
+            writer.begin_section(SaLsIndexHeader::TEXT);
+            if (is_packed_) writer.write(reinterpret_cast<const char *>(packed_words_.data()), packed_words_.size_bytes());
+            else            writer.write(seq_.data(), seq_.size());
+            writer.end_section();
+            return true;
+        }
 
-            // isa_を初期化してsa_を更新
-            update_isa_and_sa(0, len_seq_ - 1);
+        // pos文字目からのchars_per_key_文字を、先頭の文字が上位になるようにbits_per_char_ビットずつ詰めたキー
+        // '$'は2番目に小さい文字と同じ値にし、末尾より後ろは0にする('$'は末尾だけなので、キーが等しければ短いsuffixが小さい)
+        uint64_t external_key(const ExternalSort & sort, const Index pos) const
+        {
+            if (pos >= len_seq_) return 0;
+            if (is_packed_)
+            {
+                // 32塩基を切り出し、2bitずつの並びを逆にする
+                Index w = pos / 32;
+                int shift = 2 * (pos % 32);
+                uint64_t x = packed_words_[w] >> shift;
+                if (shift > 0 && w + 1 < static_cast<Index>(packed_words_.size())) x |= packed_words_[w + 1] << (64 - shift);
+                x = __builtin_bswap64(x);
+                x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+                return ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+            }
+            uint64_t key = 0;
+            for (int t = 0; t < sort.chars_per_key_; t++)
+            {
+                int c = (pos + t < len_seq_) ? max(code_at(pos + t) - 1, 0) : 0;
+                key = key << sort.bits_per_char_ | c;
+            }
+            return key << (64 - sort.bits_per_char_ * sort.chars_per_key_);
         }
 
-        void ternary_split_quick_sort(const int left_idx, const int right_idx)
+        // 周期periodのrunが崩れる位置(先頭からの長さrem)と、崩れた文字が周期どおりの文字より小さいか
+        // 周期が崩れずに終わるsuffixは'$'で崩れるので小さい側になる
+        struct RunCache
         {
-            if (left_idx >= right_idx) return;
-            uniform_int_distribution<> d(left_idx, right_idx);
-            int pivot = isa_[abs(sa_[d(rng_)]) + num_order_];
+            Index base {-1};     // 最後に調べたsuffix
+            Index end {-1};      // そのrunが崩れる位置
+            bool  smaller {false};
+        };
 
-            vector<int> small;
-            vector<int> equal;
-            vector<int> large;
-            for (int i = left_idx; i <= right_idx; i++)
+        // 先頭d文字(周期periodを持つ)が等しいsuffixを並べるキー
+        // 2つのsuffixは短い方のremまで等しく、その次の文字は短い方だけが周期から外れるので、
+        // 崩れた文字が小さいものはremの昇順、大きいものはremの降順に並ぶ. 前者をrem、後者を2 * len_seq_ - remとし、
+        // キーが等しいsuffixは先頭rem文字が等しい(同じrunの中のsuffixは、周期が揃っていれば同じ位置で崩れる)
+        // 先頭d文字の途中で'$'に達するsuffixは、'$'までの長さをremとして小さい側に置く
+        uint64_t run_key(const ExternalSort & sort, const Index pos, const Index d, const Index period, RunCache & cache) const
+        {
+            if (pos + d < len_seq_ - 1 && pos > cache.base && pos < cache.end && (pos - cache.base) % period == 0)
+            {
+                Index rem = cache.end - pos;
+                return cache.smaller ? rem : 2 * len_seq_ - rem;
+            }
+            Index end = min(pos + d, len_seq_ - 1);
+            while (end < len_seq_ - 1)
             {
-                int idx = abs(sa_[i]) + num_order_;
-                if      (isa_[idx] < pivot) small.push_back(sa_[i]);
-                else if (isa_[idx] > pivot) large.push_back(sa_[i]);
-                else                        equal.push_back(sa_[i]);
+                Index n = min<Index>(sort.chars_per_key_, len_seq_ - 1 - end);
+                uint64_t diff = external_key(sort, end) ^ external_key(sort, end - period);
+                Index k = (diff == 0) ? n : min<Index>(countl_zero(diff) / sort.bits_per_char_, n);
+                end += k;
+                if (k < n) break;
             }
-            
-            // sa_の更新
-            for (int i = left_idx; i <= right_idx; i++)
+            bool smaller = (end == len_seq_ - 1) || code_at(end) < code_at(end - period);
+            if (pos + d < len_seq_ - 1) cache = {pos, end, smaller};
+            Index rem = end - pos;
+            return smaller ? rem : 2 * len_seq_ - rem;
+        }
+
+        // run_keyからremを戻す
+        Index run_length(const uint64_t key) const
+        {
+            return (key < static_cast<uint64_t>(len_seq_)) ? key : 2 * len_seq_ - key;
+        }
+
+        // build_suffix_array_externalで残っているバケツ. pathのnum個のsuffixは先頭depth文字が等しく、位置の昇順に並ぶ
+        // CHARSはdepth文字目からのprefix_len_文字で分け、RUNはrun_keyを上位ビットから順に分ける
+        struct BucketTask
+        {
+            enum Kind { CHARS, RUN };
+            string   path;            // 空ならsuffix 0, 1, ..., len_seq_ - 1
+            Index    num;
+            Index    depth;
+            Kind     kind {CHARS};
+            Index    period {0};      // RUN: 先頭depth文字の周期(0なら分ける前に求める)
+            int      key_bits {0};    // RUN: run_keyの上位で等しいことが分かっているビット数
+            uint64_t key_prefix {0};  // RUN: その上位ビット
+        };
+
+        // 全suffixを辞書順にwriter_へ書く. 辞書順で前のバケツが上に来るスタックで、メモリに収まるバケツから順に片付ける
+        // 収まらないバケツはキーごとに数え、辞書順に並ぶキーを容量を超えない範囲でまとめてファイルに振り分ける
+        // 1つのprefixだけで容量を超えたバケツは、先頭の文字を伸ばす代わりにrun_keyで分ける
+        // (長い単一塩基の連続やNの領域、完全な縦列反復でも、周期が崩れる位置まで一度に進む)
+        bool sort_buckets(ExternalSort & sort)
+        {
+            int key_bits = sort.bits_per_char_ * sort.prefix_len_;          // 1回に分けるビット数
+            int run_bits = bit_width(static_cast<uint64_t>(2 * len_seq_)); // run_keyのビット数
+            vector<BucketTask> tasks(1);
+            tasks[0].num = len_seq_;
+            tasks[0].depth = 0;
+            while (!tasks.empty())
             {
-                if (i < left_idx + small.size()) 
+                BucketTask task = move(tasks.back());
+                tasks.pop_back();
+                auto for_each_suffix = [&](const auto & func)
+                {
+                    if (task.path.empty())
+                    {
+                        for (Index i = 0; i < task.num; i++) func(i);
+                        return true;
+                    }
+                    ifstream in(task.path, ios::binary);
+                    vector<Index> buffer(SCRATCH_BUFFER);
+                    for (Index done = 0; done < task.num; )
+                    {
+                        Index count = min<Index>(SCRATCH_BUFFER, task.num - done);
+                        if (!in.read(reinterpret_cast<char *>(buffer.data()), count * sizeof(Index))) return false;
+                        for (Index i = 0; i < count; i++) func(buffer[i]);
+                        done += count;
+                    }
+                    return true;
+                };
+
+                if (static_cast<size_t>(task.num) <= sort.capacity_)
+                {
+                    vector<pair<uint64_t, Index>> entries;
+                    entries.reserve(task.num);
+                    if (!for_each_suffix([&](const Index pos) { entries.emplace_back(0, pos); })) return false;
+                    sort.remove_file(task.path);
+                    sort_in_memory(sort, entries, task.depth);
+                    vector<Index> sorted(entries.size());
+                    for (size_t i = 0; i < entries.size(); i++) sorted[i] = entries[i].second;
+                    sort.writer_->write(reinterpret_cast<const char *>(sorted.data()), sorted.size() * sizeof(Index));
+                    continue;
+                }
+
+                if (task.kind == BucketTask::RUN && task.period == 0)
                 {
-                    sa_[i] = small[i - left_idx];
+                    // 先頭depth文字が本当に等しい2つのsuffixの間隔は、その文字列の周期になる
+                    Index period = task.depth, last = -1;
+                    bool ok = for_each_suffix([&](const Index pos)
+                    {
+                        if (pos + task.depth >= len_seq_) return;
+                        if (last >= 0) period = min(period, pos - last);
+                        last = pos;
+                    });
+                    if (!ok) return false;
+                    task.period = period;
                 }
-                else if (left_idx + small.size() <= i && i < left_idx + small.size() + equal.size())
+                int bits = (task.kind == BucketTask::CHARS) ? key_bits : min(key_bits, run_bits - task.key_bits);
+                RunCache cache;
+                auto key_of = [&](const Index pos) -> uint64_t
+                {
+                    if (task.kind == BucketTask::CHARS) return external_key(sort, pos + task.depth) >> (64 - bits);
+                    uint64_t key = run_key(sort, pos, task.depth, task.period, cache);
+                    return (key >> (run_bits - task.key_bits - bits)) & ((1ULL << bits) - 1);
+                };
+                // 1つのキーだけで容量を超えたバケツを、同じファイルのまま先へ進める
+                auto deeper = [&](BucketTask child, const uint64_t key)
                 {
-                    sa_[i] = equal[i - left_idx - small.size()];
+                    if (task.kind == BucketTask::CHARS)
+                    {
+                        child.kind = BucketTask::RUN;
+                        child.depth = task.depth + sort.prefix_len_;
+                        child.period = 0;
+                        child.key_bits = 0;
+                        child.key_prefix = 0;
+                        return child;
+                    }
+                    child.key_bits = task.key_bits + bits;
+                    child.key_prefix = (task.key_prefix << bits) | key;
+                    if (child.key_bits == run_bits)
+                    {
+                        child.kind = BucketTask::CHARS;
+                        child.depth = run_length(child.key_prefix);
+                    }
+                    return child;
+                };
+
+                // キーごとに数え、辞書順に並ぶキーを容量を超えない範囲でまとめる
+                vector<uint64_t> counts(1ULL << bits, 0);
+                if (!for_each_suffix([&](const Index pos) { counts[key_of(pos)]++; })) return false;
+                vector<uint64_t> first_key; // まとめたキーの最初
+                vector<Index>    group_size;
+                for (uint64_t v = 0; v < counts.size(); v++)
+                {
+                    if (counts[v] == 0) continue;
+                    if (group_size.empty() || static_cast<size_t>(group_size.back()) + counts[v] > sort.capacity_)
+                    {
+                        first_key.push_back(v);
+                        group_size.push_back(0);
+                    }
+                    group_size.back() += counts[v];
                 }
-                else 
+                vector<uint64_t>().swap(counts);
+                int num_groups = group_size.size();
+                if (num_groups == 1)
                 {
-                    sa_[i] = large[i - left_idx - small.size() - equal.size()];
+                    tasks.push_back(deeper(move(task), first_key[0]));
+                    continue;
                 }
-            }
 
-            // smallとlargeのサイズが0でないときは再帰
-            if (small.size() > 0) ternary_split_quick_sort(left_idx, left_idx + small.size() - 1);
-            if (large.size() > 0) ternary_split_quick_sort(right_idx - large.size() + 1, right_idx);
+                // MAX_SCRATCH_FILES個ずつのまとまりを、バッファに溜めて順に書き出す
+                vector<string> paths(num_groups);
+                for (int first = 0; first < num_groups; first += MAX_SCRATCH_FILES)
+                {
+                    int last = min(num_groups, first + MAX_SCRATCH_FILES);
+                    vector<ofstream>      outs(last - first);
+                    vector<vector<Index>> buffers(last - first);
+                    for (int g = first; g < last; g++)
+                    {
+                        paths[g] = sort.new_file();
+                        outs[g - first].open(paths[g], ios::binary | ios::trunc);
+                        if (!outs[g - first])
+                        {
+                            cerr << "Cannot write " << paths[g] << "\n";
+                            return false;
+                        }
+                        buffers[g - first].reserve(SCRATCH_BUFFER);
+                    }
+                    auto flush = [&](const int k)
+                    {
+                        outs[k].write(reinterpret_cast<const char *>(buffers[k].data()), buffers[k].size() * sizeof(Index));
+                        buffers[k].clear();
+                    };
+                    uint64_t lo = first_key[first];
+                    uint64_t hi = (last < num_groups) ? first_key[last] : UINT64_MAX;
+                    cache = RunCache();
+                    bool ok = for_each_suffix([&](const Index pos)
+                    {
+                        uint64_t v = key_of(pos);
+                        if (v < lo || v >= hi) return;
+                        int k = upper_bound(first_key.begin() + first, first_key.begin() + last, v) - first_key.begin() - 1 - first;
+                        buffers[k].push_back(pos);
+                        if (buffers[k].size() == SCRATCH_BUFFER) flush(k);
+                    });
+                    for (int k = 0; k < last - first; k++)
+                    {
+                        flush(k);
+                        outs[k].close();
+                        ok = ok && !outs[k].fail();
+                    }
+                    sort.num_passes_++;
+                    if (!ok) return false;
+                }
+                sort.remove_file(task.path);
+                for (int g = num_groups - 1; g >= 0; g--)
+                {
+                    BucketTask child = task;
+                    child.path = paths[g];
+                    child.num = group_size[g];
+                    tasks.push_back((static_cast<size_t>(child.num) > sort.capacity_) ? deeper(move(child), first_key[g]) : move(child));
+                }
+            }
+            return true;
         }
 
-        void is_valid_sa()
+        // 先頭depth文字が等しいentries(キー, suffix)を辞書順に並べる
+        // chars_per_key_文字ずつのキーと、'$'までの残りの長さで並べ、どちらも等しい(窓の中に'$'がない)区間は先へ進める
+        // 区間の中で最も近い2つのsuffixの間隔より先まで等しければ、それが等しい部分の周期なので、run_keyで並べ直して
+        // 周期が崩れる位置まで等しいものだけをそこから先へ進める(単一塩基の連続や縦列反復を周期1つ分ずつ進めない)
+        void sort_in_memory(const ExternalSort & sort, vector<pair<uint64_t, Index>> & entries, const Index depth) const
         {
-            for (int i = 0; i < len_seq_ - 1; i++)
+            Index width = sort.chars_per_key_;
+            vector<tuple<size_t, size_t, Index>> ranges = {{0, entries.size(), depth}}; // [lo, hi)をd文字目から並べる
+            // 先頭shared文字が等しい[i, j)を位置の順に並べ、最も近い2つの間隔がsharedより短ければrun_keyで分ける
+            auto split_run = [&](const size_t i, const size_t j, const Index shared)
+            {
+                auto first = entries.begin() + i, last = entries.begin() + j;
+                std::sort(first, last, [](const auto & a, const auto & b) { return a.second < b.second; });
+                Index period = shared;
+                for (size_t k = i + 1; k < j; k++) period = min(period, entries[k].second - entries[k - 1].second);
+                if (period == shared) return false;
+                RunCache cache;
+                for (size_t k = i; k < j; k++) entries[k].first = run_key(sort, entries[k].second, shared, period, cache);
+                std::sort(first, last);
+                for (size_t a = i; a < j; )
+                {
+                    size_t b = a + 1;
+                    while (b < j && entries[b].first == entries[a].first) b++;
+                    if (b - a > 1) ranges.emplace_back(a, b, run_length(entries[a].first));
+                    a = b;
+                }
+                return true;
+            };
+            while (!ranges.empty())
             {
-                string s1 = seq_.substr(sa_[i]);
-                string s2 = seq_.substr(sa_[i + 1]);
-                if (s1 > s2)
+                auto [lo, hi, d] = ranges.back();
+                ranges.pop_back();
+                if (hi - lo < 2) continue;
+                // 窓の中の'$'の位置(窓より前で終わっていれば負). 窓の中に'$'がなければwidth
+                auto rest = [&](const Index pos) { return min<Index>(len_seq_ - 1 - pos - d, width); };
+                // 全て同じ窓が続く間は、ソートせずに先へ進める
+                bool split = false;
+                for (;;)
                 {
-                    cout << "Invalid case found" << "\n";
-                    cout << "seq: " << seq_ << "\n";
-                    cout << "SA: ";
-                    for (auto & sa : sa_) cout << sa << " ";
-                    cout << "\n";
-                    cout << "position: " << i << "\n";
-                    cout << "s1: " << s1 << "\n";
-                    cout << "s2: " << s2 << "\n";
-                    break;
+                    uint64_t key = external_key(sort, entries[lo].second + d);
+                    bool same = rest(entries[lo].second) == width;
+                    for (size_t i = lo; i < hi; i++)
+                    {
+                        entries[i].first = external_key(sort, entries[i].second + d);
+                        same = same && entries[i].first == key && rest(entries[i].second) == width;
+                    }
+                    if (!same) break;
+                    d += width;
+                    if ((split = split_run(lo, hi, d))) break;
+                }
+                if (split) continue;
+                auto less = [&](const pair<uint64_t, Index> & a, const pair<uint64_t, Index> & b)
+                {
+                    return (a.first != b.first) ? a.first < b.first : rest(a.second) < rest(b.second);
+                };
+                std::sort(entries.begin() + lo, entries.begin() + hi, less);
+                for (size_t i = lo; i < hi; )
+                {
+                    size_t j = i + 1;
+                    while (j < hi && !less(entries[i], entries[j])) j++;
+                    if (j - i > 1 && rest(entries[i].second) == width && !split_run(i, j, d + width)) ranges.emplace_back(i, j, d + width);
+                    i = j;
                 }
             }
         }
 };
 
+using SaLs   = BasicSaLs<int>;
+using SaLs64 = BasicSaLs<int64_t>;
+
+// SALSBenchmark.cppのように#includeして使うときはSALS_NO_MAINを定義してこのmainを外す
+#ifndef SALS_NO_MAIN
 int main()
 {
     vector<int> len_seq = {0, 10, 73, 100, 240, 777, 1000, 3511, 10000};
@@ -259,8 +1624,144 @@ int main()
         {
             SaLs test(len_seq[i]);
             //cout << test.get_seq() << "\n";
+            test.set_verify(true);
             test.build_suffix_array();
+
+            // 64bitの添字と詰めた文字列でも同じsuffix arrayになること
+            SaLs64 packed(test.get_seq());
+            packed.set_engine((j % 2 == 0) ? SuffixSortEngine::SAIS : SuffixSortEngine::DOUBLING);
+            packed.pack_text();
+            packed.build_suffix_array();
+            if (!ranges::equal(test.get_sa(), packed.get_sa())) cout << "Invalid packed case found" << "\n";
+
+            // 隣り合う2つを入れ替えたsaは検査で見つかること(順位を作り直す経路はexternalの検査で通す)
+            if (len_seq[i] >= 2)
+            {
+                swap(test.get_sa()[j % (len_seq[i] - 1)], test.get_sa()[j % (len_seq[i] - 1) + 1]);
+                cout.setstate(ios::failbit);
+                bool found = !test.verify_sa();
+                cout.clear();
+                if (!found) cout << "Invalid verifier case found" << "\n";
+            }
+        }
+    }
+
+    // alphabet_にない文字を数えること
+    cout << "Testing invalid bases" << "\n";
+    {
+        SaLs sals("ACGTNNacgRT$");
+        cerr.setstate(ios::failbit);
+        sals.set_verify(true);
+        sals.build_suffix_array();
+        cerr.clear();
+        if (sals.get_num_invalid_bases() != 6) cout << "Invalid base count found" << "\n";
+    }
+
+    // FASTAを読んで構築し、保存した索引を読み直すと同じsa, isa, LCP配列と文字列が得られること
+    cout << "Testing index file" << "\n";
+    string fasta_path = (filesystem::temp_directory_path() / "sals_test.fa").string();
+    string index_path = (filesystem::temp_directory_path() / "sals_test.idx").string();
+    ofstream(fasta_path) << ">chr1 test\r\nACGTNacgt\r\nGGRA\n>chr2\n\nTTGCA\nCC\n";
+    string expected = "ACGTAACGTGGAATTGCACC$";
+    for (bool pack : {false, true})
+    {
+        SaLs sals;
+        sals.load_fasta(fasta_path, pack);
+        sals.build_suffix_array();
+        SaLs plain(expected);
+        plain.build_suffix_array();
+        vector<int> lcp(expected.size(), 0);
+        for (size_t i = 1; i < expected.size(); i++)
+        {
+            while (expected[plain.get_sa()[i - 1] + lcp[i]] == expected[plain.get_sa()[i] + lcp[i]]) lcp[i]++;
+        }
+        bool ok = sals.get_num_replaced() == 2 && sals.get_records().size() == 2 && sals.get_records()[1].second == 13
+                  && sals.is_packed() == pack && ranges::equal(sals.get_sa(), plain.get_sa()) && sals.save_index(index_path, true, lcp);
+
+        SaLs loaded;
+        ok = ok && loaded.load_index(index_path, true) && loaded.is_packed() == pack && ranges::equal(loaded.get_sa(), plain.get_sa())
+             && ranges::equal(loaded.get_isa(), plain.get_isa()) && ranges::equal(loaded.get_lcp(), lcp) && loaded.verify_sa();
+        for (int i = 0; i < static_cast<int>(expected.size()); i++) ok = ok && loaded.get_char(i) == expected[i];
+        if (!ok) cout << "Invalid index file case found" << "\n";
+    }
+    // 壊れたファイルはchecksumで見つかること
+    {
+        fstream file(index_path, ios::in | ios::out | ios::binary);
+        file.seekp(HEADER_BYTES + 1);
+        file.put('\x7f');
+    }
+    SaLs broken;
+    cerr.setstate(ios::failbit);
+    if (broken.load_index(index_path, true)) cout << "Invalid checksum case found" << "\n";
+    cerr.clear();
+
+    // バケツが予算に収まらず分け直す長さで、build_suffix_array_externalがSA-ISと同じsuffix arrayを書くこと
+    // t = 1, 3は171塩基の単位を少しずつ変えて繰り返した、LCPの長い文字列
+    // t >= 4は1つのprefixだけでバケツの容量を超える: 単一塩基の長い連続、
+    // 同じ長さのNの領域(load_fastaでAになる)が2つと別の長さのAの連続がある文字列、
+    // 2000塩基の単位の完全な縦列反復(メモリ上のソートが単位ごとに進むと遅い)
+    cout << "Testing external construction" << "\n";
+    mt19937 rng(1);
+    auto random_bases = [&](const size_t n)
+    {
+        string s;
+        for (size_t i = 0; i < n; i++) s += "ACGT"[rng() % 4];
+        return s;
+    };
+    auto count_scratch = []()
+    {
+        int count = 0;
+        string prefix = "sals_" + to_string(getpid()) + "_";
+        for (const auto & entry : filesystem::directory_iterator(filesystem::temp_directory_path()))
+        {
+            if (entry.path().filename().string().starts_with(prefix)) count++;
+        }
+        return count;
+    };
+    for (int t = 0; t < 7; t++)
+    {
+        string seq;
+        string unit = random_bases(171);
+        if (t < 4)
+        {
+            while (seq.size() < 300000) seq += (t % 2 == 0) ? random_bases(1) : unit.substr(0, 170) + random_bases(1);
+        }
+        else if (t == 4)
+        {
+            seq = string(100000, 'A');
         }
+        else if (t == 5)
+        {
+            seq = random_bases(20000) + string(80000, 'A') + random_bases(20000) + string(80000, 'A') + random_bases(20000) + string(70000, 'A') + random_bases(10000);
+        }
+        else
+        {
+            unit = random_bases(2000);
+            while (seq.size() < 300000) seq += unit;
+        }
+        seq += '$';
+        SaLs expected_sa(seq);
+        expected_sa.set_engine(SuffixSortEngine::SAIS);
+        expected_sa.build_suffix_array();
+        SaLs external(seq);
+        if (t >= 2 && t != 5) external.pack_text();
+        bool ok = external.build_suffix_array_external(index_path, filesystem::temp_directory_path().string(), (t == 3) ? 1 << 20 : 0);
+        // 予算0ではprefix 1文字のバケツが容量を超えて分け直し、1MBでは1回の振り分けで収まる
+        // 単一塩基だけの文字列はprefixで分からず、最初の振り分けからrun_keyで分ける
+        int min_passes = (t == 3 || t == 4) ? 1 : 2;
+        if (!ok || !ranges::equal(external.get_sa(), expected_sa.get_sa()) || !external.verify_sa() || external.get_num_passes() < min_passes || count_scratch() > 0) cout << "Invalid external case found" << "\n";
+    }
+    // scratchファイルを書けなければ失敗し、途中まで書いたファイルも残さないこと
+    {
+        string seq = random_bases(300000) + "$";
+        SaLs external(seq);
+        cerr.setstate(ios::failbit);
+        bool ok = external.build_suffix_array_external(index_path, (filesystem::temp_directory_path() / "sals_missing_dir").string(), 0);
+        cerr.clear();
+        if (ok || count_scratch() > 0) cout << "Invalid external case found" << "\n";
     }
+    filesystem::remove(fasta_path);
+    filesystem::remove(index_path);
     return 0;
-}
\ No newline at end of file
+}
+#endif
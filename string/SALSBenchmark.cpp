@@ -0,0 +1,153 @@
+//--------------------------------------------------------------------------------------------------------
+// SALS.cppの構築方法ごとのベンチマーク
+// ランダムなDNAと、セントロメアのような高度に反復した配列(171塩基のモノマーからなるHOR (higher-order repeat)を
+// 少しずつ変異させながら並べたもの)、2000塩基の単位の完全な縦列反復を長さを10倍ずつ変えて作り、
+// 各構築方法の時間をCSVで出力する
+// 全ての構築方法のsa_が最初の方法(doubling)と一致するかも確かめる
+// doubling-k1は最初のソートを先頭の1文字に戻したもので、num_orderとinitial_sortedでk-merのソートが省いた分を比べる
+// doubling-packedは文字列を2bitに詰めてから構築したもの
+// external-64m, external-minは詰めた文字列からbuild_suffix_array_externalで一時ディレクトリに書いたもの
+// (予算64MBと0. 0ではバケツの容量がMIN_BUCKET_CAPACITYになり、振り分けを最も多く繰り返す)
+// Usage: ./SALSBenchmark [最大長 = 10000000] [スレッド数 = コア数] [seed = 1] > result.csv
+// To compile, perform: g++ -std=c++20 -O2 -pthread -Wall --pedantic-errors -o SALSBenchmark SALSBenchmark.cpp
+//--------------------------------------------------------------------------------------------------------
+#define SALS_NO_MAIN
+#include "SALS.cpp"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+using namespace std;
+
+struct SaLsBenchmark
+{
+    public:
+        SaLsBenchmark(const unsigned seed)
+            : rng_(seed)
+            {}
+
+        // 構築方法の名前と、構築の前にSaLsに設定する関数. buildを省くとbuild_suffix_arrayで構築する
+        void add_engine(const string & name, const function<void(SaLs &)> & configure, const function<bool(SaLs &)> & build = nullptr)
+        {
+            engines_.push_back({name, configure, build ? build : [](SaLs & sals) { sals.build_suffix_array(); return true; }});
+        }
+
+        // 一致しなかった行数を返す
+        int run(const vector<int> & lengths)
+        {
+            cout << "kind,length,engine,sec,bases_per_sec,num_order,initial_sorted,check\n";
+            int num_mismatches = 0;
+            for (int len : lengths)
+            {
+                for (const char * kind : {"random", "centromeric", "tandem"})
+                {
+                    string seq = (string(kind) == "random") ? make_random(len) : (string(kind) == "centromeric") ? make_centromeric(len) : make_tandem(len);
+                    vector<int> expected;
+                    for (const auto & [name, configure, build] : engines_)
+                    {
+                        SaLs sals(seq);
+                        configure(sals);
+                        auto start = chrono::steady_clock::now();
+                        bool ok = build(sals);
+                        double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+                        if (expected.empty()) expected.assign(sals.get_sa().begin(), sals.get_sa().end());
+                        else ok = ok && ranges::equal(sals.get_sa(), expected);
+                        if (!ok)
+                        {
+                            num_mismatches++;
+                            cerr << "MISMATCH: " << kind << " " << len << " " << name << "\n";
+                        }
+                        cout << kind << "," << len << "," << name << "," << sec << "," << (sec > 0.0 ? len / sec : 0.0) << ","
+                             << sals.get_num_order() << "," << sals.get_num_initial_sorted_groups() << "," << (ok ? "ok" : "MISMATCH") << "\n";
+                    }
+                }
+            }
+            return num_mismatches;
+        }
+
+    private:
+        struct Engine
+        {
+            string                     name;
+            function<void(SaLs &)>     configure;
+            function<bool(SaLs &)>     build;
+        };
+        mt19937        rng_;
+        vector<Engine> engines_;
+
+        char random_base() { return "ACGT"[rng_() % 4]; }
+
+        string make_random(const int len)
+        {
+            string seq;
+            for (int i = 0; i < len - 1; i++) seq += random_base();
+            seq += '$';
+            return seq;
+        }
+
+        // 互いに約20%異なる12個のモノマーからなるHORを、コピーごとに約1%の置換を入れて並べる
+        string make_centromeric(const int len)
+        {
+            const int monomer_len = 171;
+            const int num_monomers = 12;
+            string monomer;
+            for (int i = 0; i < monomer_len; i++) monomer += random_base();
+            string hor;
+            for (int m = 0; m < num_monomers; m++)
+            {
+                for (int i = 0; i < monomer_len; i++) hor += (rng_() % 5 == 0) ? random_base() : monomer[i];
+            }
+            string seq;
+            while (static_cast<int>(seq.size()) < len - 1)
+            {
+                for (char c : hor) seq += (rng_() % 100 == 0) ? random_base() : c;
+            }
+            seq.resize(len - 1);
+            seq += '$';
+            return seq;
+        }
+
+        // 2000塩基の単位を変異なしで並べる(suffixの先頭の共有部分が文字列の末尾まで続く)
+        string make_tandem(const int len)
+        {
+            string unit;
+            for (int i = 0; i < 2000; i++) unit += random_base();
+            string seq;
+            while (static_cast<int>(seq.size()) < len - 1) seq += unit;
+            seq.resize(len - 1);
+            seq += '$';
+            return seq;
+        }
+};
+
+int main(int argc, char ** argv)
+{
+    int max_len     = (argc > 1) ? atoi(argv[1]) : 10000000;
+    int num_threads = (argc > 2) ? atoi(argv[2]) : static_cast<int>(thread::hardware_concurrency());
+    unsigned seed   = (argc > 3) ? atoi(argv[3]) : 1;
+
+    vector<int> lengths;
+    for (int len = 100000; len <= max_len; len *= 10) lengths.push_back(len);
+
+    SaLsBenchmark benchmark(seed);
+    benchmark.add_engine("doubling", [](SaLs & sals) { sals.set_engine(SuffixSortEngine::DOUBLING); });
+    benchmark.add_engine("doubling-k1", [](SaLs & sals) { sals.set_kmer_length(1); });
+    benchmark.add_engine("sa-is",    [](SaLs & sals) { sals.set_engine(SuffixSortEngine::SAIS);     });
+    benchmark.add_engine("doubling-packed", [](SaLs & sals) { sals.pack_text(); });
+    string index_path = (filesystem::temp_directory_path() / ("sals_benchmark_" + to_string(getpid()) + ".idx")).string();
+    for (auto [name, budget] : {pair<string, size_t>{"external-64m", 64 << 20}, {"external-min", 0}})
+    {
+        benchmark.add_engine(name, [](SaLs & sals) { sals.pack_text(); }, [index_path, budget](SaLs & sals)
+        {
+            return sals.build_suffix_array_external(index_path, filesystem::temp_directory_path().string(), budget);
+        });
+    }
+    if (num_threads > 1)
+    {
+        benchmark.add_engine("doubling-" + to_string(num_threads) + "t", [num_threads](SaLs & sals) { sals.set_num_threads(num_threads); });
+    }
+    int num_mismatches = benchmark.run(lengths);
+    filesystem::remove(index_path);
+    cerr << num_mismatches << " mismatches\n";
+    return (num_mismatches == 0) ? 0 : 1;
+}
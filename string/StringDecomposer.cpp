@@ -3,12 +3,31 @@
 // Reference: Tatiana Dvorkina, Andrey V. Bzikadze and Pavel A. Pevzner
 // "The string decomposition problem and its applications to centromere analysis and assembly” Bioinformatics, 36 (2020): i93-i101.
 // To compile, perform: g++ -std=c++20 -Wall --pedantic-errors -o StringDecomposer StringDecomposer.cpp
+// DecomposeMode::ROLLINGはdp_の代わりに各blockのスコアを2列だけ持ち、各セルで選んだ辺を2bitで、各列のblock-switching edgeの
+// 出発blockを1つ記録してtrace backする。CHECKPOINTEDはさらにK列おきのスコアの列だけを残し、trace backで区間ごとに辺を計算し直して
+// 辺の記録をK列分(memory_budget_以内)に抑える。どちらもdecompose()の結果(path_, decomp_)はFULLと同じになる。
+// ROLLINGとCHECKPOINTEDの列は全blockを1つの連続した配列に16 blockずつレーンに並べて持ち、AVX2があればint16_tの飽和演算で
+// 16 blockを同時に埋める(StringDecomposerBenchmark.cppでFULLとの速度を比べる)。
+// 列j(1以上)の行0の値はその列の各blockの最後の行の最大値で、行0からの欠失はその値から同じ列を下る。
+// 行0と同じ列のセルが互いに依存するので、各列はまず行0からの欠失なしで埋めて最大値を求め、それから欠失の鎖で緩和する。
+// 鎖の値は行0より小さいので最大値(行0)は変わらず、block-switching edgeの出発blockも1回目のままでよい。
 //---------------------------------------------------------------------------------------------------------------------------------
 #include <iostream>
 #include <string>
 #include <vector>
 #include <tuple>
 #include <climits>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <bit>
+#include <limits>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STRINGDECOMPOSER_X86_SIMD 1
+#endif
 using namespace std;
 
 const int MATCH = 1;
@@ -20,6 +39,265 @@ int score(char a, char b)
     return (a == b) ? MATCH : MISMATCH;
 }
 
+//---------------------------------------------------------------------------------------------------------------------------------
+// ROLLING, CHECKPOINTEDで1列を埋めるカーネル
+// 同じ列の中のblockは互いに依存しないので、blockをDECOMP_LANES個ずつのグループにしてSIMDのレーンに載せる
+// (block内の位置をレーンに載せるFarrarのstripedと違い、縦方向(欠失)の依存を直すループが要らない)
+// グループgの行iのレーンkはblock g * DECOMP_LANES + kの行iで、列の中ではcolumn[(g * max_len + i - 1) * DECOMP_LANES + k]に並ぶ
+// 短いblockや空きのレーンも行max_lenまで計算し、各blockの最後の行の値だけをend_maskで取り出す
+// 値は1つ前の列の行0(block-switching edgeの値)を0とした相対値で持つ. 各セルはそこから-2 * max_len - 3以上max_len + 1以下に
+// 収まるので、max_lenがDECOMP_INT16_MAX_LEN以下ならint16_tで飽和させて計算しても結果は変わらない
+// (飽和しうるのは1回目の同じ列の行0からの欠失の-infだけで、これはどのセルでも選ばれない)
+// 行0からの欠失は、列の最大値が決まってからrelax_column_*で緩和する
+//---------------------------------------------------------------------------------------------------------------------------------
+constexpr int DECOMP_LANES = 16;
+constexpr int DECOMP_INT16_MAX_LEN = 8192;
+
+template <class Cell>
+struct ColumnParams
+{
+    const Cell * prev;       // 1つ前の列(基準は2つ前の列の行0)
+    Cell *       curr;       // この列(基準は1つ前の列の行0)
+    const Cell * profile;    // score(block[i - 1], seq[j - 1]). 空きのレーンと行はMISMATCH
+    const Cell * end_mask;   // 行iがblockの最後の行であるレーンは-1, それ以外は0
+    uint32_t *   moves;      // nullptrでなければ(g, i)ごとに下位16bitに欠失、上位16bitに挿入を選んだレーンを書く
+    int          num_groups;
+    int          max_len;
+    Cell         delta;      // 1つ前の列の行0 - 2つ前の列の行0
+};
+
+// 1回目に埋めるときの同じ列の行0からの欠失の値. int16_tは飽和演算なので最小値、intはGAPを足しても溢れないように半分にする
+template <class Cell>
+constexpr Cell column_neg_inf()
+{
+    return is_same_v<Cell, int16_t> ? numeric_limits<Cell>::min() : numeric_limits<Cell>::min() / 2;
+}
+
+template <class Cell>
+Cell saturate(const int v)
+{
+    return clamp<int>(v, numeric_limits<Cell>::min(), numeric_limits<Cell>::max());
+}
+
+// 戻り値はblockの最後の行の最大値(相対値)と、それを取る最初のblock
+template <class Cell>
+pair<int, int> fill_column_scalar(const ColumnParams<Cell> & p)
+{
+    int best = numeric_limits<Cell>::min();
+    int from = 0;
+    for (int g = 0; g < p.num_groups; ++g)
+    {
+        Cell diag[DECOMP_LANES];
+        Cell up[DECOMP_LANES];
+        Cell end[DECOMP_LANES];
+        fill(diag, diag + DECOMP_LANES, 0);
+        fill(up,   up   + DECOMP_LANES, column_neg_inf<Cell>());
+        fill(end,  end  + DECOMP_LANES, numeric_limits<Cell>::min());
+        for (int i = 1; i <= p.max_len; ++i)
+        {
+            size_t row = size_t(g) * p.max_len + i - 1;
+            uint32_t word = 0;
+            for (int k = 0; k < DECOMP_LANES; ++k)
+            {
+                size_t idx = row * DECOMP_LANES + k;
+                Cell prev = saturate<Cell>(p.prev[idx] - p.delta);
+                Cell h = saturate<Cell>(diag[k] + p.profile[idx]);
+                Cell d = saturate<Cell>(up[k] + GAP);
+                Cell n = saturate<Cell>(prev + GAP);
+                if (d > h)
+                {
+                    h = d;
+                    word |= 1u << k;
+                }
+                if (n > h)
+                {
+                    h = n;
+                    word |= 1u << (DECOMP_LANES + k);
+                }
+                p.curr[idx] = h;
+                if (p.end_mask[idx]) end[k] = h;
+                diag[k] = prev;
+                up[k] = h;
+            }
+            if (p.moves) p.moves[row] = word;
+        }
+        for (int k = 0; k < DECOMP_LANES; ++k)
+        {
+            if (end[k] > best)
+            {
+                best = end[k];
+                from = g * DECOMP_LANES + k;
+            }
+        }
+    }
+    return {best, from};
+}
+
+#ifdef STRINGDECOMPOSER_X86_SIMD
+// int16_t版: AVX2 1レジスタに1グループ(16 block)を載せ、block-switching edgeの最大値もレジスタの中で求める
+__attribute__((target("avx2")))
+pair<int, int> fill_column_avx2_i16(const ColumnParams<int16_t> & p)
+{
+    const __m256i gap = _mm256_set1_epi16(GAP);
+    const __m256i delta = _mm256_set1_epi16(p.delta);
+    __m256i best = _mm256_set1_epi16(INT16_MIN);
+    __m256i best_group = _mm256_setzero_si256(); // レーンごとに最大値を最初に取ったグループ
+    for (int g = 0; g < p.num_groups; ++g)
+    {
+        __m256i diag = _mm256_setzero_si256();
+        __m256i up = _mm256_set1_epi16(column_neg_inf<int16_t>());
+        __m256i end = _mm256_set1_epi16(INT16_MIN);
+        size_t row = size_t(g) * p.max_len;
+        for (int i = 1; i <= p.max_len; ++i, ++row)
+        {
+            size_t idx = row * DECOMP_LANES;
+            __m256i prev = _mm256_subs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p.prev + idx)), delta);
+            __m256i m = _mm256_adds_epi16(diag, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p.profile + idx)));
+            __m256i d = _mm256_adds_epi16(up, gap);
+            __m256i n = _mm256_adds_epi16(prev, gap);
+            __m256i del = _mm256_cmpgt_epi16(d, m);
+            __m256i h = _mm256_max_epi16(m, d);
+            __m256i ins = _mm256_cmpgt_epi16(n, h);
+            h = _mm256_max_epi16(h, n);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(p.curr + idx), h);
+            if (p.moves)
+            {
+                // packsは128bitごとに[del 0-7, ins 0-7, del 8-15, ins 8-15]と並べるので64bit単位で[del, del, ins, ins]に直す
+                __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(del, ins), 0xD8);
+                p.moves[row] = _mm256_movemask_epi8(packed);
+            }
+            end = _mm256_blendv_epi8(end, h, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p.end_mask + idx)));
+            diag = prev;
+            up = h;
+        }
+        best_group = _mm256_blendv_epi8(best_group, _mm256_set1_epi16(g), _mm256_cmpgt_epi16(end, best));
+        best = _mm256_max_epi16(best, end);
+    }
+
+    // レーン間の最大値
+    __m256i m = _mm256_max_epi16(best, _mm256_permute2x128_si256(best, best, 1));
+    m = _mm256_max_epi16(m, _mm256_shuffle_epi32(m, 0x4E));
+    m = _mm256_max_epi16(m, _mm256_shuffle_epi32(m, 0xB1));
+    m = _mm256_max_epi16(m, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(m, 0xB1), 0xB1));
+    int max_end = int16_t(_mm_extract_epi16(_mm256_castsi256_si128(m), 0));
+
+    // 最大値を取るレーンのうちblockのインデックスが最小のもの
+    uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi16(best, m)) & 0x55555555; // 1レーンに2bitなので下の1bitだけ見る
+    alignas(32) int16_t groups[DECOMP_LANES];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(groups), best_group);
+    int from = INT_MAX;
+    for (; eq; eq &= eq - 1)
+    {
+        int k = countr_zero(eq) / 2;
+        from = min(from, groups[k] * DECOMP_LANES + k);
+    }
+    return {max_end, from};
+}
+#endif
+
+// 2回目: 行0(この列のblockの最後の行の最大値max_end)からの欠失の鎖max_end + GAP * iでセルを緩和する
+// 1回目の値は行2以降の欠失を含むので1行で1より多くは下がらず、緩和される行は各blockの行1からの連続した行になる
+// 緩和されたセルは欠失を選び、値が鎖と等しく挿入を選んでいたセルもFULLのtrace backと同じく欠失にする
+// 鎖はmax_endより小さいので、各blockの最後の行の最大値と、それを取るblockは変わらない
+template <class Cell>
+void relax_column_scalar(const ColumnParams<Cell> & p, const int max_end)
+{
+    for (int g = 0; g < p.num_groups; ++g)
+    {
+        uint32_t active = (1u << DECOMP_LANES) - 1; // 1つ上の行が行0か緩和された行で、blockの最後の行より後ろでないレーン
+        for (int i = 1; i <= p.max_len && active; ++i)
+        {
+            size_t row = size_t(g) * p.max_len + i - 1;
+            Cell chain = saturate<Cell>(max_end + GAP * i);
+            uint32_t word = p.moves ? p.moves[row] : 0;
+            uint32_t relaxed = 0;
+            for (uint32_t lanes = active; lanes; lanes &= lanes - 1)
+            {
+                int k = countr_zero(lanes);
+                size_t idx = row * DECOMP_LANES + k;
+                Cell & h = p.curr[idx];
+                if (chain > h)
+                {
+                    h = chain;
+                    if (!p.end_mask[idx]) relaxed |= 1u << k;
+                }
+                else if (chain < h || !((word >> (DECOMP_LANES + k)) & 1))
+                {
+                    continue;
+                }
+                word = (word | (1u << k)) & ~(1u << (DECOMP_LANES + k));
+            }
+            if (p.moves) p.moves[row] = word;
+            active = relaxed;
+        }
+    }
+}
+
+#ifdef STRINGDECOMPOSER_X86_SIMD
+// int16_t版: 1グループの16 blockの1行をまとめて緩和する
+__attribute__((target("avx2")))
+void relax_column_avx2_i16(const ColumnParams<int16_t> & p, const int max_end)
+{
+    const __m256i lane_bits = _mm256_setr_epi16(1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7,
+                                                1 << 8, 1 << 9, 1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, int16_t(1 << 15));
+    for (int g = 0; g < p.num_groups; ++g)
+    {
+        __m256i active = _mm256_set1_epi16(-1);
+        size_t row = size_t(g) * p.max_len;
+        for (int i = 1; i <= p.max_len && !_mm256_testz_si256(active, active); ++i, ++row)
+        {
+            size_t idx = row * DECOMP_LANES;
+            __m256i chain = _mm256_set1_epi16(saturate<int16_t>(max_end + GAP * i));
+            __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p.curr + idx));
+            __m256i gt = _mm256_and_si256(_mm256_cmpgt_epi16(chain, h), active);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(p.curr + idx), _mm256_blendv_epi8(h, chain, gt));
+            if (p.moves)
+            {
+                uint32_t word = p.moves[row];
+                __m256i ins = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(int16_t(word >> DECOMP_LANES)), lane_bits), lane_bits);
+                __m256i tie = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi16(chain, h), ins), active);
+                __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(_mm256_or_si256(gt, tie), _mm256_setzero_si256()), 0xD8);
+                uint32_t changed = _mm256_movemask_epi8(packed) & 0xFFFF;
+                p.moves[row] = (word | changed) & ~(changed << DECOMP_LANES);
+            }
+            active = _mm256_andnot_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p.end_mask + idx)), gt);
+        }
+    }
+}
+#endif
+
+// 実行時にCPUを見て使うカーネルを決める(intのセルは常にスカラー版)
+template <class Cell>
+struct ColumnKernel
+{
+    pair<int, int> (*fill)(const ColumnParams<Cell> &) = fill_column_scalar<Cell>;
+    void (*relax)(const ColumnParams<Cell> &, int)     = relax_column_scalar<Cell>;
+    const char * name = "scalar";
+};
+
+template <class Cell>
+const ColumnKernel<Cell> & select_column_kernel(const bool use_simd)
+{
+    static const ColumnKernel<Cell> scalar;
+    static const ColumnKernel<Cell> simd = []
+    {
+        ColumnKernel<Cell> kernel;
+#ifdef STRINGDECOMPOSER_X86_SIMD
+        if constexpr (is_same_v<Cell, int16_t>)
+        {
+            if (__builtin_cpu_supports("avx2")) kernel = {fill_column_avx2_i16, relax_column_avx2_i16, "avx2 (int16)"};
+        }
+#endif
+        return kernel;
+    }();
+    return use_simd ? simd : scalar;
+}
+
+// FULL:         dp_[b][i][j]を全て持つ
+// ROLLING:      スコアは2列、辺はセルごとに2bit
+// CHECKPOINTED: スコアはK列おき、辺はK列分だけ持つ(trace backで区間ごとに埋め直すので埋める時間は約2倍)
+enum class DecomposeMode { FULL, ROLLING, CHECKPOINTED };
+
 struct StringDecomposer
 {
     public:
@@ -28,6 +306,46 @@ struct StringDecomposer
             {}
         
         void decompose()
+        {
+            path_.clear();
+            decomp_.clear();
+            if (mode_ == DecomposeMode::FULL) decompose_full();
+            else                              decompose_compact();
+            build_decomposition();
+        }
+
+        void set_mode(const DecomposeMode mode)        { mode_ = mode; }
+        // CHECKPOINTEDで辺の記録とチェックポイントの列に使うバイト数の目安
+        void set_memory_budget(const size_t bytes)     { memory_budget_ = bytes; }
+
+        vector<vector<vector<int>>>  & get_dp()     { return dp_;     } // FULLのときだけ
+        vector<tuple<int, int, int>> & get_path()   { return path_;   }
+        vector<string>               & get_decomp() { return decomp_; }
+        int                            get_score()  { return score_;  }
+        // CHECKPOINTEDで1度に辺を記録する列の数(ROLLINGでは全ての列)
+        int                            get_segment_len() { return segment_len_; }
+        // ROLLING, CHECKPOINTEDで列を埋めるカーネル. falseにするとスカラー版を使う
+        void                           set_simd(const bool use_simd) { use_simd_ = use_simd; }
+        const char *                   get_kernel_name() const       { return kernel_name_;  }
+
+    private:
+        // 各セルで選んだ辺
+        enum Move : uint8_t { DIAGONAL = 0, DELETION = 1, INSERTION = 2 };
+
+        const string                  seq_;
+        vector<string>                blocks_;
+        vector<vector<vector<int>>>   dp_;         // dpテーブル
+        vector<tuple<int, int, int>>  path_;       // 最適パスのblockインデックス, i, j
+        vector<string>                decomp_;     // seq_の最適な分解
+        int                           score_ {0};  // 最適パスのスコア
+        DecomposeMode                 mode_ {DecomposeMode::FULL};
+        size_t                        memory_budget_ {size_t(1) << 30};
+        bool                          use_simd_ {true};
+        const char *                  kernel_name_ {""};
+        vector<int>                   switch_from_; // switch_from_[j]は列jでblock-switching edgeの出発となるblock
+        int                           segment_len_ {0};
+
+        void decompose_full()
         {
             int len_seq = seq_.size();
             int num_blocks = blocks_.size();
@@ -55,7 +373,7 @@ struct StringDecomposer
                     for (int i = 1; i <= len_block; ++i)
                     {
                         int s_match = dp_[b][i - 1][j - 1] + score(blocks_[b][i - 1], seq_[j - 1]);
-                        int s_del = dp_[b][i - 1][j] + GAP;
+                        int s_del = (i > 1) ? dp_[b][i - 1][j] + GAP : INT_MIN; // 同じ列の行0からの欠失は後で緩和する
                         int s_ins = dp_[b][i][j - 1] + GAP;
 
                         dp_[b][i][j] = max({s_match, s_del, s_ins});
@@ -71,6 +389,13 @@ struct StringDecomposer
                 }
                 int max_end_score = *max_element(block_end_scores.begin(), block_end_scores.end());
                 for (int b = 0; b < num_blocks; ++b) dp_[b][0][j] = max_end_score;
+
+                // 行0からの欠失の鎖で緩和する(鎖の値はmax_end_scoreより小さいので行0は変わらない)
+                for (int b = 0; b < num_blocks; ++b)
+                {
+                    int len_block = blocks_[b].size();
+                    for (int i = 1; i <= len_block && dp_[b][i - 1][j] + GAP > dp_[b][i][j]; ++i) dp_[b][i][j] = dp_[b][i - 1][j] + GAP;
+                }
             }
 
             // sinkを求める
@@ -87,6 +412,7 @@ struct StringDecomposer
                     len_sink_block = len_block;
                 }
             }
+            score_ = prev_score;
 
             // trace backで最適パスを求める
             int b = sink_b;
@@ -95,12 +421,13 @@ struct StringDecomposer
             path_.emplace_back(b, i, j);
             while (i != 0 || j != 0)
             {
-                if (prev_score == dp_[b][i - 1][j - 1] + score(blocks_[b][i - 1], seq_[j - 1]))
+                // 列0は欠失だけ
+                if (j > 0 && prev_score == dp_[b][i - 1][j - 1] + score(blocks_[b][i - 1], seq_[j - 1]))
                 { 
                     prev_score = dp_[b][i - 1][j - 1];
                     --i; --j;
                 }
-                else if (prev_score == dp_[b][i - 1][j] + GAP)
+                else if (j == 0 || prev_score == dp_[b][i - 1][j] + GAP)
                 {
                     prev_score = dp_[b][i - 1][j];
                     --i;
@@ -115,6 +442,7 @@ struct StringDecomposer
                 // glued部分に到達したらblock-switching edgeを遡る
                 if (i == 0 && j > 0)
                 {
+                    prev_score = dp_[b][0][j];
                     for (int prev_b = 0; prev_b < num_blocks; ++prev_b)
                     {
                         int prev_len_block = blocks_[prev_b].size();
@@ -129,8 +457,149 @@ struct StringDecomposer
                 }
             }
             reverse(path_.begin(), path_.end());
+        }
 
-            // seq_の最適な分解を求める
+        // 列の状態: columnはrefを0とした相対値、row0はこの列の行0(block-switching edgeの値)の絶対値
+        template <class Cell>
+        struct ColumnState
+        {
+            vector<Cell> column;
+            int          ref {0};
+            int          row0 {0};
+        };
+
+        void decompose_compact()
+        {
+            int max_len = 0;
+            for (auto & block : blocks_) max_len = max<int>(max_len, block.size());
+            if (max_len <= DECOMP_INT16_MAX_LEN) decompose_compact<int16_t>(max_len);
+            else                                 decompose_compact<int>(max_len);
+        }
+
+        // スコアを2列ずつ回して埋め、辺の記録からtrace backする
+        // CHECKPOINTEDでは最初にsegment_len_列おきの列の状態だけを残して最後まで埋め、
+        // trace backが区間[c, c + segment_len_]に入るたびに列cから辺を埋め直す
+        template <class Cell>
+        void decompose_compact(const int max_len)
+        {
+            int len_seq = seq_.size();
+            int num_blocks = blocks_.size();
+            int num_groups = (num_blocks + DECOMP_LANES - 1) / DECOMP_LANES;
+            size_t column_cells = size_t(num_groups) * max_len * DECOMP_LANES;
+            size_t column_words = size_t(num_groups) * max_len; // 1列の辺の記録
+            auto cell_index = [&](const int b, const int i) { return (size_t(b / DECOMP_LANES) * max_len + i - 1) * DECOMP_LANES + b % DECOMP_LANES; };
+            const ColumnKernel<Cell> & kernel = select_column_kernel<Cell>(use_simd_);
+            kernel_name_ = kernel.name;
+            switch_from_.assign(len_seq + 1, 0);
+
+            // seq_に現れる文字ごとのscore(blocks_[b][i - 1], c)とblockの最後の行
+            vector<Cell> end_mask(column_cells, 0);
+            for (int b = 0; b < num_blocks; ++b) end_mask[cell_index(b, blocks_[b].size())] = -1;
+            vector<int> profile_of(256, -1);
+            vector<vector<Cell>> profiles;
+            for (unsigned char c : seq_)
+            {
+                if (profile_of[c] >= 0) continue;
+                profile_of[c] = profiles.size();
+                vector<Cell> & profile = profiles.emplace_back(column_cells, MISMATCH);
+                for (int b = 0; b < num_blocks; ++b)
+                {
+                    for (size_t i = 1; i <= blocks_[b].size(); ++i) profile[cell_index(b, i)] = score(blocks_[b][i - 1], c);
+                }
+            }
+
+            // 区間の長さKは辺の記録(K列)とチェックポイント(len_seq / K列)がそれぞれ予算の半分に収まるように選ぶ
+            // 両方は収まらないときは合計が最小になるsqrt(len_seq * 列のバイト数 / 辺の列のバイト数)にする
+            segment_len_ = max(len_seq, 1);
+            if (mode_ == DecomposeMode::CHECKPOINTED)
+            {
+                size_t column_bytes = column_cells * sizeof(Cell);
+                size_t column_move_bytes = max<size_t>(column_words * sizeof(uint32_t), 1);
+                size_t k = max<size_t>(1, memory_budget_ / 2 / column_move_bytes);
+                if ((len_seq / k + 1) * column_bytes > memory_budget_ / 2) k = max<size_t>(k, ceil(sqrt(double(len_seq) * column_bytes / column_move_bytes)));
+                segment_len_ = min<size_t>(segment_len_, k);
+            }
+            bool recompute = segment_len_ < len_seq;
+
+            // 列0は行0が0、行iがGAP * i
+            ColumnState<Cell> state;
+            state.column.resize(column_cells);
+            for (size_t c = 0; c < column_cells; ++c) state.column[c] = GAP * int(c / DECOMP_LANES % max_len + 1);
+            vector<Cell> next(column_cells);
+            auto fill_column = [&](const int j, uint32_t * moves)
+            {
+                ColumnParams<Cell> params {state.column.data(), next.data(), profiles[profile_of[(unsigned char)seq_[j - 1]]].data(), end_mask.data(),
+                                           moves, num_groups, max_len, Cell(state.row0 - state.ref)};
+                auto [max_end, from] = kernel.fill(params);
+                kernel.relax(params, max_end);
+                switch_from_[j] = from;
+                state.column.swap(next);
+                state.ref = state.row0;
+                state.row0 += max_end;
+            };
+
+            vector<uint32_t> moves(recompute ? 0 : column_words * len_seq);
+            vector<ColumnState<Cell>> checkpoints;
+            for (int j = 1; j <= len_seq; ++j)
+            {
+                if (recompute && (j - 1) % segment_len_ == 0) checkpoints.push_back(state);
+                fill_column(j, recompute ? nullptr : moves.data() + column_words * (j - 1));
+            }
+
+            // sinkを求める(FULLと同じく最大のうち最後のblock)
+            int sink_b = 0;
+            for (int b = 0; b < num_blocks; ++b)
+            {
+                if (state.column[cell_index(b, blocks_[b].size())] >= state.column[cell_index(sink_b, blocks_[sink_b].size())]) sink_b = b;
+            }
+            score_ = state.ref + state.column[cell_index(sink_b, blocks_[sink_b].size())];
+
+            // 辺の記録はseg_begin + 1列目からseg_end列目まで
+            int seg_begin = 0;
+            int seg_end = recompute ? 0 : len_seq; // CHECKPOINTEDでは最初のmove_atで読み込む
+            auto load_segment = [&](const int j)
+            {
+                seg_begin = (j - 1) / segment_len_ * segment_len_;
+                seg_end = min(len_seq, seg_begin + segment_len_);
+                moves.resize(column_words * (seg_end - seg_begin));
+                state = checkpoints[seg_begin / segment_len_];
+                for (int jj = seg_begin + 1; jj <= seg_end; ++jj) fill_column(jj, moves.data() + column_words * (jj - seg_begin - 1));
+            };
+            auto move_at = [&](const int b, const int i, const int j)
+            {
+                if (recompute && (j <= seg_begin || j > seg_end)) load_segment(j);
+                uint32_t word = moves[column_words * (j - seg_begin - 1) + cell_index(b, i) / DECOMP_LANES];
+                int k = b % DECOMP_LANES;
+                if ((word >> (DECOMP_LANES + k)) & 1) return INSERTION;
+                if ((word >> k) & 1)                  return DELETION;
+                return DIAGONAL;
+            };
+
+            int b = sink_b;
+            int i = blocks_[b].size();
+            int j = len_seq;
+            path_.emplace_back(b, i, j);
+            while (i != 0 || j != 0)
+            {
+                int move = (j == 0) ? DELETION : move_at(b, i, j);
+                if (move != INSERTION) --i;
+                if (move != DELETION)  --j;
+                path_.emplace_back(b, i, j);
+
+                // glued部分に到達したらblock-switching edgeを遡る
+                if (i == 0 && j > 0)
+                {
+                    b = switch_from_[j];
+                    i = blocks_[b].size();
+                    path_.emplace_back(b, i, j);
+                }
+            }
+            reverse(path_.begin(), path_.end());
+        }
+
+        // path_からseq_の最適な分解を求める
+        void build_decomposition()
+        {
             int block_start_idx = 0;
             for (int i = 1; i < path_.size(); ++i)
             {
@@ -145,21 +614,167 @@ struct StringDecomposer
                 }
             }
         }
+};
 
-        vector<vector<vector<int>>>  & get_dp()     { return dp_;     }
-        vector<tuple<int, int, int>> & get_path()   { return path_;   }
-        vector<string>               & get_decomp() { return decomp_; }
+// StringDecomposerBenchmark.cppのように#includeして使うときはSTRINGDECOMPOSER_NO_MAINを定義してこのmainを外す
+#ifndef STRINGDECOMPOSER_NO_MAIN
+// pathを先頭からたどったスコア(block-switching edgeは0). 辺として不正な並びがあればINT_MINを返す
+int path_score(const string & seq, const vector<string> & blocks, const vector<tuple<int, int, int>> & path)
+{
+    if (path.empty() || get<1>(path[0]) != 0 || get<2>(path[0]) != 0) return INT_MIN;
+    int total = 0;
+    for (size_t p = 1; p < path.size(); ++p)
+    {
+        auto [b0, i0, j0] = path[p - 1];
+        auto [b1, i1, j1] = path[p];
+        if (i1 == 0 && i0 == int(blocks[b0].size()) && j0 == j1 && j0 > 0) continue; // 同じblockへのswitchもある
+        if (b0 != b1) return INT_MIN;
+        if (i1 == i0 + 1 && j1 == j0 + 1) total += score(blocks[b1][i0], seq[j0]);
+        else if (i1 == i0 + 1 && j1 == j0) total += GAP;
+        else if (i1 == i0 && j1 == j0 + 1 && i0 > 0) total += GAP;
+        else return INT_MIN;
+    }
+    return total;
+}
 
-    private:
-        const string                  seq_;
-        vector<string>                blocks_;
-        vector<vector<vector<int>>>   dp_;         // dpテーブル
-        vector<tuple<int, int, int>>  path_;       // 最適パスのblockインデックス, i, j
-        vector<string>                decomp_;     // seq_の最適な分解
-};
+// 各列を行0からの欠失も含めて値が変わらなくなるまで埋め直した最適スコア(列を2回に分けて埋めずに求める検査用)
+int reference_score(const string & seq, const vector<string> & blocks)
+{
+    int num_blocks = blocks.size();
+    vector<vector<int>> column(num_blocks), next(num_blocks);
+    for (int b = 0; b < num_blocks; ++b)
+    {
+        for (int i = 0; i <= int(blocks[b].size()); ++i) column[b].push_back(GAP * i);
+        next[b].resize(column[b].size());
+    }
+    for (size_t j = 1; j <= seq.size(); ++j)
+    {
+        int row0 = INT_MIN / 2;
+        for (;;)
+        {
+            int max_end = INT_MIN / 2;
+            for (int b = 0; b < num_blocks; ++b)
+            {
+                next[b][0] = row0;
+                for (int i = 1; i <= int(blocks[b].size()); ++i)
+                {
+                    next[b][i] = max({column[b][i - 1] + score(blocks[b][i - 1], seq[j - 1]), next[b][i - 1] + GAP, column[b][i] + GAP});
+                }
+                max_end = max(max_end, next[b].back());
+            }
+            if (max_end == row0) break;
+            row0 = max_end;
+        }
+        swap(column, next);
+    }
+    int best = INT_MIN;
+    for (int b = 0; b < num_blocks; ++b) best = max(best, column[b].back());
+    return best;
+}
 
 int main()
 {
+    // ランダムなblockを変異させながら並べた配列で、ROLLINGとCHECKPOINTEDが(SIMDでもスカラーでも)FULLと同じ分解になるか確かめる
+    mt19937 rng(1);
+    const string bases = "ACGT";
+    for (int t = 0; t < 200; ++t)
+    {
+        int num_blocks = 1 + rng() % (t % 2 ? 5 : 40); // 40 blockは複数のグループにまたがる
+        vector<string> rand_blocks(num_blocks);
+        for (auto & block : rand_blocks)
+        {
+            int len_block = 1 + rng() % 12;
+            for (int i = 0; i < len_block; ++i) block += bases[rng() % 4];
+        }
+        string rand_seq;
+        int num_units = rng() % 12;
+        for (int u = 0; u < num_units; ++u)
+        {
+            for (char c : rand_blocks[rng() % num_blocks])
+            {
+                int r = rng() % 20;
+                if (r == 0)      continue;                         // 欠失
+                else if (r == 1) rand_seq += bases[rng() % 4];     // 置換
+                else             rand_seq += c;
+                if (rng() % 20 == 0) rand_seq += bases[rng() % 4]; // 挿入
+            }
+        }
+
+        StringDecomposer full(rand_seq, rand_blocks);
+        full.decompose();
+        if (full.get_score() != reference_score(rand_seq, rand_blocks) || path_score(rand_seq, rand_blocks, full.get_path()) != full.get_score())
+        {
+            cout << "Invalid case found" << "\n";
+            cout << "seq: " << rand_seq << "\n";
+            return 1;
+        }
+        for (auto mode : {DecomposeMode::ROLLING, DecomposeMode::CHECKPOINTED})
+        {
+            StringDecomposer compact(rand_seq, rand_blocks);
+            compact.set_mode(mode);
+            compact.set_memory_budget(1 + rng() % 1024); // 区間が数列になるくらい小さくする
+            compact.set_simd(t % 3 != 0);
+            compact.decompose();
+            if (compact.get_score() != full.get_score() || compact.get_path() != full.get_path() || compact.get_decomp() != full.get_decomp())
+            {
+                cout << "Invalid case found" << "\n";
+                cout << "seq: " << rand_seq << "\n";
+                return 1;
+            }
+        }
+    }
+
+    // blockと似ていない配列と短いblock(1塩基を含む)ではblockの最後の行の最大値が負になり、行0からの欠失の鎖で緩和されるセルが多い
+    // (行0を列を埋める前の値のまま欠失に使うとtrace backが循環していた). 全てのモードが終わり、最適スコアがreference_scoreと、
+    // pathのスコアがget_score()と一致し、どのモードもFULLと同じpathになるか確かめる
+    for (int t = 0; t < 100; ++t)
+    {
+        vector<string> rand_blocks(12);
+        for (auto & block : rand_blocks)
+        {
+            int len_block = 1 + rng() % (t % 2 ? 4 : 30);
+            for (int i = 0; i < len_block; ++i) block += bases[rng() % 4];
+        }
+        rand_blocks[rng() % 12] = "G";
+        string rand_seq;
+        for (int i = 0; i < 149; ++i) rand_seq += bases[rng() % 4];
+
+        StringDecomposer full(rand_seq, rand_blocks);
+        full.decompose();
+        bool ok = full.get_score() == reference_score(rand_seq, rand_blocks) && path_score(rand_seq, rand_blocks, full.get_path()) == full.get_score();
+        for (auto mode : {DecomposeMode::ROLLING, DecomposeMode::CHECKPOINTED})
+        {
+            for (bool use_simd : {false, true})
+            {
+                StringDecomposer compact(rand_seq, rand_blocks);
+                compact.set_mode(mode);
+                compact.set_simd(use_simd);
+                compact.set_memory_budget(4096);
+                compact.decompose();
+                ok = ok && compact.get_score() == full.get_score() && compact.get_path() == full.get_path();
+            }
+        }
+        if (!ok)
+        {
+            cout << "Invalid case found" << "\n";
+            cout << "seq: " << rand_seq << "\n";
+            return 1;
+        }
+    }
+
+    // DECOMP_INT16_MAX_LENより長いblockはintのセルで計算する
+    {
+        vector<string> long_blocks = {string(DECOMP_INT16_MAX_LEN + 10, 'A'), "ACGT"};
+        for (int i = 0; i < DECOMP_INT16_MAX_LEN + 10; i += 7) long_blocks[0][i] = 'C';
+        string long_seq = "ACGTAC" + long_blocks[0].substr(0, 40) + "ACGT";
+        StringDecomposer full(long_seq, long_blocks);
+        full.decompose();
+        StringDecomposer compact(long_seq, long_blocks);
+        compact.set_mode(DecomposeMode::ROLLING);
+        compact.decompose();
+        if (compact.get_score() != full.get_score() || compact.get_path() != full.get_path()) cout << "Invalid case found" << "\n";
+    }
+
     /*string seq = "ACGTCGC";
     vector<string> blocks = {"ACGT", "ATAT", "CGCG"};*/
     string seq = "ACGTACGTACCTACGTTCGTACGT";
@@ -196,4 +811,5 @@ int main()
     }
     cout << "\n";
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,128 @@
+//--------------------------------------------------------------------------------------------------------
+// StringDecomposer.cppのモードとカーネルごとのベンチマーク
+// 12個の171塩基のモノマーからなるHOR (互いに約20%異なる)をコピーごとに約1%変異させながら並べた配列を長さを倍にしながら作り、
+// モノマーをblockとして分解したときの時間と1秒あたりのセル数(配列長 * blockの長さの合計)をCSVで出力する
+// 全てのモードとカーネルのpath_とスコアが最初のもの(長さがFULLの上限以下ならFULL、それより長ければrolling-scalar)と一致するかも確かめる
+// Usage: ./StringDecomposerBenchmark [最大長 = 1000000] [FULLを使う最大長 = 20000] [seed = 1] > result.csv
+// To compile, perform: g++ -std=c++20 -O2 -Wall --pedantic-errors -o StringDecomposerBenchmark StringDecomposerBenchmark.cpp
+//--------------------------------------------------------------------------------------------------------
+#define STRINGDECOMPOSER_NO_MAIN
+#include "StringDecomposer.cpp"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+using namespace std;
+
+struct StringDecomposerBenchmark
+{
+    public:
+        StringDecomposerBenchmark(const unsigned seed)
+            : rng_(seed)
+            {}
+
+        // モードの名前と、decomposeの前にStringDecomposerに設定する関数
+        void add_engine(const string & name, const function<void(StringDecomposer &)> & configure) { engines_.emplace_back(name, configure); }
+
+        // 一致しなかった行数を返す
+        int run(const vector<int> & lengths, const int max_full_len)
+        {
+            cout << "length,num_blocks,engine,kernel,sec,cells_per_sec,score,check\n";
+            make_hor();
+            int num_mismatches = 0;
+            for (int len : lengths)
+            {
+                string seq = make_centromeric(len);
+                long long num_cells = 0;
+                for (auto & monomer : monomers_) num_cells += (long long)monomer.size() * len;
+
+                vector<tuple<int, int, int>> expected;
+                int expected_score = 0;
+                for (const auto & [name, configure] : engines_)
+                {
+                    if (name == "full" && len > max_full_len) continue;
+                    StringDecomposer decomposer(seq, monomers_);
+                    configure(decomposer);
+                    auto start = chrono::steady_clock::now();
+                    decomposer.decompose();
+                    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+                    bool ok = true;
+                    if (expected.empty())
+                    {
+                        expected = decomposer.get_path();
+                        expected_score = decomposer.get_score();
+                    }
+                    else ok = (decomposer.get_path() == expected && decomposer.get_score() == expected_score);
+                    if (!ok)
+                    {
+                        num_mismatches++;
+                        cerr << "MISMATCH: " << len << " " << name << "\n";
+                    }
+                    cout << len << "," << monomers_.size() << "," << name << "," << (name == "full" ? "scalar" : decomposer.get_kernel_name()) << ","
+                         << sec << "," << (sec > 0.0 ? num_cells / sec : 0.0) << "," << decomposer.get_score() << "," << (ok ? "ok" : "MISMATCH") << "\n";
+                }
+            }
+            return num_mismatches;
+        }
+
+    private:
+        mt19937                                                      rng_;
+        vector<pair<string, function<void(StringDecomposer &)>>>     engines_;
+        vector<string>                                               monomers_;
+
+        char random_base() { return "ACGT"[rng_() % 4]; }
+
+        void make_hor()
+        {
+            const int monomer_len = 171;
+            const int num_monomers = 12;
+            string monomer;
+            for (int i = 0; i < monomer_len; i++) monomer += random_base();
+            monomers_.assign(num_monomers, "");
+            for (auto & m : monomers_)
+            {
+                for (int i = 0; i < monomer_len; i++) m += (rng_() % 5 == 0) ? random_base() : monomer[i];
+            }
+        }
+
+        // HORをコピーごとに約1%の置換と約0.5%の挿入、欠失を入れて並べる
+        string make_centromeric(const int len)
+        {
+            string seq;
+            while (static_cast<int>(seq.size()) < len)
+            {
+                for (auto & m : monomers_)
+                {
+                    for (char c : m)
+                    {
+                        int r = rng_() % 200;
+                        if (r == 0)     continue;
+                        else if (r < 3) seq += random_base();
+                        else            seq += c;
+                        if (r == 3) seq += random_base();
+                    }
+                }
+            }
+            seq.resize(len);
+            return seq;
+        }
+};
+
+int main(int argc, char ** argv)
+{
+    int max_len      = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int max_full_len = (argc > 2) ? atoi(argv[2]) : 20000;
+    unsigned seed    = (argc > 3) ? atoi(argv[3]) : 1;
+
+    vector<int> lengths;
+    for (int len = 10000; len <= max_len; len *= 2) lengths.push_back(len);
+
+    StringDecomposerBenchmark benchmark(seed);
+    benchmark.add_engine("full",           [](StringDecomposer & d) { d.set_mode(DecomposeMode::FULL); });
+    benchmark.add_engine("rolling-scalar", [](StringDecomposer & d) { d.set_mode(DecomposeMode::ROLLING); d.set_simd(false); });
+    benchmark.add_engine("rolling",        [](StringDecomposer & d) { d.set_mode(DecomposeMode::ROLLING); });
+    benchmark.add_engine("checkpointed",   [](StringDecomposer & d) { d.set_mode(DecomposeMode::CHECKPOINTED); d.set_memory_budget(64 << 20); });
+    int num_mismatches = benchmark.run(lengths, max_full_len);
+    cerr << num_mismatches << " mismatches\n";
+    return (num_mismatches == 0) ? 0 : 1;
+}